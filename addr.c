@@ -0,0 +1,186 @@
+#include "defs.h"
+
+
+// Address mode folding.
+//
+// x86 loads and stores can address base + index * scale + disp in a single
+// instruction. Element accesses are rewritten so the constant parts of the
+// index move into the scale and displacement and only the variable part is
+// left for the code generator to compute (int a[]):
+//
+//   a[i + 3]   ->  a[i], scale 4, disp 12
+//   a[i * 2]   ->  a[i], scale 8
+//   a[5]       ->  a[],  scale 4, disp 20
+//   *(p + i)   ->  p[i]
+//
+// A scale is only folded while it remains 1, 2, 4 or 8 and the displacement
+// has to fit in the signed 32 bit field of the encoding.
+
+
+typedef struct {
+  uint32_t folded;
+  uint32_t derefs;
+} addr_t;
+
+static bool addrIsScale(int64_t scale) {
+  return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
+
+static bool addrDisp(ast_node_p n, int64_t add) {
+  const int64_t disp = n->exprIndex.disp + add;
+  if (disp < INT32_MIN || disp > INT32_MAX) {
+    return false;
+  }
+  n->exprIndex.disp = disp;
+  return true;
+}
+
+static bool addrFoldOnce(ast_node_p n) {
+
+  ast_node_p i = n->exprIndex.index;
+  const int64_t scale = n->exprIndex.scale;
+  int64_t c;
+
+  if (!i) {
+    return false;
+  }
+
+  // a[C]
+  if (aIntLitValue(i, &c)) {
+    if (!addrDisp(n, c * scale)) {
+      return false;
+    }
+    n->exprIndex.index = NULL;
+    return true;
+  }
+
+  // only plain integer arithmetic, not pointer steps
+  if (i->type != AST_EXPR_BIN_OP || i->exprBinOp.scale) {
+    return false;
+  }
+  ast_node_p l = i->exprBinOp.lhs;
+  ast_node_p r = i->exprBinOp.rhs;
+
+  switch (i->exprBinOp.op.type) {
+  case TOK_ADD:
+    // a[i + C], a[C + i]
+    if (aIntLitValue(r, &c) && addrDisp(n, c * scale)) {
+      n->exprIndex.index = l;
+      return true;
+    }
+    if (aIntLitValue(l, &c) && addrDisp(n, c * scale)) {
+      n->exprIndex.index = r;
+      return true;
+    }
+    break;
+  case TOK_SUB:
+    // a[i - C]
+    if (aIntLitValue(r, &c) && addrDisp(n, -c * scale)) {
+      n->exprIndex.index = l;
+      return true;
+    }
+    break;
+  case TOK_MUL:
+    // a[i * C], a[C * i]
+    if (aIntLitValue(r, &c) && addrIsScale(c * scale)) {
+      n->exprIndex.index = l;
+      n->exprIndex.scale = (uint32_t)(c * scale);
+      return true;
+    }
+    if (aIntLitValue(l, &c) && addrIsScale(c * scale)) {
+      n->exprIndex.index = r;
+      n->exprIndex.scale = (uint32_t)(c * scale);
+      return true;
+    }
+    break;
+  case TOK_SHL:
+    // a[i << C]
+    if (aIntLitValue(r, &c) && c >= 0 && c <= 3 && addrIsScale(scale << c)) {
+      n->exprIndex.index = l;
+      n->exprIndex.scale = (uint32_t)(scale << c);
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return false;
+}
+
+static bool addrIsPtr(ast_node_p n) {
+  return n->decorate.type && n->decorate.type->ptrLevel;
+}
+
+static void addrDeref(addr_t *a, ast_node_p n) {
+
+  // *(p + i), *(i + p), *(p - i)
+  ast_node_p e = n->exprUnaryOp.rhs;
+  if (!tIs(&n->exprUnaryOp.op, TOK_MUL) ||
+      e->type != AST_EXPR_BIN_OP || !e->exprBinOp.scale) {
+    return;
+  }
+
+  ast_node_p base  = e->exprBinOp.lhs;
+  ast_node_p index = e->exprBinOp.rhs;
+  if (tIs(&e->exprBinOp.op, TOK_ADD) && addrIsPtr(index)) {
+    base  = e->exprBinOp.rhs;
+    index = e->exprBinOp.lhs;
+  }
+  if (!addrIsPtr(base) || addrIsPtr(index)) {
+    return;
+  }
+  if (tIs(&e->exprBinOp.op, TOK_SUB)) {
+    ast_node_p neg = aNodeNew(AST_EXPR_UNARY_OP);
+    neg->exprUnaryOp.op  = tMake(TOK_SUB, e->exprBinOp.op.line);
+    neg->exprUnaryOp.rhs = index;
+    index = neg;
+  }
+
+  ast_node_p x = aNodeNew(AST_EXPR_INDEX);
+  x->exprIndex.token = tMake(TOK_LBRACKET, n->exprUnaryOp.op.line);
+  x->exprIndex.base  = base;
+  x->exprIndex.index = index;
+  x->exprIndex.scale = e->exprBinOp.scale;
+  x->decorate.type   = n->decorate.type;
+  aNodeReplace(n, x);
+
+  a->derefs++;
+}
+
+static void addrWalk(addr_t *a, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      addrWalk(a, *slots[i]);
+    }
+
+    if (n->type == AST_EXPR_UNARY_OP) {
+      addrDeref(a, n);
+    }
+
+    if (n->type == AST_EXPR_INDEX) {
+      bool folded = false;
+      while (addrFoldOnce(n)) {
+        folded = true;
+      }
+      a->folded += folded ? 1 : 0;
+    }
+  }
+}
+
+void oAddrMode(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  addr_t a;
+  memset(&a, 0, sizeof(a));
+
+  addrWalk(&a, n->root.node);
+
+  if (opt->stats) {
+    fprintf(opt->out, "addr: %u folded, %u derefs\n", a.folded, a.derefs);
+  }
+}
@@ -1,14 +1,38 @@
 #include "defs.h"
 
 
+// nodes allocated and not freed yet
+static _Thread_local uint32_t aLive;
+
 ast_node_p aNodeNew(ast_node_type_t type) {
   ast_node_p node = malloc(sizeof(ast_node_t));
   assert(node);
   memset(node, 0, sizeof(ast_node_t));
   node->type = type;
+  aLive++;
   return node;
 }
 
+void aNodeFree(ast_node_p n) {
+  // n, its siblings following it and everything below them
+  while (n) {
+    ast_node_p next = n->next;
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      aNodeFree(*slots[i]);
+    }
+    free(n->decorate.type);
+    free(n);
+    aLive--;
+    n = next;
+  }
+}
+
+uint32_t aNodeLive(void) {
+  return aLive;
+}
+
 ast_node_p aNodeInsert(ast_node_p chain, ast_node_p toInsert) {
 
   toInsert->next = NULL;
@@ -23,117 +47,171 @@ ast_node_p aNodeInsert(ast_node_p chain, ast_node_p toInsert) {
   return chain;
 }
 
-static void aDumpNode(ast_node_p n, int level) {
+void aNodeInsertAfter(ast_node_p chain, ast_node_p pos, ast_node_p toInsert) {
+
+  assert(chain && pos);
+
+  toInsert->next = pos->next;
+  pos->next      = toInsert;
+
+  if (chain->last == pos) {
+    chain->last = toInsert;
+  }
+}
+
+static const char *aSwitchLowerName(switch_lower_t lower) {
+  switch (lower) {
+  case SWITCH_LOWER_TABLE:   return ", table";
+  case SWITCH_LOWER_BITTEST: return ", bittest";
+  case SWITCH_LOWER_BSEARCH: return ", bsearch";
+  default:                   return "";
+  }
+}
+
+static void aDumpNode(ast_node_p n, int level, FILE *out) {
 
   for (int i=0; i<level; ++i) {
-    printf(". ");
+    fprintf(out, ". ");
   }
 
   switch (n->type) {
   case AST_ROOT:
-    printf("AST_ROOT\n");
+    fprintf(out, "AST_ROOT\n");
     break;
   case AST_DECL_TYPE:
-    printf("AST_DECL_TYPE %.*s, line:%d\n",
+    fprintf(out, "AST_DECL_TYPE %.*s, line:%d\n",
       tSize(&n->declType.token),
       n->declType.token.start,
       tLineNum(&n->declType.token));
     break;
   case AST_DECL_VAR:
     if (n->declVar.ident.type == TOK_UNKNOWN) {
-      printf("AST_DECL_VAR <none>:\n");
+      fprintf(out, "AST_DECL_VAR <none>:\n");
     }
     else {
-      printf("AST_DECL_VAR %.*s, line:%d\n",
+      fprintf(out, "AST_DECL_VAR %.*s, line:%d%s\n",
         tSize(&n->declVar.ident),
         n->declVar.ident.start,
-        tLineNum(&n->declVar.ident));
+        tLineNum(&n->declVar.ident),
+        n->declVar.isRegister ? ", reg" : "");
     }
     break;
   case AST_DECL_FUNC:
-    printf("AST_DECL_FUNC %.*s, line:%d\n",
+    fprintf(out, "AST_DECL_FUNC %.*s, line:%d\n",
       tSize(&n->declFunc.ident),
       n->declFunc.ident.start,
       tLineNum(&n->declVar.ident));
     break;
   case AST_STMT_RETURN:
-    printf("AST_STMT_RETURN, line:%d\n",
+    fprintf(out, "AST_STMT_RETURN, line:%d\n",
       tLineNum(&n->stmtReturn.token));
     break;
   case AST_STMT_EXPR:
-    printf("AST_STMT_EXPR\n");
+    fprintf(out, "AST_STMT_EXPR\n");
     break;
   case AST_STMT_COMPOUND:
-    printf("AST_STMT_COMPOUND\n");
+    fprintf(out, "AST_STMT_COMPOUND\n");
     break;
   case AST_STMT_IF:
-    printf("AST_STMT_IF, line:%d\n",
+    fprintf(out, "AST_STMT_IF, line:%d\n",
       tLineNum(&n->stmtIf.token));
     break;
   case AST_STMT_WHILE:
-    printf("AST_STMT_WHILE, line:%d\n",
+    fprintf(out, "AST_STMT_WHILE, line:%d\n",
       tLineNum(&n->stmtWhile.token));
     break;
   case AST_STMT_BREAK:
-    printf("AST_STMT_BREAK, line:%d\n",
+    fprintf(out, "AST_STMT_BREAK, line:%d\n",
       tLineNum(&n->stmtBreak.token));
     break;
   case AST_STMT_CONTINUE:
-    printf("AST_STMT_CONTINUE, line:%d\n",
+    fprintf(out, "AST_STMT_CONTINUE, line:%d\n",
       tLineNum(&n->stmtContinue.token));
     break;
+  case AST_STMT_SWITCH:
+    fprintf(out, "AST_STMT_SWITCH, line:%d%s\n",
+      tLineNum(&n->stmtSwitch.token),
+      aSwitchLowerName(n->stmtSwitch.lower));
+    break;
+  case AST_STMT_CASE:
+    fprintf(out, "AST_STMT_CASE, line:%d\n",
+      tLineNum(&n->stmtCase.token));
+    break;
+  case AST_STMT_DEFAULT:
+    fprintf(out, "AST_STMT_DEFAULT, line:%d\n",
+      tLineNum(&n->stmtDefault.token));
+    break;
   case AST_EXPR_IDENT:
-    printf("AST_EXPR_IDENT %.*s, line:%d\n",
+    fprintf(out, "AST_EXPR_IDENT %.*s, line:%d\n",
       tSize(&n->exprIdent.ident),
       n->exprIdent.ident.start,
       tLineNum(&n->exprIdent.ident));
     break;
   case AST_EXPR_INT_LIT:
-    printf("AST_EXPR_INT_LIT %.*s, line:%d\n",
+    fprintf(out, "AST_EXPR_INT_LIT %.*s, line:%d\n",
       tSize(&n->exprIntLit.token),
       n->exprIntLit.token.start,
       tLineNum(&n->exprIntLit.token));
     break;
   case AST_EXPR_BIN_OP:
-    printf("AST_EXPR_BIN_OP %.*s, line:%d\n",
+    fprintf(out, "AST_EXPR_BIN_OP %.*s, line:%d",
       tSize(&n->exprBinOp.op),
       n->exprBinOp.op.start,
       tLineNum(&n->exprBinOp.op));
+    if (n->exprBinOp.scale) {
+      fprintf(out, ", scale %u", n->exprBinOp.scale);
+    }
+    fprintf(out, "\n");
     break;
   case AST_STMT_DO:
-    printf("AST_STMT_DO, line:%d\n",
+    fprintf(out, "AST_STMT_DO, line:%d\n",
       tLineNum(&n->stmtDo.token));
     break;
   case AST_STMT_FOR:
-    printf("AST_STMT_FOR, line:%d\n",
+    fprintf(out, "AST_STMT_FOR, line:%d",
       tLineNum(&n->stmtFor.token));
+    if (n->stmtFor.lanes) {
+      fprintf(out, ", vector %u", n->stmtFor.lanes);
+    }
+    fprintf(out, "\n");
     break;
   case AST_EXPR_UNARY_OP:
-    printf("AST_EXPR_UNARY_OP %.*s, line:%d\n",
+    fprintf(out, "AST_EXPR_UNARY_OP %.*s, line:%d\n",
       tSize(&n->exprUnaryOp.op),
       n->exprUnaryOp.op.start,
       tLineNum(&n->exprUnaryOp.op));
     break;
   case AST_EXPR_CALL:
-    printf("AST_EXPR_CALL %.*s, line:%d\n",
+    fprintf(out, "AST_EXPR_CALL %.*s, line:%d%s\n",
       tSize(&n->exprCall.ident),
       n->exprCall.ident.start,
-      tLineNum(&n->exprCall.ident));
+      tLineNum(&n->exprCall.ident),
+      n->exprCall.isTail ? ", tail" : "");
     break;
   case AST_EXPR_CAST:
-    printf("AST_EXPR_CAST, line:%d\n",
+    fprintf(out, "AST_EXPR_CAST, line:%d\n",
       tLineNum(&n->exprCall.ident));
     break;
+  case AST_EXPR_INDEX:
+    fprintf(out, "AST_EXPR_INDEX, line:%d, scale %u",
+      tLineNum(&n->exprIndex.token),
+      n->exprIndex.scale);
+    if (n->exprIndex.disp) {
+      fprintf(out, ", disp %lld", (long long)n->exprIndex.disp);
+    }
+    fprintf(out, "\n");
+    break;
   default:
     assert(!"unhandled node type");
   }
 }
 
-typedef void (*ast_walk_func_t)(ast_node_p node, int level);
+typedef void (*ast_walk_func_t)(ast_node_p node, int level, FILE *out);
 
-static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level) {
+static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level,
+                  FILE *out) {
 
-#define WALK(NODE) { aWalk(NODE, preFunc, level+1); }
+#define WALK(NODE) { aWalk(NODE, preFunc, level+1, out); }
 
   if (!n) {
     return;
@@ -141,7 +219,7 @@ static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level) {
 
   do {
     if (preFunc) {
-      preFunc(n, level);
+      preFunc(n, level, out);
     }
 
     switch (n->type) {
@@ -152,6 +230,7 @@ static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level) {
       break;
     case AST_DECL_VAR:
       WALK(n->declVar.type);
+      WALK(n->declVar.size);
       WALK(n->declVar.expr);
       break;
     case AST_DECL_FUNC:
@@ -199,6 +278,15 @@ static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level) {
       WALK(n->stmtFor.update);
       WALK(n->stmtFor.body);
       break;
+    case AST_STMT_SWITCH:
+      WALK(n->stmtSwitch.expr);
+      WALK(n->stmtSwitch.body);
+      break;
+    case AST_STMT_CASE:
+      WALK(n->stmtCase.expr);
+      break;
+    case AST_STMT_DEFAULT:
+      break;
     case AST_EXPR_UNARY_OP:
       WALK(n->exprUnaryOp.rhs);
       break;
@@ -209,6 +297,10 @@ static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level) {
       WALK(n->exprCast.type);
       WALK(n->exprCast.expr);
       break;
+    case AST_EXPR_INDEX:
+      WALK(n->exprIndex.base);
+      WALK(n->exprIndex.index);
+      break;
     default:
       assert(!"unhandled node type");
     }
@@ -218,6 +310,352 @@ static void aWalk(ast_node_p n, ast_walk_func_t preFunc, int level) {
 #undef WALK
 }
 
-void aDump(ast_node_p n) {
-  aWalk(n, aDumpNode, 0);
+void aDump(ast_node_p n, FILE *out) {
+  aWalk(n, aDumpNode, 0, out);
+}
+
+void aDumpDepth(ast_node_p n, int level, FILE *out) {
+  // n and its siblings as if nested level deep
+  aWalk(n, aDumpNode, level, out);
+}
+
+token_t *aToken(ast_node_p n) {
+  // the token a node was parsed from, NULL for nodes without one
+  switch (n->type) {
+  case AST_DECL_TYPE:     return &n->declType.token;
+  case AST_DECL_FUNC:     return &n->declFunc.ident;
+  case AST_DECL_VAR:      return &n->declVar.ident;
+  case AST_STMT_RETURN:   return &n->stmtReturn.token;
+  case AST_STMT_BREAK:    return &n->stmtBreak.token;
+  case AST_STMT_CONTINUE: return &n->stmtContinue.token;
+  case AST_STMT_IF:       return &n->stmtIf.token;
+  case AST_STMT_WHILE:    return &n->stmtWhile.token;
+  case AST_STMT_DO:       return &n->stmtDo.token;
+  case AST_STMT_FOR:      return &n->stmtFor.token;
+  case AST_STMT_SWITCH:   return &n->stmtSwitch.token;
+  case AST_STMT_CASE:     return &n->stmtCase.token;
+  case AST_STMT_DEFAULT:  return &n->stmtDefault.token;
+  case AST_EXPR_IDENT:    return &n->exprIdent.ident;
+  case AST_EXPR_INT_LIT:  return &n->exprIntLit.token;
+  case AST_EXPR_BIN_OP:   return &n->exprBinOp.op;
+  case AST_EXPR_UNARY_OP: return &n->exprUnaryOp.op;
+  case AST_EXPR_CALL:     return &n->exprCall.ident;
+  case AST_EXPR_INDEX:    return &n->exprIndex.token;
+  default:                return NULL;
+  }
+}
+
+uint32_t aChildren(ast_node_p n, ast_node_p *slots[AST_MAX_CHILDREN]) {
+
+  uint32_t count = 0;
+
+#define SLOT(FIELD) { slots[count++] = &(FIELD); }
+
+  switch (n->type) {
+  case AST_ROOT:
+    SLOT(n->root.node);
+    break;
+  case AST_DECL_VAR:
+    SLOT(n->declVar.type);
+    SLOT(n->declVar.size);
+    SLOT(n->declVar.expr);
+    break;
+  case AST_DECL_FUNC:
+    SLOT(n->declFunc.type);
+    SLOT(n->declFunc.args);
+    SLOT(n->declFunc.body);
+    break;
+  case AST_STMT_RETURN:
+    SLOT(n->stmtReturn.expr);
+    break;
+  case AST_STMT_EXPR:
+    SLOT(n->stmtExpr.expr);
+    break;
+  case AST_STMT_COMPOUND:
+    SLOT(n->stmtCompound.stmt);
+    break;
+  case AST_STMT_IF:
+    SLOT(n->stmtIf.expr);
+    SLOT(n->stmtIf.isTrue);
+    SLOT(n->stmtIf.isFalse);
+    break;
+  case AST_STMT_WHILE:
+    SLOT(n->stmtWhile.expr);
+    SLOT(n->stmtWhile.body);
+    break;
+  case AST_STMT_DO:
+    SLOT(n->stmtDo.body);
+    SLOT(n->stmtDo.expr);
+    break;
+  case AST_STMT_FOR:
+    SLOT(n->stmtFor.init);
+    SLOT(n->stmtFor.cond);
+    SLOT(n->stmtFor.update);
+    SLOT(n->stmtFor.body);
+    break;
+  case AST_STMT_SWITCH:
+    SLOT(n->stmtSwitch.expr);
+    SLOT(n->stmtSwitch.body);
+    break;
+  case AST_STMT_CASE:
+    SLOT(n->stmtCase.expr);
+    break;
+  case AST_EXPR_BIN_OP:
+    SLOT(n->exprBinOp.lhs);
+    SLOT(n->exprBinOp.rhs);
+    break;
+  case AST_EXPR_UNARY_OP:
+    SLOT(n->exprUnaryOp.rhs);
+    break;
+  case AST_EXPR_CALL:
+    SLOT(n->exprCall.arg);
+    break;
+  case AST_EXPR_CAST:
+    SLOT(n->exprCast.type);
+    SLOT(n->exprCast.expr);
+    break;
+  case AST_EXPR_INDEX:
+    SLOT(n->exprIndex.base);
+    SLOT(n->exprIndex.index);
+    break;
+  default:
+    break;
+  }
+
+#undef SLOT
+
+  assert(count <= AST_MAX_CHILDREN);
+  return count;
+}
+
+typedef struct {
+  ast_node_p *from;
+  ast_node_p *to;
+  uint32_t    head;
+  uint32_t    max;
+} ast_clone_map_t;
+
+static ast_node_p aChainCloneMap(ast_node_p n, ast_clone_map_t *map);
+
+static ast_node_p aNodeCloneMap(ast_node_p n, ast_clone_map_t *map) {
+
+  ast_node_p c = aNodeNew(n->type);
+  memcpy(c, n, sizeof(ast_node_t));
+  c->next = NULL;
+  c->last = NULL;
+
+  // every node owns its type so a tree can be freed node by node
+  if (n->decorate.type) {
+    c->decorate.type = malloc(sizeof(ast_type_t));
+    assert(c->decorate.type);
+    *c->decorate.type = *n->decorate.type;
+  }
+
+  // record declarations so uses inside the copy can be redirected
+  if (n->type == AST_DECL_VAR) {
+    if (map->head >= map->max) {
+      map->max += 32;
+      map->from = realloc(map->from, map->max * sizeof(ast_node_p));
+      map->to   = realloc(map->to,   map->max * sizeof(ast_node_p));
+      assert(map->from && map->to);
+    }
+    map->from[map->head] = n;
+    map->to  [map->head] = c;
+    map->head++;
+  }
+
+  ast_node_p *slots[AST_MAX_CHILDREN];
+  const uint32_t count = aChildren(c, slots);
+  for (uint32_t i = 0; i < count; ++i) {
+    *slots[i] = aChainCloneMap(*slots[i], map);
+  }
+
+  return c;
+}
+
+static ast_node_p aChainCloneMap(ast_node_p n, ast_clone_map_t *map) {
+  ast_node_p out = NULL;
+  for (; n; n = n->next) {
+    out = aNodeInsert(out, aNodeCloneMap(n, map));
+  }
+  return out;
+}
+
+static void aCloneRemap(ast_node_p n, ast_clone_map_t *map) {
+  for (; n; n = n->next) {
+    ast_node_p *decl = NULL;
+    if (n->type == AST_EXPR_IDENT) {
+      decl = &n->exprIdent.decl;
+    }
+    if (decl && *decl) {
+      for (uint32_t i = 0; i < map->head; ++i) {
+        if (map->from[i] == *decl) {
+          *decl = map->to[i];
+          break;
+        }
+      }
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      aCloneRemap(*slots[i], map);
+    }
+  }
+}
+
+ast_node_p aNodeClone(ast_node_p n) {
+  // deep copy of a node and its children but not its siblings
+  ast_clone_map_t map = { NULL, NULL, 0, 0 };
+  ast_node_p c = aNodeCloneMap(n, &map);
+  c->last = c;
+  aCloneRemap(c, &map);
+  free(map.from);
+  free(map.to);
+  return c;
+}
+
+void aNodeReplace(ast_node_p n, ast_node_p with) {
+  // overwrite a node in place keeping its position in the parent chain
+  ast_node_p next = n->next;
+  ast_node_p last = n->last;
+  memcpy(n, with, sizeof(ast_node_t));
+  n->next = next;
+  n->last = last;
+}
+
+uint32_t aNodeCount(ast_node_p n) {
+  uint32_t count = 0;
+  for (; n; n = n->next) {
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t num = aChildren(n, slots);
+    for (uint32_t i = 0; i < num; ++i) {
+      count += aNodeCount(*slots[i]);
+    }
+    ++count;
+  }
+  return count;
+}
+
+ast_node_p aIntLitNew(int64_t value, uint32_t line) {
+  char buf[32];
+  const int len = snprintf(buf, sizeof(buf), "%lld", (long long)value);
+  char *text = malloc(len + 1);
+  assert(text);
+  memcpy(text, buf, len + 1);
+
+  ast_node_p n = aNodeNew(AST_EXPR_INT_LIT);
+  n->exprIntLit.token.type  = TOK_INT_LIT;
+  n->exprIntLit.token.line  = line;
+  n->exprIntLit.token.start = text;
+  n->exprIntLit.token.end   = text + len;
+  return n;
+}
+
+ast_node_p aIntNew(int64_t value, uint32_t line) {
+  // negative values are spelled the way the parser produces them
+  if (value >= 0) {
+    return aIntLitNew(value, line);
+  }
+  ast_node_p n = aNodeNew(AST_EXPR_UNARY_OP);
+  n->exprUnaryOp.op  = tMake(TOK_SUB, line);
+  n->exprUnaryOp.rhs = aIntLitNew(-value, line);
+  return n;
+}
+
+int64_t aWrapToType(int64_t value, const ast_type_t *t) {
+  // value the way a variable of type t holds it, int when t is NULL
+  const uint32_t width = t ? t->width : 4;
+  switch (width) {
+  case 1:  return (int8_t)value;
+  case 2:  return (int16_t)value;
+  default: return (int32_t)(uint32_t)value;
+  }
+}
+
+bool aIntLitValue(ast_node_p n, int64_t *out) {
+
+  if (!n) {
+    return false;
+  }
+
+  // fold a leading unary minus into the literal
+  if (n->type == AST_EXPR_UNARY_OP && tIs(&n->exprUnaryOp.op, TOK_SUB)) {
+    if (!aIntLitValue(n->exprUnaryOp.rhs, out)) {
+      return false;
+    }
+    *out = -*out;
+    return true;
+  }
+
+  if (n->type != AST_EXPR_INT_LIT) {
+    return false;
+  }
+
+  int64_t value = 0;
+  const token_t *t = &n->exprIntLit.token;
+  for (const char *p = t->start; p != t->end; ++p) {
+    value = value * 10 + (*p - '0');
+    if (value > INT32_MAX) {
+      return false;
+    }
+  }
+  *out = value;
+  return true;
+}
+
+ast_node_p aIdentNew(ast_node_p decl, uint32_t line) {
+  assert(decl->type == AST_DECL_VAR);
+  ast_node_p n = aNodeNew(AST_EXPR_IDENT);
+  n->exprIdent.ident = decl->declVar.ident;
+  n->exprIdent.ident.line = line;
+  n->exprIdent.decl = decl;
+  return n;
+}
+
+ast_node_p aBinOpNew(token_type_t op, ast_node_p lhs, ast_node_p rhs, uint32_t line) {
+  ast_node_p n = aNodeNew(AST_EXPR_BIN_OP);
+  n->exprBinOp.op  = tMake(op, line);
+  n->exprBinOp.lhs = lhs;
+  n->exprBinOp.rhs = rhs;
+  return n;
+}
+
+static bool aIsQualifier(ast_node_p type) {
+  return tIs(&type->declType.token, TOK_CONST) ||
+         tIs(&type->declType.token, TOK_STATIC);
+}
+
+bool aIsVoidType(ast_node_p type) {
+  // plain void, void* is a value
+  while (type && aIsQualifier(type)) {
+    type = type->next;
+  }
+  return type && tIs(&type->declType.token, TOK_VOID) && !type->next;
+}
+
+bool aIsStatic(ast_node_p type) {
+  for (; type; type = type->next) {
+    if (tIs(&type->declType.token, TOK_STATIC)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+ast_node_p aTypeUnqual(ast_node_p type) {
+  // copy of a type without const and static, for compiler temporaries
+  ast_node_p out = NULL;
+  for (; type; type = type->next) {
+    if (!aIsQualifier(type)) {
+      out = aNodeInsert(out, aNodeClone(type));
+    }
+  }
+  return out;
+}
+
+bool aIsVoidArgs(ast_node_p args) {
+  // f(void)
+  return args && !args->next &&
+         !tIs(&args->declVar.ident, TOK_IDENT) &&
+         aIsVoidType(args->declVar.type);
 }
@@ -0,0 +1,75 @@
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Rebuild time of one large file with --cache after editing a single
+# function, against compiling it without the cache:
+#
+#   python3 benchcache.py [functions] [passes...]
+#
+# 'unchanged' is answered by the whole file entry, 'one edit' only runs the
+# passes over the edited function and reads the others back.
+
+
+def findDriver():
+    winPath = 'build/debug/compiler.exe'
+    lnxPath = './compiler'
+    if os.path.exists(winPath):
+        return winPath
+    if os.path.exists(lnxPath):
+        return lnxPath
+    return 'unknown'
+
+DRIVER = findDriver()
+
+
+def make_file(path, count, edit):
+    lines = ['int g;', '']
+    for f in range(count):
+        step = f + 2 + (1 if f == edit else 0)
+        lines += ['int f{}(int n) {{'.format(f),
+                  '    int s;',
+                  '    int i;',
+                  '    s = 0;',
+                  '    for (i = 0; i < 16; i = i + 1) {',
+                  '        if (i & n) {',
+                  '            s = s + i * {};'.format(step),
+                  '        }',
+                  '        else {',
+                  '            s = s - g;',
+                  '        }',
+                  '    }',
+                  '    return s;',
+                  '}',
+                  '']
+    lines += ['int main(void) {', '    return f0(8);', '}', '']
+    with open(path, 'w') as fd:
+        fd.write('\n'.join(lines))
+
+
+def run(args):
+    start = time.perf_counter()
+    subprocess.run([DRIVER] + args, stdout=subprocess.DEVNULL, check=False)
+    return time.perf_counter() - start
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+    passes = sys.argv[2:] or ['-funroll', '-fpeephole', '-fif-convert']
+
+    with tempfile.TemporaryDirectory() as dir:
+        path = os.path.join(dir, 'bench.c')
+        cache = ['--cache=' + os.path.join(dir, 'cache')]
+
+        make_file(path, count, -1)
+        print('{:<12} {:>10.3f} s'.format('no cache', run(passes + [path])))
+        print('{:<12} {:>10.3f} s'.format('cold', run(passes + cache + [path])))
+        print('{:<12} {:>10.3f} s'.format('unchanged', run(passes + cache + [path])))
+
+        make_file(path, count, count // 2)
+        print('{:<12} {:>10.3f} s'.format('one edit', run(passes + cache + [path])))
+
+main()
@@ -0,0 +1,86 @@
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Files per second when compiling many files in one process with -j,
+# against starting the driver once for each file:
+#
+#   python3 benchjobs.py [files] [passes...]
+
+
+def findDriver():
+    winPath = 'build/debug/compiler.exe'
+    lnxPath = './compiler'
+    if os.path.exists(winPath):
+        return winPath
+    if os.path.exists(lnxPath):
+        return lnxPath
+    return 'unknown'
+
+DRIVER = findDriver()
+
+
+def make_func(rnd, index):
+    # a few loops and branches over locals, sized at random so some
+    # files take much longer than others
+    lines = ['int f{}(int n) {{'.format(index),
+             '    int s;',
+             '    int i;',
+             '    s = 0;']
+    for k in range(rnd.randint(1, 12)):
+        lines += ['    for (i = 0; i < n; i = i + 1) {',
+                  '        if (i & {}) {{'.format(k + 1),
+                  '            s = s + i * {};'.format(k + 2),
+                  '        }',
+                  '        else {',
+                  '            s = s - {};'.format(k),
+                  '        }',
+                  '    }']
+    lines += ['    return s;', '}', '']
+    return lines
+
+
+def make_files(dir, count):
+    rnd = random.Random(1)
+    paths = []
+    for i in range(count):
+        lines = []
+        funcs = rnd.choice([2, 4, 8, 64])
+        for f in range(funcs):
+            lines += make_func(rnd, f)
+        lines += ['int main(void) {', '    return f0(8);', '}', '']
+        path = os.path.join(dir, 'bench{}.c'.format(i))
+        with open(path, 'w') as fd:
+            fd.write('\n'.join(lines))
+        paths += [path]
+    return paths
+
+
+def run(args):
+    start = time.perf_counter()
+    subprocess.run([DRIVER] + args, stdout=subprocess.DEVNULL, check=False)
+    return time.perf_counter() - start
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 400
+    passes = sys.argv[2:]
+
+    with tempfile.TemporaryDirectory() as dir:
+        paths = make_files(dir, count)
+
+        start = time.perf_counter()
+        for p in paths:
+            run(passes + [p])
+        took = time.perf_counter() - start
+        print('{:<16} {:>10.1f} files/s'.format('process per file', count / took))
+
+        for jobs in [1, 2, 4, 8]:
+            took = run(passes + ['-j', str(jobs)] + paths)
+            print('{:<16} {:>10.1f} files/s'.format('-j {}'.format(jobs), count / took))
+
+main()
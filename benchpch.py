@@ -0,0 +1,77 @@
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Compile time of files including a header of many prototypes, read as text
+# against started from its precompiled snapshot:
+#
+#   python3 benchpch.py [prototypes] [files]
+#
+# 'write' is the one time cost of the snapshot, the other rows compile every
+# file on one thread.
+
+
+def findDriver():
+    winPath = 'build/debug/compiler.exe'
+    lnxPath = './compiler'
+    if os.path.exists(winPath):
+        return winPath
+    if os.path.exists(lnxPath):
+        return lnxPath
+    return 'unknown'
+
+DRIVER = findDriver()
+
+
+def make_header(path, count):
+    lines = ['#ifndef BENCH_H', '#define BENCH_H', '']
+    for f in range(count):
+        lines.append('int f{}(int a, char *p, const int n);'.format(f))
+        if f % 10 == 0:
+            lines.append('const int k{} = {};'.format(f, f))
+    lines += ['', '#endif', '']
+    with open(path, 'w') as fd:
+        fd.write('\n'.join(lines))
+
+
+def make_file(path, header, index, count):
+    lines = ['#include "{}"'.format(header), '']
+    lines += ['int use{}(int a) {{'.format(index),
+              '    return f{}(a, 0, k{}) + f{}(a, 0, 1);'.format(
+                  index % count, (index % count) // 10 * 10, (index * 7) % count),
+              '}', '']
+    with open(path, 'w') as fd:
+        fd.write('\n'.join(lines))
+
+
+def run(args):
+    start = time.perf_counter()
+    proc = subprocess.run([DRIVER] + args, stdout=subprocess.DEVNULL, check=False)
+    if proc.returncode:
+        print('failed: {}'.format(' '.join(args)))
+    return time.perf_counter() - start
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    numFiles = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+
+    with tempfile.TemporaryDirectory() as dir:
+        header = os.path.join(dir, 'bench.h')
+        pch = os.path.join(dir, 'bench.pch')
+        make_header(header, count)
+        files = []
+        for i in range(numFiles):
+            files.append(os.path.join(dir, 'use{}.c'.format(i)))
+            make_file(files[-1], 'bench.h', i, count)
+
+        print('{} prototypes, {} files'.format(count, numFiles))
+        print('{:<12} {:>10.3f} s'.format('text', run(['-j', '1'] + files)))
+        print('{:<12} {:>10.3f} s'.format('write', run(['--pch-write=' + pch, header])))
+        print('{:<12} {:>10.3f} s'.format('snapshot', run(['-j', '1', '--pch=' + pch] + files)))
+        print('{:<12} {:>10} bytes'.format('size', os.path.getsize(pch)))
+
+main()
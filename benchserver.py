@@ -0,0 +1,83 @@
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Latency of a compile through a --server against a cold run of the driver:
+#
+#   python3 benchserver.py [requests] [file.c] [options...]
+#
+# 'client' starts compiler-client for each request, 'socket' keeps one
+# connection open the way a build system embedding the protocol would.
+
+
+def findDriver(name):
+    winPath = 'build/debug/{}.exe'.format(name)
+    lnxPath = './{}'.format(name)
+    if os.path.exists(winPath):
+        return winPath
+    if os.path.exists(lnxPath):
+        return lnxPath
+    return 'unknown'
+
+DRIVER = findDriver('compiler')
+CLIENT = findDriver('compiler-client')
+
+
+def request(sock, args):
+    payload = b''.join(a.encode('utf-8') + b'\0' for a in args)
+    sock.sendall(struct.pack('<I', len(payload)) + payload)
+    head = b''
+    while len(head) < 8:
+        head += sock.recv(8 - len(head))
+    size, status = struct.unpack('<II', head)
+    out = b''
+    while len(out) < size:
+        out += sock.recv(size - len(out))
+    return status, out
+
+
+def timed(count, func):
+    took = []
+    for i in range(count):
+        start = time.perf_counter()
+        func()
+        took += [time.perf_counter() - start]
+    took.sort()
+    return took
+
+
+def report(name, took):
+    ms = [t * 1000 for t in took]
+    print('{:<8} mean {:7.3f} ms  p50 {:7.3f} ms  p99 {:7.3f} ms'.format(
+        name, sum(ms) / len(ms), ms[len(ms) // 2], ms[len(ms) * 99 // 100]))
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    path = os.path.abspath(sys.argv[2] if len(sys.argv) > 2
+                           else 'tests/unroll/unrollPartial.c')
+    args = sys.argv[3:] + [path]
+
+    with tempfile.TemporaryDirectory() as dir:
+        sockPath = os.path.join(dir, 'compiler.sock')
+        server = subprocess.Popen([DRIVER, '--server=' + sockPath])
+        while not os.path.exists(sockPath):
+            time.sleep(0.01)
+
+        quiet = dict(stdout=subprocess.DEVNULL, check=False)
+        report('cold', timed(count, lambda: subprocess.run([DRIVER] + args, **quiet)))
+        report('client', timed(count, lambda: subprocess.run([CLIENT, sockPath] + args, **quiet)))
+
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(sockPath)
+        report('socket', timed(count, lambda: request(sock, args)))
+        request(sock, ['--shutdown'])
+        sock.close()
+        server.wait()
+
+main()
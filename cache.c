@@ -0,0 +1,317 @@
+#include "defs.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+
+// Content addressed cache of compile outputs.
+//
+// The key is a hash of everything the output depends on: the compiler
+// binary, the options and the source. Entries are files named by their key,
+// below a directory for the first byte:
+//
+//   <dir>/3f/a0c15e9b2d4471   output of one compile, or of one function
+//   <dir>/stats               hits misses stores evicted size
+//
+// An entry is written to a temporary file first and renamed into place, so
+// a reader sees a whole entry or none, whichever process wrote it. Reading
+// an entry touches it. Once the entries outgrow the limit, the least
+// recently touched are removed until a fifth of the space is free again.
+// The stats file is locked while it changes, it also keeps two processes
+// from evicting at the same time.
+
+
+#define CA_HASH_INIT  0xcbf29ce484222325ull
+#define CA_HASH_PRIME 0x100000001b3ull
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t evicted;
+  uint64_t size;
+} cache_stats_t;
+
+typedef struct {
+  char    *path;
+  time_t   touched;
+  uint64_t size;
+} cache_entry_t;
+
+static pthread_once_t caBuildOnce = PTHREAD_ONCE_INIT;
+static uint64_t caBuild;
+
+uint64_t caHash(uint64_t hash, const void *data, size_t size) {
+  // FNV-1a, start with caHash(0, ...) and feed the result back in
+  const uint8_t *p = data;
+  if (!hash) {
+    hash = CA_HASH_INIT;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= p[i];
+    hash *= CA_HASH_PRIME;
+  }
+  return hash;
+}
+
+static void caBuildId(void) {
+
+  // any rebuild of the compiler changes its binary and so every key
+  caBuild = caHash(0, __DATE__ __TIME__, strlen(__DATE__ __TIME__));
+  FILE *fd = fopen("/proc/self/exe", "rb");
+  if (!fd) {
+    return;
+  }
+  char buf[1 << 16];
+  for (size_t got; (got = fread(buf, 1, sizeof(buf), fd)) > 0;) {
+    caBuild = caHash(caBuild, buf, got);
+  }
+  fclose(fd);
+}
+
+uint64_t caBuildHash(void) {
+  // the same for every thread of the process, computed once
+  pthread_once(&caBuildOnce, caBuildId);
+  return caBuild;
+}
+
+static void caPath(const cache_t *c, uint64_t key, char *out, size_t size) {
+  snprintf(out, size, "%s/%02x/%014llx", c->dir, (unsigned)(key >> 56),
+           (unsigned long long)(key & 0xffffffffffffffull));
+}
+
+static int caLock(const cache_t *c, cache_stats_t *stats) {
+
+  // returns the locked stats file, read into stats
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/stats", c->dir);
+  memset(stats, 0, sizeof(cache_stats_t));
+  const int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  flock(fd, LOCK_EX);
+
+  char text[256];
+  const ssize_t got = pread(fd, text, sizeof(text) - 1, 0);
+  text[got > 0 ? got : 0] = '\0';
+  unsigned long long v[5] = { 0, 0, 0, 0, 0 };
+  sscanf(text, "%llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4]);
+  stats->hits    = v[0];
+  stats->misses  = v[1];
+  stats->stores  = v[2];
+  stats->evicted = v[3];
+  stats->size    = v[4];
+  return fd;
+}
+
+static void caUnlock(int fd, const cache_stats_t *stats) {
+  char text[256];
+  const int len = snprintf(text, sizeof(text), "%llu %llu %llu %llu %llu\n",
+    (unsigned long long)stats->hits,
+    (unsigned long long)stats->misses,
+    (unsigned long long)stats->stores,
+    (unsigned long long)stats->evicted,
+    (unsigned long long)stats->size);
+  if (ftruncate(fd, 0) != 0 || pwrite(fd, text, (size_t)len, 0) != len) {
+    // the counters are advisory, a lost update does no harm
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+static int caEntryCompare(const void *a, const void *b) {
+  const cache_entry_t *x = a;
+  const cache_entry_t *y = b;
+  if (x->touched != y->touched) {
+    return x->touched < y->touched ? -1 : 1;
+  }
+  return strcmp(x->path, y->path);
+}
+
+static uint64_t caScan(const cache_t *c, cache_entry_t **out, uint32_t *num) {
+
+  // every entry, returns their total size
+  uint64_t total = 0;
+  uint32_t max = 0;
+  *out = NULL;
+  *num = 0;
+
+  DIR *top = opendir(c->dir);
+  if (!top) {
+    return 0;
+  }
+  char path[4096];
+  for (struct dirent *d; (d = readdir(top));) {
+    // only the two hex digit directories hold entries
+    if (strlen(d->d_name) != 2 || !isxdigit((unsigned char)d->d_name[0]) ||
+        !isxdigit((unsigned char)d->d_name[1])) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", c->dir, d->d_name);
+    DIR *sub = opendir(path);
+    if (!sub) {
+      continue;
+    }
+    for (struct dirent *e; (e = readdir(sub));) {
+      struct stat st;
+      if (e->d_name[0] == '.' ||
+          snprintf(path, sizeof(path), "%s/%s/%s",
+                   c->dir, d->d_name, e->d_name) >= (int)sizeof(path) ||
+          stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      if (*num >= max) {
+        max = max ? max * 2 : 256;
+        *out = realloc(*out, max * sizeof(cache_entry_t));
+        assert(*out);
+      }
+      cache_entry_t *entry = &(*out)[(*num)++];
+      entry->path    = strdup(path);
+      entry->touched = st.st_mtime;
+      entry->size    = (uint64_t)st.st_size;
+      total += entry->size;
+    }
+    closedir(sub);
+  }
+  closedir(top);
+  return total;
+}
+
+static void caEvict(const cache_t *c, cache_stats_t *stats) {
+
+  // oldest first, down to four fifths of the limit
+  cache_entry_t *entries;
+  uint32_t num;
+  stats->size = caScan(c, &entries, &num);
+  qsort(entries, num, sizeof(cache_entry_t), caEntryCompare);
+
+  const uint64_t keep = c->maxSize / 5 * 4;
+  for (uint32_t i = 0; i < num; ++i) {
+    if (stats->size > keep && unlink(entries[i].path) == 0) {
+      stats->size -= entries[i].size;
+      stats->evicted++;
+    }
+    free(entries[i].path);
+  }
+  free(entries);
+}
+
+bool caOpen(cache_t *c, const char *dir, uint64_t maxSize) {
+
+  memset(c, 0, sizeof(cache_t));
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    return false;
+  }
+  c->dir     = dir;
+  c->maxSize = maxSize;
+  c->build   = caBuildHash();
+  return true;
+}
+
+char *caGet(const cache_t *c, uint64_t key, size_t *size) {
+
+  // the entry for key, allocated, or NULL on a miss
+  char path[4096];
+  caPath(c, key, path, sizeof(path));
+
+  char *data = NULL;
+  FILE *fd = fopen(path, "rb");
+  if (fd) {
+    fseek(fd, 0, SEEK_END);
+    const long len = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    data = malloc(len > 0 ? (size_t)len + 1 : 1);
+    assert(data);
+    *size = len > 0 ? fread(data, 1, (size_t)len, fd) : 0;
+    data[*size] = '\0';
+    fclose(fd);
+    utime(path, NULL);
+  }
+  return data;
+}
+
+void caCount(const cache_t *c, uint32_t hits, uint32_t misses) {
+
+  // lookups are counted in batches, the stats file is shared
+  cache_stats_t stats;
+  const int lock = caLock(c, &stats);
+  if (lock >= 0) {
+    stats.hits   += hits;
+    stats.misses += misses;
+    caUnlock(lock, &stats);
+  }
+}
+
+void caPut(const cache_t *c, uint64_t key, const char *data, size_t size) {
+
+  char path[4096];
+  caPath(c, key, path, sizeof(path));
+  char *slash = strrchr(path, '/');
+  *slash = '\0';
+  mkdir(path, 0755);
+  *slash = '/';
+
+  // published whole or not at all
+  static _Thread_local uint32_t serial;
+  char temp[4096];
+  snprintf(temp, sizeof(temp), "%s/tmp.%ld.%lx.%u", c->dir, (long)getpid(),
+           (unsigned long)pthread_self(), serial++);
+  FILE *fd = fopen(temp, "wb");
+  if (!fd) {
+    return;
+  }
+  const bool written = fwrite(data, 1, size, fd) == size;
+  if (fclose(fd) != 0 || !written || rename(temp, path) != 0) {
+    unlink(temp);
+    return;
+  }
+
+  cache_stats_t stats;
+  const int lock = caLock(c, &stats);
+  if (lock >= 0) {
+    stats.stores++;
+    stats.size += size;
+    if (stats.size > c->maxSize) {
+      caEvict(c, &stats);
+    }
+    caUnlock(lock, &stats);
+  }
+}
+
+void caStats(const cache_t *c, FILE *out) {
+
+  cache_stats_t stats;
+  const int lock = caLock(c, &stats);
+  if (lock < 0) {
+    fprintf(out, "Unable to read the stats of cache '%s'\n", c->dir);
+    return;
+  }
+  // the size is counted again, entries may have been removed by hand
+  cache_entry_t *entries;
+  uint32_t num;
+  stats.size = caScan(c, &entries, &num);
+  for (uint32_t i = 0; i < num; ++i) {
+    free(entries[i].path);
+  }
+  free(entries);
+
+  const uint64_t lookups = stats.hits + stats.misses;
+  fprintf(out, "cache directory  %s\n", c->dir);
+  fprintf(out, "entries          %u\n", num);
+  fprintf(out, "size             %llu of %llu bytes\n",
+    (unsigned long long)stats.size, (unsigned long long)c->maxSize);
+  fprintf(out, "hits             %llu (%.1f%%)\n", (unsigned long long)stats.hits,
+    lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0);
+  fprintf(out, "misses           %llu\n", (unsigned long long)stats.misses);
+  fprintf(out, "stores           %llu\n", (unsigned long long)stats.stores);
+  fprintf(out, "evicted          %llu\n", (unsigned long long)stats.evicted);
+  caUnlock(lock, &stats);
+}
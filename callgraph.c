@@ -0,0 +1,180 @@
+#include "defs.h"
+
+
+// Whole file call graph built from the resolved AST_EXPR_CALL nodes.
+// Prototypes and definitions of the same function share one entry.
+// Strongly connected components are found with Tarjan's algorithm which
+// also yields cg->order, a bottom up (callees first) function ordering.
+
+
+typedef struct {
+  cg_t     *cg;
+  uint32_t *index;
+  uint32_t *lowLink;
+  bool     *onStack;
+  uint32_t *stack;
+  uint32_t  stackHead;
+  uint32_t  nextIndex;
+  uint32_t  nextScc;
+  uint32_t  orderHead;
+} cg_tarjan_t;
+
+static int32_t cgIndexOf(cg_t *cg, const token_t *ident) {
+  for (uint32_t i = 0; i < cg->numFuncs; ++i) {
+    if (tEqual(&cg->funcs[i].func->declFunc.ident, ident)) {
+      return (int32_t)i;
+    }
+  }
+  return -1;
+}
+
+static void cgAddEdge(cg_func_t *from, uint32_t to) {
+  for (uint32_t i = 0; i < from->numCallees; ++i) {
+    if (from->callees[i] == to) {
+      return;
+    }
+  }
+  if (from->numCallees >= from->maxCallees) {
+    from->maxCallees += 8;
+    from->callees = realloc(from->callees, from->maxCallees * sizeof(uint32_t));
+    assert(from->callees);
+  }
+  from->callees[from->numCallees++] = to;
+}
+
+static void cgCollect(cg_t *cg, cg_func_t *from, ast_node_p n) {
+  for (; n; n = n->next) {
+    if (n->type == AST_EXPR_CALL && n->exprCall.decl &&
+        n->exprCall.decl->type == AST_DECL_FUNC) {
+      const int32_t to = cgIndexOf(cg, &n->exprCall.ident);
+      if (to >= 0) {
+        cg->funcs[to].numCallSites++;
+        cgAddEdge(from, (uint32_t)to);
+      }
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      cgCollect(cg, from, *slots[i]);
+    }
+  }
+}
+
+static void cgStrongConnect(cg_tarjan_t *t, uint32_t v) {
+
+  cg_func_t *f = &t->cg->funcs[v];
+
+  t->index[v]   = t->nextIndex;
+  t->lowLink[v] = t->nextIndex;
+  t->nextIndex++;
+  t->stack[t->stackHead++] = v;
+  t->onStack[v] = true;
+
+  for (uint32_t i = 0; i < f->numCallees; ++i) {
+    const uint32_t w = f->callees[i];
+    if (w == v) {
+      // direct recursion
+      f->isRecursive = true;
+    }
+    if (t->index[w] == UINT32_MAX) {
+      cgStrongConnect(t, w);
+      if (t->lowLink[w] < t->lowLink[v]) {
+        t->lowLink[v] = t->lowLink[w];
+      }
+    }
+    else if (t->onStack[w] && t->index[w] < t->lowLink[v]) {
+      t->lowLink[v] = t->index[w];
+    }
+  }
+
+  // v is the root of an scc so pop it off the stack
+  if (t->lowLink[v] == t->index[v]) {
+    const uint32_t base = t->stackHead;
+    uint32_t w;
+    do {
+      w = t->stack[--t->stackHead];
+      t->onStack[w] = false;
+      t->cg->funcs[w].scc = t->nextScc;
+      t->cg->order[t->orderHead++] = w;
+    } while (w != v);
+    // mutual recursion
+    if (base - t->stackHead > 1) {
+      for (uint32_t i = t->stackHead; i < base; ++i) {
+        t->cg->funcs[t->stack[i]].isRecursive = true;
+      }
+    }
+    t->nextScc++;
+  }
+}
+
+void cgBuild(ast_node_p n, cg_t *cg) {
+
+  assert(n->type == AST_ROOT);
+  memset(cg, 0, sizeof(cg_t));
+
+  // one entry per function name
+  uint32_t max = 0;
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    max += (f->type == AST_DECL_FUNC) ? 1 : 0;
+  }
+  cg->funcs = calloc(max ? max : 1, sizeof(cg_func_t));
+  cg->order = calloc(max ? max : 1, sizeof(uint32_t));
+  assert(cg->funcs && cg->order);
+
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type != AST_DECL_FUNC) {
+      continue;
+    }
+    const int32_t i = cgIndexOf(cg, &f->declFunc.ident);
+    if (i < 0) {
+      cg->funcs[cg->numFuncs++].func = f;
+    }
+    else if (f->declFunc.body) {
+      cg->funcs[i].func = f;
+    }
+  }
+
+  // call edges
+  for (uint32_t i = 0; i < cg->numFuncs; ++i) {
+    cgCollect(cg, &cg->funcs[i], cg->funcs[i].func->declFunc.body);
+  }
+
+  // strongly connected components
+  cg_tarjan_t t;
+  memset(&t, 0, sizeof(t));
+  t.cg      = cg;
+  t.index   = malloc((max + 1) * sizeof(uint32_t));
+  t.lowLink = malloc((max + 1) * sizeof(uint32_t));
+  t.stack   = malloc((max + 1) * sizeof(uint32_t));
+  t.onStack = calloc(max + 1, sizeof(bool));
+  assert(t.index && t.lowLink && t.stack && t.onStack);
+  for (uint32_t i = 0; i < cg->numFuncs; ++i) {
+    t.index[i] = UINT32_MAX;
+  }
+  for (uint32_t i = 0; i < cg->numFuncs; ++i) {
+    if (t.index[i] == UINT32_MAX) {
+      cgStrongConnect(&t, i);
+    }
+  }
+  free(t.index);
+  free(t.lowLink);
+  free(t.stack);
+  free(t.onStack);
+}
+
+void cgFree(cg_t *cg) {
+  for (uint32_t i = 0; i < cg->numFuncs; ++i) {
+    free(cg->funcs[i].callees);
+  }
+  free(cg->funcs);
+  free(cg->order);
+  memset(cg, 0, sizeof(cg_t));
+}
+
+cg_func_t *cgFind(cg_t *cg, ast_node_p func) {
+  if (!func || func->type != AST_DECL_FUNC) {
+    return NULL;
+  }
+  const int32_t i = cgIndexOf(cg, &func->declFunc.ident);
+  return (i >= 0) ? &cg->funcs[i] : NULL;
+}
@@ -0,0 +1,79 @@
+#include "defs.h"
+
+#include <limits.h>
+#include <unistd.h>
+
+
+// Client for a compiler started with --server=<socket>.
+//
+//   compiler-client <socket> [options] <file.c>
+//
+// sends the options and file to the server and prints what it answered,
+// exiting with the status of the compile. A file named - is read from stdin
+// and sent along as text, --shutdown stops the server.
+
+
+static char *readAll(FILE *fd, size_t *size) {
+  size_t max = 4096;
+  char *text = malloc(max);
+  assert(text);
+  *size = 0;
+  for (size_t got; (got = fread(text + *size, 1, max - *size, fd)) > 0;) {
+    *size += got;
+    if (*size == max) {
+      max *= 2;
+      text = realloc(text, max);
+      assert(text);
+    }
+  }
+  return text;
+}
+
+int main(int argc, char **args) {
+
+  if (argc < 3) {
+    printf("usage: %s <socket> [options] <file.c | ->\n", args[0]);
+    return 1;
+  }
+
+  const int fd = svConnect(args[1]);
+  if (fd < 0) {
+    printf("Unable to connect to '%s'\n", args[1]);
+    return 1;
+  }
+
+  // the server has its own working directory
+  char **send = calloc(argc, sizeof(char*));
+  assert(send);
+  int num = 0;
+  char *text = NULL;
+  size_t size = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(args[i], "-") == 0) {
+      text = readAll(stdin, &size);
+      continue;
+    }
+    if (args[i][0] != '-') {
+      char *path = realpath(args[i], NULL);
+      send[num++] = path ? path : args[i];
+      continue;
+    }
+    send[num++] = args[i];
+  }
+
+  int status = 1;
+  char *out = NULL;
+  size_t outSize = 0;
+  if (!svSend(fd, num, send, text, size) ||
+      !svReceive(fd, &status, &out, &outSize)) {
+    printf("Lost the connection to '%s'\n", args[1]);
+    close(fd);
+    return 1;
+  }
+  fwrite(out, 1, outSize, stdout);
+
+  free(out);
+  free(text);
+  close(fd);
+  return status;
+}
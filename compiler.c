@@ -0,0 +1,82 @@
+#include "defs.h"
+
+
+// Embedding the compiler.
+//
+// All state of a compilation lives in its compiler_ctx_t, so a host such as
+// a build system can keep one context per thread and compile buffer after
+// buffer without starting a process for each:
+//
+//   compiler_ctx_t *ctx = cNew();
+//   ast_node_p root = cCompile(ctx, src, size);
+//   ... walk root, or read cDiags(ctx, &num) when it is NULL ...
+//   cReset(ctx);
+//   cFree(ctx);
+//
+// The tree and the diagnostics point into the context's copy of the buffer
+// and stay valid until the next cReset.
+
+
+compiler_ctx_t *cNew(void) {
+  compiler_ctx_t *ctx = malloc(sizeof(compiler_ctx_t));
+  assert(ctx);
+  memset(ctx, 0, sizeof(compiler_ctx_t));
+  ctx->out = stdout;
+  return ctx;
+}
+
+ast_node_p cCompile(compiler_ctx_t *ctx, const char *src, size_t size) {
+
+  cReset(ctx);
+
+  // tokens keep pointing into the text, the caller may reuse its buffer
+  ctx->source = malloc(size + 1);
+  assert(ctx->source);
+  memcpy(ctx->source, src, size);
+  ctx->source[size] = '\0';
+
+  lInitText(ctx, ctx->source, size, 1);
+  ctx->root = pParse(ctx, false);
+
+  // a tree put together around syntax errors is not worth checking
+  if (!dErrors(ctx)) {
+    sCheck(ctx, ctx->root);
+  }
+  return dErrors(ctx) ? NULL : ctx->root;
+}
+
+const diag_t *cDiags(compiler_ctx_t *ctx, uint32_t *num) {
+  // in the order they were reported, dFormat turns one into its message
+  *num = dCount(ctx);
+  return ctx->diags.list;
+}
+
+void cReset(compiler_ctx_t *ctx) {
+
+  // back to how cNew left it, keeping the memory of the stacks and lists
+  aNodeFree(ctx->root);
+  free(ctx->source);
+  ctx->root   = NULL;
+  ctx->source = NULL;
+
+  memset(&ctx->lex, 0, sizeof(ctx->lex));
+  memset(&ctx->lexBefore, 0, sizeof(ctx->lexBefore));
+  ctx->lexBad   = false;
+  ctx->lexBadAt = NULL;
+  lReset(ctx);
+  memset(&ctx->parser, 0, sizeof(ctx->parser));
+  ctx->sema.stack.head = 0;
+  ctx->sema.hist.head  = 0;
+  ctx->sema.spare.head = 0;
+  dTruncate(ctx, 0);
+}
+
+void cFree(compiler_ctx_t *ctx) {
+  cReset(ctx);
+  free(ctx->sema.stack.stack);
+  free(ctx->sema.hist.stack);
+  free(ctx->sema.spare.stack);
+  free(ctx->diags.list);
+  free(ctx->files);
+  free(ctx);
+}
@@ -0,0 +1,97 @@
+#include "defs.h"
+
+
+// Constant propagation of const globals.
+//
+// A global declared const with an integer constant initializer can never
+// change, so every read of it is replaced by a copy of the initializer:
+//
+//   const int size = 16;
+//   a = b * size;          ->  a = b * 16;
+//
+// The copy holds the value as the variable stores it, so an initializer
+// which does not fit is wrapped first, 'const char c = 300;' reads as 44.
+// Taking the address of such a global is left alone, the variable is kept
+// for those uses.
+
+
+typedef struct {
+  uint32_t   replaced;
+} constprop_t;
+
+static bool constIsFoldable(ast_node_p var) {
+
+  int64_t value;
+  if (!var || var->type != AST_DECL_VAR || !var->decorate.type) {
+    return false;
+  }
+  const ast_type_t *t = var->decorate.type;
+  if (!t->isConst || t->ptrLevel || t->count ||
+      !aIntLitValue(var->declVar.expr, &value)) {
+    return false;
+  }
+
+  // locals are left to the optimizations that track their stores
+  return var->declVar.isGlobal;
+}
+
+static void constSetLine(ast_node_p n, uint32_t line) {
+  // the copy reads as if written at the use
+  if (n->type == AST_EXPR_UNARY_OP) {
+    n->exprUnaryOp.op.line = line;
+    constSetLine(n->exprUnaryOp.rhs, line);
+  }
+  if (n->type == AST_EXPR_INT_LIT) {
+    n->exprIntLit.token.line = line;
+  }
+}
+
+static ast_node_p constValue(ast_node_p var, uint32_t line) {
+  int64_t value;
+  aIntLitValue(var->declVar.expr, &value);
+  const int64_t wrapped = aWrapToType(value, var->decorate.type);
+  if (wrapped != value) {
+    return aIntNew(wrapped, line);
+  }
+  ast_node_p v = aNodeClone(var->declVar.expr);
+  constSetLine(v, line);
+  return v;
+}
+
+static void constWalk(constprop_t *c, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    // &x needs the variable itself
+    if (n->type == AST_EXPR_UNARY_OP &&
+        tIs(&n->exprUnaryOp.op, TOK_BIT_AND) &&
+        n->exprUnaryOp.rhs->type == AST_EXPR_IDENT) {
+      continue;
+    }
+
+    if (n->type == AST_EXPR_IDENT && constIsFoldable(n->exprIdent.decl)) {
+      aNodeReplace(n, constValue(n->exprIdent.decl, n->exprIdent.ident.line));
+      c->replaced++;
+      continue;
+    }
+
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      constWalk(c, *slots[i]);
+    }
+  }
+}
+
+void oConstProp(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  constprop_t c;
+  memset(&c, 0, sizeof(c));
+
+  constWalk(&c, n->root.node);
+
+  if (opt->stats) {
+    fprintf(opt->out, "constprop: %u replaced\n", c.replaced);
+  }
+}
@@ -7,22 +7,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <setjmp.h>
 
 
-#define ERROR(...) { \
-  printf("Error, line %u: ", lLineNum()); \
-  printf(__VA_ARGS__); \
-  printf("\n"); \
-  exit(1); \
-}
-
-#define ERROR_LN(LN, ...) { \
-  printf("Error, line %u: ", LN); \
-  printf(__VA_ARGS__); \
-  printf("\n"); \
-  exit(1); \
-}
-
 #define TRACE(FUNC) { \
   printf("%s\n", FUNC); \
 }
@@ -34,10 +21,14 @@ typedef enum {
   TOK_RPAREN,
   TOK_LBRACE,
   TOK_RBRACE,
+  TOK_LBRACKET,
+  TOK_RBRACKET,
   TOK_IDENT,
   TOK_CHAR,
   TOK_SHORT,
   TOK_INT,
+  TOK_CONST,
+  TOK_STATIC,
   TOK_INT_LIT,
   TOK_IF,
   TOK_ELSE,
@@ -48,7 +39,11 @@ typedef enum {
   TOK_WHILE,
   TOK_DO,
   TOK_FOR,
+  TOK_SWITCH,
+  TOK_CASE,
+  TOK_DEFAULT,
   TOK_COMMA,    // ,
+  TOK_COLON,    // :
   TOK_ASSIGN,   // =
   TOK_BIT_AND,  // &
   TOK_LOG_AND,  // &&
@@ -87,47 +82,183 @@ typedef enum {
   AST_STMT_CONTINUE,
   AST_STMT_DO,
   AST_STMT_FOR,
+  AST_STMT_SWITCH,
+  AST_STMT_CASE,
+  AST_STMT_DEFAULT,
   AST_EXPR_IDENT,
   AST_EXPR_INT_LIT,
   AST_EXPR_BIN_OP,
   AST_EXPR_UNARY_OP,
   AST_EXPR_CALL,
   AST_EXPR_CAST,
+  AST_EXPR_INDEX,
 } ast_node_type_t;
 
 typedef struct {
   const char*  start;
   const char*  end;
   token_type_t type;
-  uint32_t     line;
+  uint32_t     line;        // see LINE_HEADER for lines of included files
 } token_t;
 
+// a line of an included file also names the file, lines of the file being
+// compiled are kept as they are:
+//
+//   1 | file (11 bits) | line (20 bits)
+//
+// the file is an index into compiler_ctx_t.files starting at 1
+#define LINE_HEADER      0x80000000u
+#define LINE_FILE_SHIFT  20
+#define LINE_FILE_MAX    0x7ffu
+#define LINE_MASK        0xfffffu
+
+typedef enum {
+  DIAG_WARNING,
+  DIAG_ERROR
+} diag_severity_t;
+
+typedef enum {
+  DIAG_OPEN_FAILED,
+  DIAG_UNKNOWN_TOKEN,
+  DIAG_EXPECTED_TOKEN,
+  DIAG_EXPECTED_PRIMARY,
+  DIAG_EXPECTED_TYPE,
+  DIAG_ALREADY_DECLARED,
+  DIAG_NOT_DECLARED,
+  DIAG_ARRAY_SIZE,
+  DIAG_SUBSCRIPT_BASE,
+  DIAG_SUBSCRIPT_INDEX,
+  DIAG_ASSIGN_CONST,
+  DIAG_STATIC_INIT,
+  DIAG_MULTIPLE_DEFAULT,
+  DIAG_CASE_NOT_CONST,
+  DIAG_CASE_DUPLICATE,
+  DIAG_CASE_OUTSIDE,
+  DIAG_DEFAULT_OUTSIDE,
+  DIAG_BREAK_OUTSIDE,
+  DIAG_CONTINUE_OUTSIDE,
+  DIAG_INCLUDE_LIMIT,
+  DIAG_PCH_INVALID,
+  DIAG_PCH_STALE,
+  DIAG_PCH_DECL,
+  DIAG_COUNT
+} diag_kind_t;
+
+// arguments are kept as they are, the message is only formatted when emitted
+typedef struct {
+  diag_kind_t  kind;
+  uint32_t     line;
+  const char  *text;        // name the message refers to
+  uint32_t     len;
+  uint32_t     num;         // number or token type
+  const char  *file;        // included file the line is in, NULL for the
+                            // file being compiled
+} diag_t;
+
+typedef struct lex_include_s lex_include_t;
+typedef struct lex_header_s lex_header_t;
+
 typedef struct {
-  const char *start;
-  const char *end;
-  const char *ptr;
-  const char *lineStart;
-  uint32_t    lineNum;
+  const char          *start;
+  const char          *end;
+  const char          *ptr;
+  const char          *lineStart;
+  uint32_t             lineNum;
+  uint32_t             file;      // 0 for the file being compiled
+  const lex_include_t *include;   // how this file was included, NULL if it
+                                  // is the file being compiled
 } lex_t;
 
+// one #include as it was lexed, kept until cReset so saved lex_t states
+// can still return to the including file
+struct lex_include_s {
+  lex_t               from;   // the including file, after the directive
+  const char         *at;     // the directive
+  const lex_header_t *header; // NULL when the include was dropped
+  uint32_t            file;
+  lex_include_t      *next;   // all of them, to find one lexed again
+};
+
+typedef struct {
+  const lex_header_t *header;
+  char               *name;   // as the include spelled it, for reports
+} lex_file_t;
+
 typedef struct ast_node_s ast_node_t, *ast_node_p;
 
 typedef struct {
   ast_node_p exprStack[1024];
   size_t     exprStackHead;
   ast_node_p astRoot;
+  bool       lazy;
 } parser_t;
 
 typedef struct {
-  uint8_t width;
-  uint8_t ptrLevel;
-  bool    isVoid;
-  bool    isConst;
-  bool    isStatic;
-  bool    isSigned;
-  bool    isRvalue;
+  ast_node_p *stack;
+  uint32_t    max;
+  uint32_t    head;
+} ast_stack_t;
+
+typedef struct {
+  ast_stack_t stack;
+  ast_stack_t hist;
+  ast_stack_t spare;        // loop stack while the globals are kept, sCheckNext
+} sema_t;
+
+typedef struct {
+  diag_t     *list;
+  uint32_t    num;
+  uint32_t    max;
+  uint32_t    errors;
+  jmp_buf    *trap;
+} diags_t;
+
+// everything one compilation keeps between calls, a process can run as many
+// of them side by side as it likes
+typedef struct {
+  lex_t       lex;
+  lex_t       lexBefore;    // state before the last token was lexed
+  bool        lexBad;       // the last token was not understood, and reported
+  const char *lexBadAt;
+  const char *lexFile;      // path of the compiled file, NULL for a buffer
+  bool        noIncludes;   // #include is an unknown token, for --edit
+  lex_include_t *includes;  // every #include lexed since cReset
+  lex_file_t *files;        // files entered by #include, from index 1
+  uint32_t    numFiles;
+  uint32_t    maxFiles;
+  parser_t    parser;
+  sema_t      sema;
+  diags_t     diags;
+  FILE       *out;          // where dEmit writes, stdout unless changed
+  char       *source;       // copy of the buffer given to cCompile
+  ast_node_p  root;
+} compiler_ctx_t;
+
+typedef struct {
+  const char *dir;
+  uint64_t    maxSize;      // bytes the entries may take before eviction
+  uint64_t    build;        // hash of the compiler binary
+} cache_t;
+
+typedef struct {
+  uint8_t  width;
+  uint8_t  ptrLevel;
+  uint32_t count;       // number of elements if this is an array
+  bool     isVoid;
+  bool     isConst;
+  uint8_t  constDeref;  // bit n set when what n + 1 derefs reach is const
+  bool     isStatic;
+  bool     isSigned;
+  bool     isRvalue;
 } ast_type_t, *ast_type_p;
 
+typedef enum {
+  SWITCH_LOWER_NONE,
+  SWITCH_LOWER_TABLE,       // jump table indexed by the value
+  SWITCH_LOWER_BITTEST,     // one mask test per target over a small range
+  SWITCH_LOWER_BSEARCH,     // balanced binary search over the case values
+} switch_lower_t;
+
 typedef struct ast_node_s {
 
   ast_node_type_t type;
@@ -150,12 +281,25 @@ typedef struct ast_node_s {
       token_t    ident;
       ast_node_p args;
       ast_node_p body;
+
+      // decorate
+      lex_t      bodyLex;   // just inside a body skipped by a lazy parse
+      bool       isLazy;    // body not parsed yet, see pParseBody
+      bool       isDropped; // body checked and freed by a streaming compile
+      bool       isPrecompiled; // read from a snapshot, checked when written
     } declFunc;
 
     struct {
       ast_node_p type;
       token_t    ident;
+      ast_node_p size;      // array length, NULL if not an array
       ast_node_p expr;
+
+      // decorate
+      bool       isGlobal;      // declared at file scope
+      bool       isEscaping;
+      bool       isRegister;
+      bool       isPrecompiled;
     } declVar;
 
     struct {
@@ -210,8 +354,35 @@ typedef struct ast_node_s {
       ast_node_p cond;
       ast_node_p update;
       ast_node_p body;
+
+      // decorate
+      uint32_t   lanes;     // elements per iteration once vectorized
     } stmtFor;
 
+    struct {
+      token_t    token;
+      ast_node_p expr;
+      ast_node_p body;
+
+      // decorate
+      switch_lower_t lower;
+      uint32_t   numCases;
+      int64_t    minCase;
+      int64_t    maxCase;
+    } stmtSwitch;
+
+    struct {
+      token_t    token;
+      ast_node_p expr;
+
+      // decorate
+      int64_t    value;
+    } stmtCase;
+
+    struct {
+      token_t    token;
+    } stmtDefault;
+
     struct {
       token_t    ident;
 
@@ -227,6 +398,9 @@ typedef struct ast_node_s {
       token_t    op;
       ast_node_p lhs;
       ast_node_p rhs;
+
+      // decorate
+      uint32_t   scale;     // pointee width for pointer arithmetic
     } exprBinOp;
 
     struct {
@@ -240,20 +414,124 @@ typedef struct ast_node_s {
 
       // decorate
       ast_node_p decl;
+      bool       isTail;
     } exprCall;
 
     struct {
       ast_node_p type;
       ast_node_p expr;
     } exprCast;
+
+    struct {
+      token_t    token;
+      ast_node_p base;
+      ast_node_p index;     // NULL once folded into disp
+
+      // decorate
+      uint32_t   scale;     // element width
+      int64_t    disp;      // constant byte offset
+    } exprIndex;
   };
 
   struct {
     ast_type_p type;
+    bool       isCold;      // never executed according to the profile
   } decorate;
 
 } ast_node_t;
 
+#define AST_MAX_CHILDREN 4
+
+typedef struct {
+  ast_node_p  func;         // definition if one exists, else the prototype
+  uint32_t   *callees;      // indices of called functions
+  uint32_t    numCallees;
+  uint32_t    maxCallees;
+  uint32_t    numCallSites; // number of calls made to this function
+  uint32_t    scc;          // strongly connected component id
+  bool        isRecursive;  // part of a call cycle
+} cg_func_t;
+
+typedef struct {
+  cg_func_t  *funcs;
+  uint32_t    numFuncs;
+  uint32_t   *order;        // function indices, callees before callers
+} cg_t;
+
+typedef struct {
+  ast_node_p  node;
+  const char *text;         // source of this declaration, its tokens point here
+  size_t      size;
+  uint32_t    line;         // line the text starts on
+  uint32_t    lines;        // newlines in text
+  bool        owned;        // text was allocated for an edit
+} incr_decl_t;
+
+typedef struct {
+  compiler_ctx_t *ctx;
+  ast_node_p      root;
+  incr_decl_t    *decls;
+  uint32_t        numDecls;
+  uint32_t        maxDecls;
+  char           *source;   // text of the last full parse
+  const char     *tail;     // text after the last declaration
+  size_t          tailSize;
+  uint32_t        reparsed; // declarations parsed by edits
+} incr_t;
+
+typedef struct {
+  bool        unroll;
+  uint32_t    unrollFactor;
+  uint32_t    unrollBudget;
+  bool        inlineFuncs;
+  uint32_t    inlineSize;
+  uint32_t    inlineBudget;
+  bool        tailCalls;
+  bool        promote;
+  bool        profileGenerate;
+  const char *profileUse;
+  bool        order;
+  const char *exports;      // comma separated roots for -forder
+  bool        stats;
+  bool        ifConvert;
+  uint32_t    ifConvertCost;
+  bool        peephole;
+  bool        switches;
+  bool        addrModes;
+  bool        constProp;
+  bool        vectorize;
+  bool        constEval;
+  bool        lazy;
+  const char *dumpFunc;
+  bool        stream;
+  bool        transforms;   // some pass reshapes the tree
+  FILE       *out;          // dumps and statistics
+  cache_t    *cache;        // NULL unless outputs are cached
+  uint64_t    optionsKey;   // hash of the options that shape the output
+  const char *pch;          // snapshot of declarations to start from
+  const char *pchWrite;     // where to write the snapshot of this file
+} opt_t;
+
+// answers one request to a server, a negative result stops serving
+typedef int (*serve_func_t)(void *user, int argc, char **args,
+                            const char *text, size_t size, FILE *out);
+
+typedef struct jobs_s jobs_t;
+typedef void (*job_func_t)(void *user, uint32_t worker, uint32_t job);
+
+// functions of one compile whose output comes from the cache
+typedef struct splice_s splice_t;
+
+
+void        dReport    (compiler_ctx_t *ctx, diag_kind_t kind, uint32_t line, uint32_t num);
+void        dReportText(compiler_ctx_t *ctx, diag_kind_t kind, uint32_t line, const char *text, size_t len);
+uint32_t    dCount     (compiler_ctx_t *ctx);
+uint32_t    dErrors    (compiler_ctx_t *ctx);
+void        dTruncate  (compiler_ctx_t *ctx, uint32_t count);
+void        dEmit      (compiler_ctx_t *ctx);
+jmp_buf    *dTrap      (compiler_ctx_t *ctx, jmp_buf *env);
+void        dAbort     (compiler_ctx_t *ctx);
+size_t      dFormat    (const diag_t *d, char *buf, size_t size);
 
 const char* tTypeName  (token_type_t type);
 const char *tName      (const token_t *t);
@@ -264,18 +542,110 @@ int         tPrec      (const token_t *t);
 bool        tEqual     (const token_t* a, const token_t* b);
 int         tSize      (const token_t* t);
 int         tLineNum   (const token_t* t);
-
-bool        lInit      (const char *file);
-void        lPop       (token_t *out);
-void        lPeek      (token_t *out);
-void        lExpect    (token_type_t type, token_t *out);
-bool        lFound     (token_type_t type, token_t *out);
-uint32_t    lLineNum   (void);
-
-ast_node_p  pParse     (void);
+uint32_t    tLineOf    (uint32_t line);
+token_t     tMake      (token_type_t type, uint32_t line);
+
+char       *lRead      (const char *file, size_t *size);
+bool        lInit      (compiler_ctx_t *ctx, const char *file);
+bool        lMap       (compiler_ctx_t *ctx, const char *file);
+void        lUnmap     (compiler_ctx_t *ctx);
+void        lInitText  (compiler_ctx_t *ctx, const char *src, size_t size, uint32_t line);
+void        lPop       (compiler_ctx_t *ctx, token_t *out);
+void        lPeek      (compiler_ctx_t *ctx, token_t *out);
+void        lExpect    (compiler_ctx_t *ctx, token_type_t type, token_t *out);
+bool        lFound     (compiler_ctx_t *ctx, token_type_t type, token_t *out);
+uint32_t    lLineNum   (compiler_ctx_t *ctx);
+void        lFail      (compiler_ctx_t *ctx, diag_kind_t kind, uint32_t num);
+void        lSave      (compiler_ctx_t *ctx, lex_t *out);
+void        lRestore   (compiler_ctx_t *ctx, const lex_t *in);
+const char *lFileName  (compiler_ctx_t *ctx, uint32_t line);
+void        lReset     (compiler_ctx_t *ctx);
+uint32_t    lPrefix    (compiler_ctx_t *ctx, const char *file);
+
+ast_node_p  pParse     (compiler_ctx_t *ctx, bool lazy);
+ast_node_p  pParseDecl (compiler_ctx_t *ctx);
+void        pParseBody (compiler_ctx_t *ctx, ast_node_p f);
 
 ast_node_p  aNodeNew   (ast_node_type_t type);
 ast_node_p  aNodeInsert(ast_node_p chain, ast_node_p toInsert);
-void        aDump      (ast_node_p n);
-
-void        sCheck     (ast_node_p n);
+void        aNodeInsertAfter(ast_node_p chain, ast_node_p pos, ast_node_p toInsert);
+void        aNodeFree  (ast_node_p n);
+uint32_t    aNodeLive  (void);
+void        aDump      (ast_node_p n, FILE *out);
+void        aDumpDepth (ast_node_p n, int level, FILE *out);
+token_t    *aToken     (ast_node_p n);
+uint32_t    aChildren  (ast_node_p n, ast_node_p *slots[AST_MAX_CHILDREN]);
+ast_node_p  aNodeClone (ast_node_p n);
+void        aNodeReplace(ast_node_p n, ast_node_p with);
+uint32_t    aNodeCount (ast_node_p n);
+ast_node_p  aIntLitNew (int64_t value, uint32_t line);
+ast_node_p  aIntNew    (int64_t value, uint32_t line);
+int64_t     aWrapToType(int64_t value, const ast_type_t *t);
+bool        aIntLitValue(ast_node_p n, int64_t *out);
+ast_node_p  aIdentNew  (ast_node_p decl, uint32_t line);
+ast_node_p  aBinOpNew  (token_type_t op, ast_node_p lhs, ast_node_p rhs, uint32_t line);
+bool        aIsVoidType(ast_node_p type);
+bool        aIsVoidArgs(ast_node_p args);
+bool        aIsStatic  (ast_node_p type);
+ast_node_p  aTypeUnqual(ast_node_p type);
+
+void        sCheck     (compiler_ctx_t *ctx, ast_node_p n);
+void        sCheckDecl (compiler_ctx_t *ctx, ast_node_p root, ast_node_p d);
+void        sCheckNext (compiler_ctx_t *ctx, ast_node_p d);
+
+void        cgBuild    (ast_node_p n, cg_t *cg);
+void        cgFree     (cg_t *cg);
+cg_func_t  *cgFind     (cg_t *cg, ast_node_p func);
+
+void        oUnroll    (ast_node_p n, const opt_t *opt, bool partial);
+void        oInline    (ast_node_p n, const opt_t *opt);
+void        oTailCall  (ast_node_p n, const opt_t *opt);
+void        oPromote   (ast_node_p n, const opt_t *opt);
+void        oProfileGenerate(ast_node_p n, const opt_t *opt);
+bool        oProfileUse(ast_node_p n, const opt_t *opt);
+void        oOrder     (ast_node_p n, const opt_t *opt);
+void        oIfConvert (ast_node_p n, const opt_t *opt);
+void        oPeephole  (ast_node_p n, const opt_t *opt);
+void        oSwitch    (ast_node_p n, const opt_t *opt);
+void        oAddrMode  (ast_node_p n, const opt_t *opt);
+void        oConstProp (ast_node_p n, const opt_t *opt);
+void        oVectorize (ast_node_p n, const opt_t *opt);
+void        oConstEval (ast_node_p n, const opt_t *opt);
+
+bool        iOpen      (incr_t *in, compiler_ctx_t *ctx, const char *file);
+bool        iEdit      (incr_t *in, size_t offset, size_t removed, const char *text);
+void        iClose     (incr_t *in);
+
+compiler_ctx_t *cNew   (void);
+ast_node_p  cCompile   (compiler_ctx_t *ctx, const char *src, size_t size);
+const diag_t *cDiags   (compiler_ctx_t *ctx, uint32_t *num);
+void        cReset     (compiler_ctx_t *ctx);
+void        cFree      (compiler_ctx_t *ctx);
+
+jobs_t     *jStart     (uint32_t numJobs, const uint64_t *cost, uint32_t numThreads,
+                        job_func_t func, void *user);
+void        jWait      (jobs_t *j, uint32_t job);
+uint32_t    jFinish    (jobs_t *j);
+uint32_t    jCores     (void);
+
+int         svServe    (const char *path, serve_func_t func, void *user);
+int         svConnect  (const char *path);
+bool        svSend     (int fd, int argc, char **args, const char *text, size_t size);
+bool        svReceive  (int fd, int *status, char **out, size_t *size);
+
+uint64_t    caHash     (uint64_t hash, const void *data, size_t size);
+uint64_t    caBuildHash(void);
+bool        caOpen     (cache_t *c, const char *dir, uint64_t maxSize);
+char       *caGet      (const cache_t *c, uint64_t key, size_t *size);
+void        caCount    (const cache_t *c, uint32_t hits, uint32_t misses);
+void        caPut      (const cache_t *c, uint64_t key, const char *data, size_t size);
+void        caStats    (const cache_t *c, FILE *out);
+
+splice_t   *spBegin    (ast_node_p n, const opt_t *opt);
+void        spEnd      (splice_t *s, FILE *out);
+
+bool        phWrite    (compiler_ctx_t *ctx, ast_node_p root, const char *path);
+bool        phLoad     (compiler_ctx_t *ctx, const char *path, ast_node_p *decls);
+
+int         rtRun      (const char *dir, uint32_t threads, serve_func_t func, void **user,
+                        FILE *out);
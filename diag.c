@@ -0,0 +1,155 @@
+#include "defs.h"
+
+
+// Diagnostics.
+//
+// Errors are collected instead of ending the process so a compile can carry
+// on and report everything it finds, the caller decides at the end whether
+// it failed. A report only records its kind and arguments, the text is put
+// together by dEmit.
+//
+// The parser recovers from a syntax error by unwinding to the innermost
+// trap set with dTrap, skipping ahead to the next ';' or '}' and continuing
+// from there.
+
+
+typedef enum {
+  DIAG_ARG_NONE,
+  DIAG_ARG_TEXT,
+  DIAG_ARG_NUM,
+  DIAG_ARG_TOKEN
+} diag_arg_t;
+
+static const struct {
+  diag_severity_t severity;
+  diag_arg_t      arg;
+  const char     *format;
+} diagInfo[DIAG_COUNT] = {
+  [DIAG_OPEN_FAILED]      = { DIAG_ERROR, DIAG_ARG_TEXT,  "Unable to open '%.*s'\n" },
+  [DIAG_UNKNOWN_TOKEN]    = { DIAG_ERROR, DIAG_ARG_NUM,   "unknown token on line %u" },
+  [DIAG_EXPECTED_TOKEN]   = { DIAG_ERROR, DIAG_ARG_TOKEN, "expected %s token" },
+  [DIAG_EXPECTED_PRIMARY] = { DIAG_ERROR, DIAG_ARG_NONE,  "Primary expression expected" },
+  [DIAG_EXPECTED_TYPE]    = { DIAG_ERROR, DIAG_ARG_NONE,  "Type expected" },
+  [DIAG_ALREADY_DECLARED] = { DIAG_ERROR, DIAG_ARG_TEXT,  "'%.*s' already declared" },
+  [DIAG_NOT_DECLARED]     = { DIAG_ERROR, DIAG_ARG_TEXT,  "'%.*s' not declared" },
+  [DIAG_ARRAY_SIZE]       = { DIAG_ERROR, DIAG_ARG_NONE,  "Array size must be a positive integer constant" },
+  [DIAG_SUBSCRIPT_BASE]   = { DIAG_ERROR, DIAG_ARG_NONE,  "Subscripted value is not an array or pointer" },
+  [DIAG_SUBSCRIPT_INDEX]  = { DIAG_ERROR, DIAG_ARG_NONE,  "Array subscript is not an integer" },
+  [DIAG_ASSIGN_CONST]     = { DIAG_ERROR, DIAG_ARG_NONE,  "Assignment to const variable" },
+  [DIAG_STATIC_INIT]      = { DIAG_ERROR, DIAG_ARG_NONE,  "Static initializer must be an integer constant" },
+  [DIAG_MULTIPLE_DEFAULT] = { DIAG_ERROR, DIAG_ARG_NONE,  "Multiple default labels in switch" },
+  [DIAG_CASE_NOT_CONST]   = { DIAG_ERROR, DIAG_ARG_NONE,  "Case value must be an integer constant" },
+  [DIAG_CASE_DUPLICATE]   = { DIAG_ERROR, DIAG_ARG_NONE,  "Duplicate case value" },
+  [DIAG_CASE_OUTSIDE]     = { DIAG_ERROR, DIAG_ARG_NONE,  "Case label outside of switch" },
+  [DIAG_DEFAULT_OUTSIDE]  = { DIAG_ERROR, DIAG_ARG_NONE,  "Default label outside of switch" },
+  [DIAG_BREAK_OUTSIDE]    = { DIAG_ERROR, DIAG_ARG_NONE,  "Break statement outside of loop or switch" },
+  [DIAG_CONTINUE_OUTSIDE] = { DIAG_ERROR, DIAG_ARG_NONE,  "Continue statement outside of loop" },
+  [DIAG_INCLUDE_LIMIT]    = { DIAG_ERROR, DIAG_ARG_TEXT,  "'%.*s' nested too deeply or too many files included" },
+  [DIAG_PCH_INVALID]      = { DIAG_ERROR, DIAG_ARG_TEXT,  "'%.*s' is not a precompiled header of this compiler" },
+  [DIAG_PCH_STALE]        = { DIAG_ERROR, DIAG_ARG_TEXT,  "'%.*s' changed since it was precompiled" },
+  [DIAG_PCH_DECL]         = { DIAG_ERROR, DIAG_ARG_TEXT,  "'%.*s' is neither a prototype nor a global with a constant value" },
+};
+
+static const char *diagSeverityName[] = {
+  [DIAG_WARNING] = "Warning",
+  [DIAG_ERROR]   = "Error",
+};
+
+static void diagPush(compiler_ctx_t *ctx, const diag_t *d) {
+  if (ctx->diags.num >= ctx->diags.max) {
+    ctx->diags.max += 64;
+    ctx->diags.list = realloc(ctx->diags.list, ctx->diags.max * sizeof(diag_t));
+    assert(ctx->diags.list);
+  }
+  ctx->diags.list[ctx->diags.num++] = *d;
+  ctx->diags.errors += diagInfo[d->kind].severity == DIAG_ERROR ? 1 : 0;
+}
+
+void dReport(compiler_ctx_t *ctx, diag_kind_t kind, uint32_t line,
+             uint32_t num) {
+  const diag_t d = { kind, line, NULL, 0, num, lFileName(ctx, line) };
+  diagPush(ctx, &d);
+}
+
+void dReportText(compiler_ctx_t *ctx, diag_kind_t kind, uint32_t line,
+                 const char *text, size_t len) {
+  const diag_t d = { kind, line, text, (uint32_t)len, 0, lFileName(ctx, line) };
+  diagPush(ctx, &d);
+}
+
+uint32_t dCount(compiler_ctx_t *ctx) {
+  return ctx->diags.num;
+}
+
+uint32_t dErrors(compiler_ctx_t *ctx) {
+  return ctx->diags.errors;
+}
+
+void dTruncate(compiler_ctx_t *ctx, uint32_t count) {
+  // forget everything reported after count
+  while (ctx->diags.num > count) {
+    const diag_t *d = &ctx->diags.list[--ctx->diags.num];
+    ctx->diags.errors -= diagInfo[d->kind].severity == DIAG_ERROR ? 1 : 0;
+  }
+}
+
+size_t dFormat(const diag_t *d, char *buf, size_t size) {
+
+  // the message as dEmit prints it, without the newline, truncated to fit
+  const char *format = diagInfo[d->kind].format;
+  const char *severity = diagSeverityName[diagInfo[d->kind].severity];
+  int len = d->file
+    ? snprintf(buf, size, "%s, %s, line %u: ", severity, d->file, tLineOf(d->line))
+    : snprintf(buf, size, "%s, line %u: ", severity, d->line);
+  const size_t at = len < 0 ? 0 : ((size_t)len < size ? (size_t)len : size);
+  switch (diagInfo[d->kind].arg) {
+  case DIAG_ARG_NONE:  len = snprintf(buf + at, size - at, "%s", format);                    break;
+  case DIAG_ARG_TEXT:  len = snprintf(buf + at, size - at, format, (int)d->len, d->text);    break;
+  case DIAG_ARG_NUM:   len = snprintf(buf + at, size - at, format, d->num);                  break;
+  case DIAG_ARG_TOKEN: len = snprintf(buf + at, size - at, format, tTypeName(d->num));       break;
+  }
+  return at + (len < 0 ? 0 : (size_t)len);
+}
+
+static int diagCompare(const void *a, const void *b) {
+  // by line, reports on the same line in the order they were made, those
+  // in included files after the others, file by file
+  const diag_t *x = *(const diag_t* const*)a;
+  const diag_t *y = *(const diag_t* const*)b;
+  if (x->line != y->line) {
+    return x->line < y->line ? -1 : 1;
+  }
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void dEmit(compiler_ctx_t *ctx) {
+
+  // sema makes more than one pass, put the reports back into source order
+  const diag_t **order = malloc((ctx->diags.num + 1) * sizeof(diag_t*));
+  assert(order);
+  for (uint32_t i = 0; i < ctx->diags.num; ++i) {
+    order[i] = &ctx->diags.list[i];
+  }
+  qsort(order, ctx->diags.num, sizeof(diag_t*), diagCompare);
+
+  char buf[256];
+  for (uint32_t i = 0; i < ctx->diags.num; ++i) {
+    dFormat(order[i], buf, sizeof(buf));
+    fprintf(ctx->out, "%s\n", buf);
+  }
+  free(order);
+  dTruncate(ctx, 0);
+}
+
+jmp_buf *dTrap(compiler_ctx_t *ctx, jmp_buf *env) {
+  // returns the trap env replaces so the caller can put it back
+  jmp_buf *outer = ctx->diags.trap;
+  ctx->diags.trap = env;
+  return outer;
+}
+
+void dAbort(compiler_ctx_t *ctx) {
+  // give up on what is being parsed, the innermost trap picks up from here
+  assert(ctx->diags.trap);
+  longjmp(*ctx->diags.trap, 1);
+}
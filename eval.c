@@ -0,0 +1,686 @@
+#include "defs.h"
+
+
+// Compile time evaluation of pure functions.
+//
+// A function is pure when it reads no globals other than const ones with a
+// constant initializer, touches no pointers or arrays, has no static locals
+// and only calls other pure functions. Calls to a pure function whose
+// arguments are all constants are run by an interpreter over the checked
+// tree and replaced by the value they return:
+//
+//   int sq(int x) { return x * x; }
+//   a = sq(12);        ->  a = 144;
+//
+// Global initializers are evaluated the same way so they become plain data.
+//
+// The interpreter keeps its own frames of local values and gives up, leaving
+// the call alone, when a call runs for more than EVAL_MAX_STEPS nodes, nests
+// deeper than EVAL_MAX_DEPTH or hits something undefined such as a division
+// by zero or a read of an uninitialized local.
+
+
+// nodes a single folded call may evaluate
+#define EVAL_MAX_STEPS 100000
+
+// nested calls a single folded call may make
+#define EVAL_MAX_DEPTH 256
+
+typedef enum {
+  EVAL_NEXT,
+  EVAL_BREAK,
+  EVAL_CONTINUE,
+  EVAL_RETURN,
+  EVAL_FAIL,
+} eval_flow_t;
+
+typedef struct {
+  ast_node_p decl;
+  int64_t    value;
+  bool       isSet;
+} eval_slot_t;
+
+typedef struct {
+  cg_t         cg;
+  bool        *isPure;      // per call graph entry
+  eval_slot_t *slots;
+  uint32_t     numSlots;
+  uint32_t     maxSlots;
+  uint32_t     base;        // first slot of the current frame
+  uint32_t     depth;
+  uint32_t     steps;
+  int64_t      ret;         // value of the last return
+  uint32_t     folded;
+  uint32_t     globals;
+  uint32_t     gaveUp;
+} eval_t;
+
+static bool evalExpr(eval_t *e, ast_node_p n, int64_t *out);
+static eval_flow_t evalStmt(eval_t *e, ast_node_p n);
+static eval_flow_t evalChain(eval_t *e, ast_node_p n);
+
+//----------------------------------------------------------------------------
+// Purity
+//----------------------------------------------------------------------------
+
+static bool evalIsGlobal(ast_node_p decl) {
+  return decl->type == AST_DECL_VAR && decl->declVar.isGlobal;
+}
+
+static bool evalIsConstGlobal(eval_t *e, ast_node_p decl, int64_t *out) {
+  // a const global with a constant initializer is just a value, the one the
+  // variable holds once the initializer is stored
+  if (!evalIsGlobal(decl) || !decl->decorate.type ||
+      !decl->decorate.type->isConst || decl->decorate.type->ptrLevel ||
+      decl->decorate.type->count ||
+      !aIntLitValue(decl->declVar.expr, out)) {
+    return false;
+  }
+  *out = aWrapToType(*out, decl->decorate.type);
+  return true;
+}
+
+static bool evalIsScalar(ast_node_p n) {
+  const ast_type_t *t = n->decorate.type;
+  return t && !t->ptrLevel && !t->count && !t->isStatic;
+}
+
+static bool evalIsPureNode(eval_t *e, ast_node_p n) {
+  for (; n; n = n->next) {
+    int64_t value;
+    switch (n->type) {
+    case AST_EXPR_IDENT:
+      if (!n->exprIdent.decl || n->exprIdent.decl->type != AST_DECL_VAR ||
+          (evalIsGlobal(n->exprIdent.decl) &&
+           !evalIsConstGlobal(e, n->exprIdent.decl, &value))) {
+        return false;
+      }
+      break;
+    case AST_EXPR_INDEX:
+      return false;
+    case AST_EXPR_UNARY_OP:
+      if (tIs(&n->exprUnaryOp.op, TOK_BIT_AND) ||
+          tIs(&n->exprUnaryOp.op, TOK_MUL)) {
+        return false;
+      }
+      break;
+    case AST_EXPR_CAST:
+    case AST_DECL_VAR:
+      if (!evalIsScalar(n)) {
+        return false;
+      }
+      break;
+    case AST_EXPR_CALL:
+      // callees are checked through the call graph
+      if (!n->exprCall.decl || n->exprCall.decl->type != AST_DECL_FUNC) {
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!evalIsPureNode(e, *slots[i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool evalIsPureFunc(eval_t *e, ast_node_p f) {
+
+  if (!f->declFunc.body) {
+    return false;
+  }
+
+  // a pointer could be returned or passed in
+  ast_node_p t = f->declFunc.type;
+  for (; t; t = t->next) {
+    if (tIs(&t->declType.token, TOK_MUL)) {
+      return false;
+    }
+  }
+  if (!aIsVoidArgs(f->declFunc.args) &&
+      !evalIsPureNode(e, f->declFunc.args)) {
+    return false;
+  }
+  return evalIsPureNode(e, f->declFunc.body);
+}
+
+static void evalPurity(eval_t *e) {
+
+  const uint32_t num = e->cg.numFuncs;
+  e->isPure = calloc(num + 1, sizeof(bool));
+  assert(e->isPure);
+
+  for (uint32_t i = 0; i < num; ++i) {
+    e->isPure[i] = evalIsPureFunc(e, e->cg.funcs[i].func);
+  }
+
+  // calling anything impure makes a function impure
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = 0; i < num; ++i) {
+      cg_func_t *f = &e->cg.funcs[i];
+      for (uint32_t j = 0; j < f->numCallees && e->isPure[i]; ++j) {
+        if (!e->isPure[f->callees[j]]) {
+          e->isPure[i] = false;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Interpreter
+//----------------------------------------------------------------------------
+
+static eval_slot_t *evalFind(eval_t *e, ast_node_p decl) {
+  for (uint32_t i = e->numSlots; i > e->base; --i) {
+    if (e->slots[i - 1].decl == decl) {
+      return &e->slots[i - 1];
+    }
+  }
+  return NULL;
+}
+
+static eval_slot_t *evalDeclare(eval_t *e, ast_node_p decl) {
+  // a declaration run again, in a loop, reuses its slot
+  eval_slot_t *s = evalFind(e, decl);
+  if (s) {
+    return s;
+  }
+  if (e->numSlots == e->maxSlots) {
+    e->maxSlots = e->maxSlots ? e->maxSlots * 2 : 64;
+    e->slots = realloc(e->slots, e->maxSlots * sizeof(eval_slot_t));
+    assert(e->slots);
+  }
+  s = &e->slots[e->numSlots++];
+  s->decl  = decl;
+  s->isSet = false;
+  return s;
+}
+
+static bool evalCall(eval_t *e, ast_node_p n, int64_t *out) {
+
+  cg_func_t *f = cgFind(&e->cg, n->exprCall.decl);
+  if (!f || !e->isPure[f - e->cg.funcs] || e->depth >= EVAL_MAX_DEPTH) {
+    return false;
+  }
+  ast_node_p callee = f->func;
+
+  // arguments are evaluated in the frame of the caller
+  ast_node_p params = aIsVoidArgs(callee->declFunc.args) ?
+                      NULL : callee->declFunc.args;
+  uint32_t num = 0;
+  for (ast_node_p a = n->exprCall.arg; a; a = a->next) {
+    ++num;
+  }
+  int64_t *args = calloc(num + 1, sizeof(int64_t));
+  assert(args);
+  uint32_t i = 0;
+  ast_node_p p = params;
+  for (ast_node_p a = n->exprCall.arg; a; a = a->next, ++i, p = p->next) {
+    if (!p || !evalExpr(e, a, &args[i])) {
+      free(args);
+      return false;
+    }
+  }
+  if (p) {
+    free(args);
+    return false;
+  }
+
+  // new frame
+  const uint32_t base = e->base;
+  e->base = e->numSlots;
+  e->depth++;
+
+  i = 0;
+  for (p = params; p; p = p->next, ++i) {
+    eval_slot_t *s = evalDeclare(e, p);
+    s->value = aWrapToType(args[i], p->decorate.type);
+    s->isSet = true;
+  }
+  free(args);
+
+  const eval_flow_t flow = evalChain(e, callee->declFunc.body);
+
+  e->depth--;
+  e->numSlots = e->base;
+  e->base = base;
+
+  // falling off the end only gives a value for void functions
+  const bool isVoid = aIsVoidType(callee->declFunc.type);
+  *out = 0;
+  if (flow == EVAL_RETURN) {
+    *out = isVoid ? 0 : aWrapToType(e->ret, n->decorate.type);
+    return true;
+  }
+  return flow == EVAL_NEXT && isVoid;
+}
+
+static bool evalAssign(eval_t *e, ast_node_p n, int64_t *out) {
+
+  ast_node_p l = n->exprBinOp.lhs;
+  if (l->type != AST_EXPR_IDENT) {
+    return false;
+  }
+  // the slots may move while the value is computed
+  if (!evalExpr(e, n->exprBinOp.rhs, out)) {
+    return false;
+  }
+  eval_slot_t *s = evalFind(e, l->exprIdent.decl);
+  if (!s) {
+    return false;
+  }
+  s->value = aWrapToType(*out, s->decl->decorate.type);
+  s->isSet = true;
+  *out = s->value;
+  return true;
+}
+
+static bool evalBinOp(eval_t *e, ast_node_p n, int64_t *out) {
+
+  int64_t a;
+  int64_t b;
+
+  switch (n->exprBinOp.op.type) {
+  case TOK_ASSIGN:
+    return evalAssign(e, n, out);
+  case TOK_LOG_AND:
+    if (!evalExpr(e, n->exprBinOp.lhs, &a)) {
+      return false;
+    }
+    if (!a) {
+      *out = 0;
+      return true;
+    }
+    if (!evalExpr(e, n->exprBinOp.rhs, &b)) {
+      return false;
+    }
+    *out = b != 0;
+    return true;
+  case TOK_LOG_OR:
+    if (!evalExpr(e, n->exprBinOp.lhs, &a)) {
+      return false;
+    }
+    if (a) {
+      *out = 1;
+      return true;
+    }
+    if (!evalExpr(e, n->exprBinOp.rhs, &b)) {
+      return false;
+    }
+    *out = b != 0;
+    return true;
+  default:
+    break;
+  }
+
+  if (n->exprBinOp.scale ||
+      !evalExpr(e, n->exprBinOp.lhs, &a) ||
+      !evalExpr(e, n->exprBinOp.rhs, &b)) {
+    return false;
+  }
+
+  int64_t v = 0;
+  switch (n->exprBinOp.op.type) {
+  case TOK_ADD:     v = a + b;  break;
+  case TOK_SUB:     v = a - b;  break;
+  case TOK_MUL:     v = a * b;  break;
+  case TOK_BIT_AND: v = a & b;  break;
+  case TOK_BIT_OR:  v = a | b;  break;
+  case TOK_BIT_XOR: v = a ^ b;  break;
+  case TOK_EQ:      v = a == b; break;
+  case TOK_NEQ:     v = a != b; break;
+  case TOK_LT:      v = a < b;  break;
+  case TOK_LTE:     v = a <= b; break;
+  case TOK_GT:      v = a > b;  break;
+  case TOK_GTE:     v = a >= b; break;
+  case TOK_DIV:
+  case TOK_MOD:
+    // undefined at run time, so left for run time
+    if (b == 0 || (a == INT32_MIN && b == -1)) {
+      return false;
+    }
+    v = tIs(&n->exprBinOp.op, TOK_DIV) ? a / b : a % b;
+    break;
+  case TOK_SHL:
+  case TOK_SHR:
+    if (b < 0 || b > 31) {
+      return false;
+    }
+    v = tIs(&n->exprBinOp.op, TOK_SHL) ? (int64_t)((uint64_t)a << b) : a >> b;
+    break;
+  default:
+    return false;
+  }
+
+  *out = aWrapToType(v, NULL);
+  return true;
+}
+
+static bool evalExpr(eval_t *e, ast_node_p n, int64_t *out) {
+
+  if (++e->steps > EVAL_MAX_STEPS) {
+    return false;
+  }
+
+  eval_slot_t *s;
+  int64_t v;
+
+  switch (n->type) {
+  case AST_EXPR_INT_LIT:
+    return aIntLitValue(n, out);
+  case AST_EXPR_IDENT:
+    s = evalFind(e, n->exprIdent.decl);
+    if (s) {
+      *out = s->value;
+      return s->isSet;
+    }
+    return evalIsConstGlobal(e, n->exprIdent.decl, out);
+  case AST_EXPR_UNARY_OP:
+    if (!evalExpr(e, n->exprUnaryOp.rhs, &v)) {
+      return false;
+    }
+    switch (n->exprUnaryOp.op.type) {
+    case TOK_SUB:      *out = aWrapToType(-v, NULL); return true;
+    case TOK_BIT_NOT:  *out = ~v;                 return true;
+    case TOK_LOG_NOT:  *out = !v;                 return true;
+    default:                                      return false;
+    }
+  case AST_EXPR_BIN_OP:
+    return evalBinOp(e, n, out);
+  case AST_EXPR_CALL:
+    return evalCall(e, n, out);
+  case AST_EXPR_CAST:
+    if (!evalIsScalar(n) || !evalExpr(e, n->exprCast.expr, &v)) {
+      return false;
+    }
+    *out = aWrapToType(v, n->decorate.type);
+    return true;
+  default:
+    return false;
+  }
+}
+
+static eval_flow_t evalChain(eval_t *e, ast_node_p n) {
+  for (; n; n = n->next) {
+    const eval_flow_t flow = evalStmt(e, n);
+    if (flow != EVAL_NEXT) {
+      return flow;
+    }
+  }
+  return EVAL_NEXT;
+}
+
+static bool evalHasLabel(ast_node_p n) {
+  // labels below the top level of a switch body can not be jumped to here
+  for (; n; n = n->next) {
+    if (n->type == AST_STMT_CASE || n->type == AST_STMT_DEFAULT) {
+      return true;
+    }
+    if (n->type == AST_STMT_SWITCH) {
+      continue;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (evalHasLabel(*slots[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static eval_flow_t evalSwitch(eval_t *e, ast_node_p n) {
+
+  int64_t v;
+  if (!evalExpr(e, n->stmtSwitch.expr, &v)) {
+    return EVAL_FAIL;
+  }
+
+  ast_node_p body = n->stmtSwitch.body;
+  if (body && body->type == AST_STMT_COMPOUND) {
+    body = body->stmtCompound.stmt;
+  }
+
+  ast_node_p start = NULL;
+  for (ast_node_p s = body; s; s = s->next) {
+    if (s->type == AST_STMT_CASE && s->stmtCase.value == v) {
+      start = s;
+      break;
+    }
+    if (s->type == AST_STMT_DEFAULT) {
+      start = s;
+    }
+    else if (s->type != AST_STMT_CASE && s->type != AST_STMT_SWITCH) {
+      ast_node_p *slots[AST_MAX_CHILDREN];
+      const uint32_t count = aChildren(s, slots);
+      for (uint32_t i = 0; i < count; ++i) {
+        if (evalHasLabel(*slots[i])) {
+          return EVAL_FAIL;
+        }
+      }
+    }
+  }
+
+  const eval_flow_t flow = evalChain(e, start);
+  return flow == EVAL_BREAK ? EVAL_NEXT : flow;
+}
+
+static eval_flow_t evalLoopBody(eval_t *e, ast_node_p body, bool *done) {
+  // what a loop does after one run of its body
+  const eval_flow_t flow = evalStmt(e, body);
+  *done = flow != EVAL_NEXT && flow != EVAL_CONTINUE;
+  return (flow == EVAL_BREAK || flow == EVAL_CONTINUE) ? EVAL_NEXT : flow;
+}
+
+static eval_flow_t evalStmt(eval_t *e, ast_node_p n) {
+
+  if (!n) {
+    return EVAL_NEXT;
+  }
+  if (++e->steps > EVAL_MAX_STEPS) {
+    return EVAL_FAIL;
+  }
+
+  int64_t v;
+  bool done = false;
+  eval_flow_t flow = EVAL_NEXT;
+
+  switch (n->type) {
+  case AST_STMT_COMPOUND:
+    return evalChain(e, n->stmtCompound.stmt);
+  case AST_DECL_VAR: {
+    eval_slot_t *s = evalDeclare(e, n);
+    s->isSet = false;
+    if (n->declVar.expr) {
+      if (!evalExpr(e, n->declVar.expr, &v)) {
+        return EVAL_FAIL;
+      }
+      s = evalFind(e, n);
+      s->value = aWrapToType(v, n->decorate.type);
+      s->isSet = true;
+    }
+    return EVAL_NEXT;
+  }
+  case AST_STMT_RETURN:
+    e->ret = 0;
+    if (n->stmtReturn.expr && !evalExpr(e, n->stmtReturn.expr, &e->ret)) {
+      return EVAL_FAIL;
+    }
+    return EVAL_RETURN;
+  case AST_STMT_IF:
+    if (!evalExpr(e, n->stmtIf.expr, &v)) {
+      return EVAL_FAIL;
+    }
+    return evalStmt(e, v ? n->stmtIf.isTrue : n->stmtIf.isFalse);
+  case AST_STMT_WHILE:
+    while (!done) {
+      if (!evalExpr(e, n->stmtWhile.expr, &v)) {
+        return EVAL_FAIL;
+      }
+      if (!v) {
+        break;
+      }
+      flow = evalLoopBody(e, n->stmtWhile.body, &done);
+    }
+    return flow;
+  case AST_STMT_DO:
+    while (!done) {
+      flow = evalLoopBody(e, n->stmtDo.body, &done);
+      if (done) {
+        break;
+      }
+      if (!evalExpr(e, n->stmtDo.expr, &v)) {
+        return EVAL_FAIL;
+      }
+      done = !v;
+    }
+    return flow;
+  case AST_STMT_FOR:
+    for (ast_node_p i = n->stmtFor.init; i; i = i->next) {
+      if (!evalExpr(e, i, &v)) {
+        return EVAL_FAIL;
+      }
+    }
+    while (!done) {
+      v = 1;
+      if (n->stmtFor.cond && !evalExpr(e, n->stmtFor.cond, &v)) {
+        return EVAL_FAIL;
+      }
+      if (!v) {
+        break;
+      }
+      flow = evalLoopBody(e, n->stmtFor.body, &done);
+      for (ast_node_p u = n->stmtFor.update; u && !done; u = u->next) {
+        if (!evalExpr(e, u, &v)) {
+          return EVAL_FAIL;
+        }
+      }
+    }
+    return flow;
+  case AST_STMT_SWITCH:
+    return evalSwitch(e, n);
+  case AST_STMT_CASE:
+  case AST_STMT_DEFAULT:
+    return EVAL_NEXT;
+  case AST_STMT_BREAK:
+    return EVAL_BREAK;
+  case AST_STMT_CONTINUE:
+    return EVAL_CONTINUE;
+  case AST_EXPR_IDENT:
+  case AST_EXPR_INT_LIT:
+  case AST_EXPR_BIN_OP:
+  case AST_EXPR_UNARY_OP:
+  case AST_EXPR_CALL:
+  case AST_EXPR_CAST:
+    return evalExpr(e, n, &v) ? EVAL_NEXT : EVAL_FAIL;
+  default:
+    return EVAL_FAIL;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Folding
+//----------------------------------------------------------------------------
+
+static bool evalRun(eval_t *e, ast_node_p n, int64_t *out) {
+  // evaluate with a fresh budget and no frame of locals
+  e->steps    = 0;
+  e->depth    = 0;
+  e->base     = 0;
+  e->numSlots = 0;
+  return evalExpr(e, n, out) && *out != INT32_MIN;
+}
+
+static void evalFold(eval_t *e, ast_node_p n) {
+
+  cg_func_t *f = cgFind(&e->cg, n->exprCall.decl);
+  if (!f || !e->isPure[f - e->cg.funcs] ||
+      aIsVoidType(f->func->declFunc.type)) {
+    return;
+  }
+  int64_t v;
+  for (ast_node_p a = n->exprCall.arg; a; a = a->next) {
+    if (!aIntLitValue(a, &v)) {
+      return;
+    }
+  }
+
+  if (!evalRun(e, n, &v)) {
+    e->gaveUp++;
+    return;
+  }
+  ast_node_p lit = aIntNew(v, n->exprCall.ident.line);
+  lit->decorate.type = n->decorate.type;
+  aNodeReplace(n, lit);
+  e->folded++;
+}
+
+static void evalWalk(eval_t *e, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    // arguments first so nested calls fold from the inside out
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      evalWalk(e, *slots[i]);
+    }
+
+    if (n->type == AST_EXPR_CALL) {
+      evalFold(e, n);
+    }
+  }
+}
+
+void oConstEval(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  eval_t e;
+  memset(&e, 0, sizeof(e));
+  cgBuild(n, &e.cg);
+  evalPurity(&e);
+
+  for (ast_node_p d = n->root.node; d; d = d->next) {
+
+    if (d->type == AST_DECL_FUNC) {
+      evalWalk(&e, d->declFunc.body);
+      continue;
+    }
+
+    // global initializers become data
+    int64_t v;
+    if (d->type != AST_DECL_VAR || !d->declVar.expr ||
+        !evalIsScalar(d) || aIntLitValue(d->declVar.expr, &v)) {
+      continue;
+    }
+    if (!evalRun(&e, d->declVar.expr, &v)) {
+      continue;
+    }
+    v = aWrapToType(v, d->decorate.type);
+    if (v == INT32_MIN) {
+      continue;
+    }
+    d->declVar.expr = aIntNew(v, d->declVar.ident.line);
+    e.globals++;
+  }
+
+  if (opt->stats) {
+    fprintf(opt->out, "eval: %u calls folded, %u globals, %u gave up\n",
+      e.folded, e.globals, e.gaveUp);
+  }
+
+  free(e.slots);
+  free(e.isPure);
+  cgFree(&e.cg);
+}
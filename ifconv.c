@@ -0,0 +1,214 @@
+#include "defs.h"
+
+
+// If conversion.
+//
+// Small if statements where each arm only assigns the same local:
+//
+//   if (c) x = a; else x = b;       if (c) x = a;
+//
+// are rewritten into straight line code which selects the value with a mask
+// instead of a branch, the AST equivalent of a conditional move:
+//
+//   { int __mask = 0 - (c != 0); x = (a & __mask) | (b & ~__mask); }
+//
+// Both arms are evaluated so they must be free of side effects and of
+// anything that could trap (calls, assignments, loads through pointers and
+// division). opt->ifConvertCost bounds the node count of the two arms.
+
+
+typedef struct {
+  const opt_t *opt;
+  uint32_t     converted;
+} ifconv_t;
+
+static token_t ifconvMaskIdent = {
+  "__mask", "__mask" + 6, TOK_IDENT, 0
+};
+
+static ast_node_p ifconvArm(ast_node_p arm) {
+  // the single assignment an arm consists of
+  while (arm && arm->type == AST_STMT_COMPOUND) {
+    arm = arm->stmtCompound.stmt;
+    if (arm && arm->next) {
+      return NULL;
+    }
+  }
+  if (!arm || arm->type != AST_EXPR_BIN_OP ||
+      !tIs(&arm->exprBinOp.op, TOK_ASSIGN) ||
+      arm->exprBinOp.lhs->type != AST_EXPR_IDENT) {
+    return NULL;
+  }
+  return arm;
+}
+
+static bool ifconvIsPure(ast_node_p n) {
+  for (; n; n = n->next) {
+    switch (n->type) {
+    case AST_EXPR_CALL:
+    case AST_EXPR_INDEX:
+      return false;
+    case AST_EXPR_BIN_OP:
+      if (tIs(&n->exprBinOp.op, TOK_ASSIGN) ||
+          tIs(&n->exprBinOp.op, TOK_DIV)    ||
+          tIs(&n->exprBinOp.op, TOK_MOD)) {
+        return false;
+      }
+      break;
+    case AST_EXPR_UNARY_OP:
+      if (tIs(&n->exprUnaryOp.op, TOK_MUL)) {
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!ifconvIsPure(*slots[i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool ifconvIsBool(ast_node_p c) {
+  // expressions which already produce 0 or 1
+  if (c->type == AST_EXPR_UNARY_OP) {
+    return tIs(&c->exprUnaryOp.op, TOK_LOG_NOT);
+  }
+  if (c->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  switch (c->exprBinOp.op.type) {
+  case TOK_EQ:
+  case TOK_NEQ:
+  case TOK_LT:
+  case TOK_LTE:
+  case TOK_GT:
+  case TOK_GTE:
+  case TOK_LOG_AND:
+  case TOK_LOG_OR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool ifconvIsIntLocal(ifconv_t *ic, ast_node_p var) {
+
+  if (!var || var->type != AST_DECL_VAR || var->declVar.isEscaping) {
+    return false;
+  }
+
+  // masking only works on integers
+  ast_node_p t = var->declVar.type;
+  for (; t; t = t->next) {
+    if (tIs(&t->declType.token, TOK_MUL) || tIs(&t->declType.token, TOK_VOID)) {
+      return false;
+    }
+  }
+
+  // a store to a global can not be made unconditional
+  return !var->declVar.isGlobal;
+}
+
+static void ifconvIf(ifconv_t *ic, ast_node_p n) {
+
+  ast_node_p t = ifconvArm(n->stmtIf.isTrue);
+  ast_node_p f = ifconvArm(n->stmtIf.isFalse);
+  if (!t || (n->stmtIf.isFalse && !f)) {
+    return;
+  }
+
+  ast_node_p var = t->exprBinOp.lhs->exprIdent.decl;
+  if (f && f->exprBinOp.lhs->exprIdent.decl != var) {
+    return;
+  }
+  if (!ifconvIsIntLocal(ic, var)) {
+    return;
+  }
+
+  ast_node_p a = t->exprBinOp.rhs;
+  ast_node_p b = f ? f->exprBinOp.rhs : NULL;
+  if (!ifconvIsPure(a) || !ifconvIsPure(b) || !ifconvIsPure(n->stmtIf.expr)) {
+    return;
+  }
+  if (aNodeCount(a) + aNodeCount(b) > ic->opt->ifConvertCost) {
+    return;
+  }
+
+  const uint32_t line = n->stmtIf.token.line;
+
+  // if (c) x = a; is if (c) x = a; else x = x;
+  if (!b) {
+    b = aIdentNew(var, line);
+  }
+
+  // int __mask = 0 - (c != 0);
+  ast_node_p c = n->stmtIf.expr;
+  if (!ifconvIsBool(c)) {
+    c = aBinOpNew(TOK_NEQ, c, aIntLitNew(0, line), line);
+  }
+  ast_node_p mask = aNodeNew(AST_DECL_VAR);
+  mask->declVar.type = aNodeNew(AST_DECL_TYPE);
+  mask->declVar.type->declType.token = tMake(TOK_INT, line);
+  mask->declVar.type->last = mask->declVar.type;
+  mask->declVar.ident = ifconvMaskIdent;
+  mask->declVar.ident.line = line;
+  mask->declVar.expr = aBinOpNew(TOK_SUB, aIntLitNew(0, line), c, line);
+
+  // x = (a & __mask) | (b & ~__mask);
+  ast_node_p notMask = aNodeNew(AST_EXPR_UNARY_OP);
+  notMask->exprUnaryOp.op  = tMake(TOK_BIT_NOT, line);
+  notMask->exprUnaryOp.rhs = aIdentNew(mask, line);
+
+  ast_node_p select = aBinOpNew(TOK_BIT_OR,
+    aBinOpNew(TOK_BIT_AND, a, aIdentNew(mask, line), line),
+    aBinOpNew(TOK_BIT_AND, b, notMask, line),
+    line);
+
+  ast_node_p out = NULL;
+  out = aNodeInsert(out, mask);
+  out = aNodeInsert(out, aBinOpNew(TOK_ASSIGN, aIdentNew(var, line), select, line));
+
+  ast_node_p comp = aNodeNew(AST_STMT_COMPOUND);
+  comp->stmtCompound.stmt = out;
+  aNodeReplace(n, comp);
+
+  ic->converted++;
+}
+
+static void ifconvWalk(ifconv_t *ic, ast_node_p n) {
+  for (; n; n = n->next) {
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      ifconvWalk(ic, *slots[i]);
+    }
+    if (n->type == AST_STMT_IF) {
+      ifconvIf(ic, n);
+    }
+  }
+}
+
+void oIfConvert(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  ifconv_t ic;
+  memset(&ic, 0, sizeof(ic));
+  ic.opt  = opt;
+
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type == AST_DECL_FUNC) {
+      ifconvWalk(&ic, f->declFunc.body);
+    }
+  }
+
+  if (opt->stats) {
+    fprintf(opt->out, "ifconv: %u converted\n", ic.converted);
+  }
+}
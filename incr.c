@@ -0,0 +1,341 @@
+#include "defs.h"
+
+
+// Incremental reparsing for an editor.
+//
+// The source is kept as one window of text per top level declaration, from
+// the end of the previous declaration up to its own last token, and a tail
+// holding whatever follows the last one:
+//
+//   [int g;][\n\nint f() {\n  return g;\n}][\n]
+//
+// An edit that stays inside a single window only lexes and parses that
+// declaration again. The new node overwrites the old one in place so every
+// reference to it stays valid, and only that declaration is checked again
+// as long as what later declarations can see of it, its name and types, is
+// unchanged. Lines of later declarations are shifted when the number of
+// newlines changes. Any other edit, or one that does not parse, falls back
+// to a full parse.
+
+
+static bool incrIsClosed(const char *text, size_t size) {
+  // an open comment or bracket would reach into the following declarations,
+  // as would a declaration missing its final ; or }
+  if (!size || (text[size - 1] != ';' && text[size - 1] != '}')) {
+    return false;
+  }
+  int32_t depth = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const char next = i + 1 < size ? text[i + 1] : '\0';
+    if (text[i] == '/' && next == '*') {
+      for (i += 2; i + 1 < size && !(text[i] == '*' && text[i + 1] == '/'); ++i);
+      if (i + 1 >= size) {
+        return false;
+      }
+      ++i;
+      continue;
+    }
+    if (text[i] == '/' && next == '/') {
+      for (; i < size && text[i] != '\n'; ++i);
+      if (i >= size) {
+        return false;
+      }
+      continue;
+    }
+    switch (text[i]) {
+    case '(': case '[': case '{':
+      ++depth;
+      break;
+    case ')': case ']': case '}':
+      if (--depth < 0) {
+        return false;
+      }
+      break;
+    }
+  }
+  return depth == 0;
+}
+
+static void incrPush(incr_t *in, ast_node_p n, const char *text, size_t size,
+                     uint32_t line, uint32_t lines) {
+  if (in->numDecls >= in->maxDecls) {
+    in->maxDecls += 128;
+    in->decls = realloc(in->decls, in->maxDecls * sizeof(incr_decl_t));
+    assert(in->decls);
+  }
+  incr_decl_t *d = &in->decls[in->numDecls++];
+  d->node  = n;
+  d->text  = text;
+  d->size  = size;
+  d->line  = line;
+  d->lines = lines;
+  d->owned = false;
+}
+
+static void incrFreeText(incr_t *in) {
+  for (uint32_t i = 0; i < in->numDecls; ++i) {
+    if (in->decls[i].owned) {
+      free((char*)in->decls[i].text);
+    }
+  }
+  in->numDecls = 0;
+  free(in->source);
+  in->source = NULL;
+}
+
+static void incrBuild(incr_t *in, char *src, size_t size) {
+
+  compiler_ctx_t *ctx = in->ctx;
+  incrFreeText(in);
+  in->source = src;
+
+  lInitText(ctx, src, size, 1);
+
+  in->root->root.node = NULL;
+
+  const char *prev = src;
+  uint32_t line = 1;
+
+  token_t token;
+  while (!lFound(ctx, TOK_EOF, &token)) {
+    // a broken declaration is left to the window of the next one
+    ast_node_p n = pParseDecl(ctx);
+    if (!n) {
+      continue;
+    }
+    in->root->root.node = aNodeInsert(in->root->root.node, n);
+
+    // the window ends with the last token of the declaration
+    lex_t lex;
+    lSave(ctx, &lex);
+    incrPush(in, n, prev, (size_t)(lex.ptr - prev), line, lex.lineNum - line);
+    line = lex.lineNum;
+    prev = lex.ptr;
+  }
+
+  in->tail = prev;
+  in->tailSize = (size_t)(src + size - prev);
+  in->reparsed += in->numDecls;
+
+  if (!dErrors(ctx)) {
+    sCheck(ctx, in->root);
+  }
+}
+
+static void incrRebuild(incr_t *in, size_t offset, size_t removed,
+                        const char *text) {
+
+  compiler_ctx_t *ctx = in->ctx;
+
+  // put the whole document back together with the edit applied, it is
+  // reported on from scratch
+  dTruncate(ctx, 0);
+  size_t size = in->tailSize;
+  for (uint32_t i = 0; i < in->numDecls; ++i) {
+    size += in->decls[i].size;
+  }
+  const size_t inserted = strlen(text);
+  char *src = malloc(size + inserted + 1);
+  assert(src);
+
+  size_t at = 0;
+  for (uint32_t i = 0; i < in->numDecls; ++i) {
+    memcpy(src + at, in->decls[i].text, in->decls[i].size);
+    at += in->decls[i].size;
+  }
+  memcpy(src + at, in->tail, in->tailSize);
+
+  memmove(src + offset + inserted, src + offset + removed,
+          size - offset - removed);
+  memcpy(src + offset, text, inserted);
+  size = size - removed + inserted;
+  src[size] = '\0';
+
+  incrBuild(in, src, size);
+}
+
+static void incrShift(ast_node_p n, int32_t delta) {
+  // n itself and every node below it
+  token_t *t = aToken(n);
+  if (t) {
+    t->line += delta;
+  }
+  ast_node_p *slots[AST_MAX_CHILDREN];
+  const uint32_t count = aChildren(n, slots);
+  for (uint32_t i = 0; i < count; ++i) {
+    for (ast_node_p c = *slots[i]; c; c = c->next) {
+      incrShift(c, delta);
+    }
+  }
+}
+
+static bool incrSameType(const ast_type_t *a, const ast_type_t *b) {
+  if (!a || !b) {
+    return a == b;
+  }
+  return a->width      == b->width      &&
+         a->ptrLevel   == b->ptrLevel   &&
+         a->count      == b->count      &&
+         a->isVoid     == b->isVoid     &&
+         a->isConst    == b->isConst    &&
+         a->constDeref == b->constDeref &&
+         a->isStatic   == b->isStatic   &&
+         a->isSigned   == b->isSigned;
+}
+
+static bool incrSameChain(ast_node_p a, ast_node_p b) {
+  for (; a && b; a = a->next, b = b->next) {
+    if (a->declType.token.type != b->declType.token.type) {
+      return false;
+    }
+  }
+  return a == b;
+}
+
+static bool incrSameSignature(const ast_node_t *old, ast_node_p n) {
+
+  // what the declarations following this one can see of it
+  if (old->type != n->type) {
+    return false;
+  }
+  if (n->type == AST_DECL_VAR) {
+    return tEqual(&old->declVar.ident, &n->declVar.ident) &&
+           incrSameType(old->decorate.type, n->decorate.type);
+  }
+
+  if (!tEqual(&old->declFunc.ident, &n->declFunc.ident) ||
+      !incrSameChain(old->declFunc.type, n->declFunc.type) ||
+      !old->declFunc.body != !n->declFunc.body) {
+    return false;
+  }
+  ast_node_p a = old->declFunc.args;
+  ast_node_p b = n->declFunc.args;
+  for (; a && b; a = a->next, b = b->next) {
+    if (!incrSameType(a->decorate.type, b->decorate.type)) {
+      return false;
+    }
+  }
+  return a == b;
+}
+
+bool iOpen(incr_t *in, compiler_ctx_t *ctx, const char *file) {
+
+  memset(in, 0, sizeof(incr_t));
+  in->ctx = ctx;
+
+  // an edit only relexes its own text, it never follows an include
+  ctx->noIncludes = true;
+  if (!lInit(ctx, file)) {
+    return false;
+  }
+  // take over the text the lexer read
+  lex_t lex;
+  lSave(ctx, &lex);
+
+  in->root = aNodeNew(AST_ROOT);
+  incrBuild(in, (char*)lex.start, (size_t)(lex.end - lex.start));
+  return true;
+}
+
+bool iEdit(incr_t *in, size_t offset, size_t removed, const char *text) {
+
+  compiler_ctx_t *ctx = in->ctx;
+
+  // find the window the edit starts in
+  size_t start = 0;
+  uint32_t i = 0;
+  for (; i < in->numDecls; ++i) {
+    if (offset < start + in->decls[i].size) {
+      break;
+    }
+    start += in->decls[i].size;
+  }
+  size_t size = start;
+  for (uint32_t j = i; j < in->numDecls; ++j) {
+    size += in->decls[j].size;
+  }
+  size += in->tailSize;
+  if (offset > size || removed > size - offset) {
+    return false;
+  }
+
+  // edits of the tail or across declarations need the whole document, as
+  // does one with errors so none of them are left behind
+  if (i == in->numDecls || offset + removed > start + in->decls[i].size ||
+      dErrors(ctx)) {
+    incrRebuild(in, offset, removed, text);
+    return true;
+  }
+
+  incr_decl_t *d = &in->decls[i];
+  const size_t at = offset - start;
+  const size_t inserted = strlen(text);
+  const size_t newSize = d->size - removed + inserted;
+
+  char *buf = malloc(newSize + 1);
+  assert(buf);
+  memcpy(buf, d->text, at);
+  memcpy(buf + at, text, inserted);
+  memcpy(buf + at + inserted, d->text + at + removed, d->size - at - removed);
+  buf[newSize] = '\0';
+
+  if (!incrIsClosed(buf, newSize)) {
+    free(buf);
+    incrRebuild(in, offset, removed, text);
+    return true;
+  }
+
+  // the window has to still hold exactly one declaration
+  lInitText(ctx, buf, newSize, d->line);
+  token_t token;
+  lPeek(ctx, &token);
+  ast_node_p n = NULL;
+  lex_t lex;
+  const uint32_t reported = dCount(ctx);
+  if (!tIs(&token, TOK_EOF)) {
+    n = pParseDecl(ctx);
+    lSave(ctx, &lex);
+    n = lex.ptr == buf + newSize && dCount(ctx) == reported ? n : NULL;
+  }
+  if (!n) {
+    free(buf);
+    incrRebuild(in, offset, removed, text);
+    return true;
+  }
+
+  const ast_node_t old = *d->node;
+  aNodeReplace(d->node, n);
+  if (d->owned) {
+    free((char*)d->text);
+  }
+  d->text  = buf;
+  d->size  = newSize;
+  d->owned = true;
+
+  // lines as the lexer counts them, so they match a full parse
+  const uint32_t lines = lex.lineNum - d->line;
+  const int32_t delta = (int32_t)lines - (int32_t)d->lines;
+  d->lines = lines;
+  if (delta) {
+    for (uint32_t j = i + 1; j < in->numDecls; ++j) {
+      in->decls[j].line += delta;
+      incrShift(in->decls[j].node, delta);
+    }
+  }
+
+  const uint32_t checked = dCount(ctx);
+  sCheckDecl(ctx, in->root, d->node);
+  if (!incrSameSignature(&old, d->node)) {
+    dTruncate(ctx, checked);
+    sCheck(ctx, in->root);
+  }
+
+  in->reparsed++;
+  return true;
+}
+
+void iClose(incr_t *in) {
+  incrFreeText(in);
+  free(in->decls);
+  memset(in, 0, sizeof(incr_t));
+}
@@ -0,0 +1,342 @@
+#include "defs.h"
+
+
+// Function inlining driven by a node count cost model.
+//
+// Calls in statement position (f(x); a = f(x); return f(x); int a = f(x);)
+// to small non-recursive functions with a body are replaced by a copy of
+// the callee. Parameters become locals initialized by the arguments and each
+// return becomes an assignment to a result temporary followed by a break out
+// of a 'do { } while (0)' wrapping the body, which acts as the merge point.
+//
+// Callees are processed before their callers so inlined bodies have already
+// been optimized. opt->inlineSize limits the size of a callee and
+// opt->inlineBudget limits how many nodes may be added to each caller.
+// A static function with a single call site is inlined regardless of its
+// size, its original is then unused and can be dropped by -forder.
+
+
+typedef struct {
+  const opt_t *opt;
+  cg_t         cg;
+  uint32_t     growth;    // nodes added to the current caller
+} inline_t;
+
+static token_t inlineRetIdent = {
+  "__ret", "__ret" + 5, TOK_IDENT, 0
+};
+
+static uint32_t inlineCount(ast_node_p n) {
+  uint32_t count = 0;
+  for (; n; n = n->next) {
+    ++count;
+  }
+  return count;
+}
+
+static uint32_t inlineReturns(ast_node_p n, bool inLoop, bool *nested) {
+  // count return statements and spot those a break can not leave from
+  uint32_t count = 0;
+  for (; n; n = n->next) {
+    bool loop = inLoop;
+    switch (n->type) {
+    case AST_STMT_RETURN:
+      *nested |= inLoop;
+      ++count;
+      break;
+    case AST_STMT_WHILE:
+    case AST_STMT_DO:
+    case AST_STMT_FOR:
+    case AST_STMT_SWITCH:
+      loop = true;
+      break;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t num = aChildren(n, slots);
+    for (uint32_t i = 0; i < num; ++i) {
+      count += inlineReturns(*slots[i], loop, nested);
+    }
+  }
+  return count;
+}
+
+static void inlineRewriteReturns(ast_node_p n, ast_node_p ret, bool jump) {
+  // return e; -> { __ret = e; break; }
+  for (; n; n = n->next) {
+    if (n->type != AST_STMT_RETURN) {
+      ast_node_p *slots[AST_MAX_CHILDREN];
+      const uint32_t num = aChildren(n, slots);
+      for (uint32_t i = 0; i < num; ++i) {
+        inlineRewriteReturns(*slots[i], ret, jump);
+      }
+      continue;
+    }
+
+    const uint32_t line = n->stmtReturn.token.line;
+    ast_node_p e = n->stmtReturn.expr;
+    ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+
+    if (e && ret) {
+      e = aBinOpNew(TOK_ASSIGN, aIdentNew(ret, line), e, line);
+    }
+    if (e) {
+      c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt, e);
+    }
+    if (jump) {
+      ast_node_p b = aNodeNew(AST_STMT_BREAK);
+      b->stmtBreak.token = tMake(TOK_BREAK, line);
+      c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt, b);
+    }
+    aNodeReplace(n, c);
+  }
+}
+
+static bool inlineHasStatic(ast_node_p n) {
+  // each copy of a static local would be a separate variable
+  for (; n; n = n->next) {
+    if (n->type == AST_DECL_VAR && aIsStatic(n->declVar.type)) {
+      return true;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t num = aChildren(n, slots);
+    for (uint32_t i = 0; i < num; ++i) {
+      if (inlineHasStatic(*slots[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static ast_node_p inlineCallee(inline_t *in, ast_node_p call) {
+
+  cg_func_t *f = cgFind(&in->cg, call->exprCall.decl);
+  if (!f || !f->func->declFunc.body || f->isRecursive) {
+    return NULL;
+  }
+  ast_node_p callee = f->func;
+
+  // argument count must line up with the parameters
+  ast_node_p args = callee->declFunc.args;
+  const uint32_t params = aIsVoidArgs(args) ? 0 : inlineCount(args);
+  if (params != inlineCount(call->exprCall.arg)) {
+    return NULL;
+  }
+
+  // returns from inside a loop or switch can not be turned into a break
+  bool nested = false;
+  inlineReturns(callee->declFunc.body, false, &nested);
+  if (nested || inlineHasStatic(callee->declFunc.body)) {
+    return NULL;
+  }
+
+  // moving the only copy of a function does not grow the program
+  if (aIsStatic(callee->declFunc.type) && f->numCallSites == 1) {
+    return callee;
+  }
+
+  // cost model
+  const uint32_t size = aNodeCount(callee->declFunc.body) + aNodeCount(args);
+  if (size > in->opt->inlineSize ||
+      in->growth + size > in->opt->inlineBudget) {
+    return NULL;
+  }
+
+  in->growth += size;
+  return callee;
+}
+
+static ast_node_p inlineExpand(ast_node_p call, ast_node_p callee,
+                               bool wantResult, ast_node_p *ret) {
+
+  const uint32_t line = call->exprCall.ident.line;
+
+  // copy of the callee, uses of the parameters refer to the copied decls
+  ast_node_p copy = aNodeClone(callee);
+  ast_node_p out  = NULL;
+
+  // result temporary
+  *ret = NULL;
+  if (wantResult && !aIsVoidType(callee->declFunc.type)) {
+    ast_node_p r = aNodeNew(AST_DECL_VAR);
+    r->declVar.type = aTypeUnqual(callee->declFunc.type);
+    r->declVar.ident = inlineRetIdent;
+    r->declVar.ident.line = line;
+    out = aNodeInsert(out, r);
+    *ret = r;
+  }
+
+  // bind parameters to the arguments
+  if (!aIsVoidArgs(copy->declFunc.args)) {
+    ast_node_p p = copy->declFunc.args;
+    ast_node_p a = call->exprCall.arg;
+    while (p) {
+      ast_node_p nextP = p->next;
+      ast_node_p nextA = a->next;
+      a->next = NULL;
+      p->declVar.expr = a;
+      out = aNodeInsert(out, p);
+      p = nextP;
+      a = nextA;
+    }
+  }
+
+  // the body, only a return as the last statement can fall through
+  ast_node_p body = copy->declFunc.body;
+  bool nested = false;
+  const uint32_t returns = inlineReturns(body, false, &nested);
+  const bool fallthrough =
+    returns == 0 ||
+    (returns == 1 && body->last->type == AST_STMT_RETURN);
+
+  inlineRewriteReturns(body, *ret, !fallthrough);
+
+  if (fallthrough) {
+    ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+    c->stmtCompound.stmt = body;
+    out = aNodeInsert(out, c);
+  }
+  else {
+    ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+    c->stmtCompound.stmt = body;
+    ast_node_p d = aNodeNew(AST_STMT_DO);
+    d->stmtDo.token = tMake(TOK_DO, line);
+    d->stmtDo.body  = c;
+    d->stmtDo.expr  = aIntLitNew(0, line);
+    out = aNodeInsert(out, d);
+  }
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = out;
+  return c;
+}
+
+static bool inlineIsCall(ast_node_p n) {
+  return n && n->type == AST_EXPR_CALL && n->exprCall.decl &&
+         n->exprCall.decl->type == AST_DECL_FUNC;
+}
+
+static void inlineSite(inline_t *in, ast_node_p chain, ast_node_p n,
+                       bool isBlock) {
+
+  ast_node_p callee = NULL;
+  ast_node_p ret    = NULL;
+  ast_node_p c      = NULL;
+  uint32_t   line   = 0;
+
+  switch (n->type) {
+  case AST_EXPR_CALL:
+    // f(x);
+    if (!inlineIsCall(n) || !(callee = inlineCallee(in, n))) {
+      return;
+    }
+    aNodeReplace(n, inlineExpand(n, callee, false, &ret));
+    break;
+
+  case AST_EXPR_BIN_OP:
+    // a = f(x);
+    if (!tIs(&n->exprBinOp.op, TOK_ASSIGN) ||
+        n->exprBinOp.lhs->type != AST_EXPR_IDENT ||
+        !inlineIsCall(n->exprBinOp.rhs) ||
+        aIsVoidType(n->exprBinOp.rhs->exprCall.decl->declFunc.type) ||
+        !(callee = inlineCallee(in, n->exprBinOp.rhs))) {
+      return;
+    }
+    line = n->exprBinOp.op.line;
+    c = inlineExpand(n->exprBinOp.rhs, callee, true, &ret);
+    n->exprBinOp.rhs = aIdentNew(ret, line);
+    c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt, aNodeClone(n));
+    aNodeReplace(n, c);
+    break;
+
+  case AST_STMT_RETURN:
+    // return f(x);
+    if (!inlineIsCall(n->stmtReturn.expr) ||
+        !(callee = inlineCallee(in, n->stmtReturn.expr))) {
+      return;
+    }
+    line = n->stmtReturn.token.line;
+    c = inlineExpand(n->stmtReturn.expr, callee, true, &ret);
+    n->stmtReturn.expr = ret ? aIdentNew(ret, line) : NULL;
+    c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt, aNodeClone(n));
+    aNodeReplace(n, c);
+    break;
+
+  case AST_DECL_VAR:
+    // int a = f(x);
+    if (!isBlock || !inlineIsCall(n->declVar.expr) ||
+        aIsVoidType(n->declVar.expr->exprCall.decl->declFunc.type) ||
+        !(callee = inlineCallee(in, n->declVar.expr))) {
+      return;
+    }
+    line = n->declVar.ident.line;
+    c = inlineExpand(n->declVar.expr, callee, true, &ret);
+    n->declVar.expr = NULL;
+    c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt,
+      aBinOpNew(TOK_ASSIGN, aIdentNew(n, line), aIdentNew(ret, line), line));
+    aNodeInsertAfter(chain, n, c);
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void inlineBlock(inline_t *in, ast_node_p chain, bool isBlock) {
+  for (ast_node_p n = chain; n; n = n->next) {
+
+    // keep cold code small
+    if (n->decorate.isCold) {
+      continue;
+    }
+
+    // nested statements
+    switch (n->type) {
+    case AST_STMT_COMPOUND:
+      inlineBlock(in, n->stmtCompound.stmt, true);
+      break;
+    case AST_STMT_IF:
+      inlineBlock(in, n->stmtIf.isTrue, false);
+      inlineBlock(in, n->stmtIf.isFalse, false);
+      break;
+    case AST_STMT_WHILE:
+      inlineBlock(in, n->stmtWhile.body, false);
+      break;
+    case AST_STMT_DO:
+      inlineBlock(in, n->stmtDo.body, false);
+      break;
+    case AST_STMT_FOR:
+      inlineBlock(in, n->stmtFor.body, false);
+      break;
+    case AST_STMT_SWITCH:
+      inlineBlock(in, n->stmtSwitch.body, false);
+      break;
+    default:
+      break;
+    }
+
+    inlineSite(in, chain, n, isBlock);
+  }
+}
+
+void oInline(ast_node_p n, const opt_t *opt) {
+
+  inline_t in;
+  memset(&in, 0, sizeof(in));
+  in.opt = opt;
+  cgBuild(n, &in.cg);
+
+  // bottom up so callees are final before they are copied
+  for (uint32_t i = 0; i < in.cg.numFuncs; ++i) {
+    ast_node_p f = in.cg.funcs[in.cg.order[i]].func;
+    if (f->decorate.isCold) {
+      continue;
+    }
+    in.growth = 0;
+    inlineBlock(&in, f->declFunc.body, true);
+  }
+
+  cgFree(&in.cg);
+}
@@ -0,0 +1,206 @@
+#include "defs.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+
+// Running independent jobs on a pool of threads.
+//
+// Every worker owns a queue. The jobs are sorted by cost and dealt out
+// round robin, largest first, so each worker starts on the biggest of its
+// share and a large job never ends up last on an otherwise idle pool:
+//
+//   costs 9 7 5 4 2 1, two workers  ->  [9 5 2] [7 4 1]
+//
+// A worker whose queue ran dry steals the next job of the fullest other
+// queue. Jobs finish in any order, jWait lets the caller pick up their
+// results in the order it likes.
+
+
+typedef struct {
+  pthread_mutex_t lock;
+  uint32_t       *jobs;
+  uint32_t        head;
+  uint32_t        tail;
+} job_queue_t;
+
+struct jobs_s {
+  job_func_t      func;
+  void           *user;
+  job_queue_t    *queues;
+  pthread_t      *threads;
+  uint32_t        numThreads;
+  bool           *done;
+  pthread_mutex_t lock;         // done and stolen
+  pthread_cond_t  finished;
+  uint32_t        stolen;
+};
+
+typedef struct {
+  jobs_t   *jobs;
+  uint32_t  worker;
+} job_worker_t;
+
+typedef struct {
+  uint64_t cost;
+  uint32_t job;
+} job_order_t;
+
+static int jobCompare(const void *a, const void *b) {
+  // most expensive first, equal ones in the order they were given
+  const job_order_t *x = a;
+  const job_order_t *y = b;
+  if (x->cost != y->cost) {
+    return x->cost > y->cost ? -1 : 1;
+  }
+  return x->job < y->job ? -1 : (x->job > y->job ? 1 : 0);
+}
+
+static bool jobTake(job_queue_t *q, uint32_t *out) {
+  pthread_mutex_lock(&q->lock);
+  const bool found = q->head < q->tail;
+  if (found) {
+    *out = q->jobs[q->head++];
+  }
+  pthread_mutex_unlock(&q->lock);
+  return found;
+}
+
+static bool jobSteal(jobs_t *j, uint32_t worker, uint32_t *out) {
+
+  // the fullest queue is the furthest from finishing
+  for (;;) {
+    uint32_t victim = worker;
+    uint32_t most = 0;
+    for (uint32_t i = 0; i < j->numThreads; ++i) {
+      job_queue_t *q = &j->queues[i];
+      pthread_mutex_lock(&q->lock);
+      const uint32_t left = q->tail - q->head;
+      pthread_mutex_unlock(&q->lock);
+      if (i != worker && left > most) {
+        victim = i;
+        most = left;
+      }
+    }
+    if (victim == worker) {
+      return false;
+    }
+    // it may have been emptied meanwhile, look again
+    if (jobTake(&j->queues[victim], out)) {
+      return true;
+    }
+  }
+}
+
+static void *jobWorker(void *arg) {
+
+  job_worker_t *w = arg;
+  jobs_t *j = w->jobs;
+
+  uint32_t job;
+  for (;;) {
+    bool stolen = false;
+    if (!jobTake(&j->queues[w->worker], &job)) {
+      if (!jobSteal(j, w->worker, &job)) {
+        break;
+      }
+      stolen = true;
+    }
+
+    j->func(j->user, w->worker, job);
+
+    pthread_mutex_lock(&j->lock);
+    j->done[job] = true;
+    j->stolen += stolen ? 1 : 0;
+    pthread_cond_broadcast(&j->finished);
+    pthread_mutex_unlock(&j->lock);
+  }
+
+  free(w);
+  return NULL;
+}
+
+uint32_t jCores(void) {
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (uint32_t)cores : 1;
+}
+
+jobs_t *jStart(uint32_t numJobs, const uint64_t *cost, uint32_t numThreads,
+               job_func_t func, void *user) {
+
+  assert(numThreads > 0);
+
+  jobs_t *j = malloc(sizeof(jobs_t));
+  assert(j);
+  memset(j, 0, sizeof(jobs_t));
+  j->func       = func;
+  j->user       = user;
+  j->numThreads = numThreads;
+  j->done       = calloc(numJobs + 1, sizeof(bool));
+  j->queues     = calloc(numThreads, sizeof(job_queue_t));
+  j->threads    = calloc(numThreads, sizeof(pthread_t));
+  assert(j->done && j->queues && j->threads);
+  pthread_mutex_init(&j->lock, NULL);
+  pthread_cond_init(&j->finished, NULL);
+
+  job_order_t *order = malloc((numJobs + 1) * sizeof(job_order_t));
+  assert(order);
+  for (uint32_t i = 0; i < numJobs; ++i) {
+    order[i].cost = cost[i];
+    order[i].job  = i;
+  }
+  qsort(order, numJobs, sizeof(job_order_t), jobCompare);
+
+  for (uint32_t i = 0; i < numThreads; ++i) {
+    job_queue_t *q = &j->queues[i];
+    pthread_mutex_init(&q->lock, NULL);
+    q->jobs = malloc((numJobs / numThreads + 1) * sizeof(uint32_t));
+    assert(q->jobs);
+  }
+  for (uint32_t i = 0; i < numJobs; ++i) {
+    job_queue_t *q = &j->queues[i % numThreads];
+    q->jobs[q->tail++] = order[i].job;
+  }
+  free(order);
+
+  // every queue is filled before the first worker looks at one
+  for (uint32_t i = 0; i < numThreads; ++i) {
+    job_worker_t *w = malloc(sizeof(job_worker_t));
+    assert(w);
+    w->jobs   = j;
+    w->worker = i;
+    const int failed = pthread_create(&j->threads[i], NULL, jobWorker, w);
+    assert(!failed);
+    (void)failed;
+  }
+  return j;
+}
+
+void jWait(jobs_t *j, uint32_t job) {
+  pthread_mutex_lock(&j->lock);
+  while (!j->done[job]) {
+    pthread_cond_wait(&j->finished, &j->lock);
+  }
+  pthread_mutex_unlock(&j->lock);
+}
+
+uint32_t jFinish(jobs_t *j) {
+
+  // returns how many jobs ran on another worker than they were dealt to
+  for (uint32_t i = 0; i < j->numThreads; ++i) {
+    pthread_join(j->threads[i], NULL);
+  }
+  const uint32_t stolen = j->stolen;
+
+  for (uint32_t i = 0; i < j->numThreads; ++i) {
+    pthread_mutex_destroy(&j->queues[i].lock);
+    free(j->queues[i].jobs);
+  }
+  pthread_mutex_destroy(&j->lock);
+  pthread_cond_destroy(&j->finished);
+  free(j->queues);
+  free(j->threads);
+  free(j->done);
+  free(j);
+  return stolen;
+}
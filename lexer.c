@@ -1,60 +1,208 @@
 #include "defs.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Included files.
+//
+//   #include "name.h"
+//
+// names a file next to the one containing the directive. Each header is
+// mapped once per process and stays mapped, so the files of a -j build and
+// the requests of a server all share it. The first time a header is mapped
+// it is looked over for '#pragma once' and for a classic include guard:
+//
+//   #ifndef NAME_H
+//   #define NAME_H
+//   ...
+//   #endif
+//
+// A later include of a header with either is dropped without reading it
+// when the header, or one with the same guard, was entered before in this
+// compile. The guard lines are the only conditionals understood, the lexer
+// reads what lies between them.
+//
+// Entering a header makes a lex_include_t holding the state to return to
+// at its end, and the new lex_t points at it. A saved lex_t so carries its
+// whole include stack, and peeking or backing up needs nothing else. A
+// directive lexed again finds the lex_include_t made the first time and
+// decides the same way.
+
+
+#define LEX_MAX_DEPTH 64
+
+struct lex_header_s {
+  dev_t         dev;        // the file it was mapped from
+  ino_t         ino;
+  off_t         size;
+  struct timespec mtime;
+  const char   *body;       // what the lexer reads, inside the guard
+  const char   *bodyEnd;
+  uint32_t      bodyLine;
+  bool          once;
+  const char   *guard;      // name of the include guard, NULL without one
+  uint32_t      guardLen;
+  lex_header_t *next;
+};
+
+static pthread_mutex_t lexHeadersLock = PTHREAD_MUTEX_INITIALIZER;
+static lex_header_t *lexHeaders;
+
+uint32_t lLineNum(compiler_ctx_t *ctx) {
+  if (!ctx->lex.file) {
+    return ctx->lex.lineNum;
+  }
+  return LINE_HEADER | (ctx->lex.file << LINE_FILE_SHIFT) |
+         (ctx->lex.lineNum & LINE_MASK);
+}
 
-static lex_t lex;
+const char *lFileName(compiler_ctx_t *ctx, uint32_t line) {
+  // the included file a line is in, NULL for the file being compiled
+  const uint32_t file = (line >> LINE_FILE_SHIFT) & LINE_FILE_MAX;
+  if (!(line & LINE_HEADER) || !file || file > ctx->numFiles) {
+    return NULL;
+  }
+  return ctx->files[file].name;
+}
 
-uint32_t lLineNum(void) {
-  return lex.lineNum;
+void lReset(compiler_ctx_t *ctx) {
+  // forgets the includes, headers stay mapped for the next compile
+  for (lex_include_t *i = ctx->includes; i;) {
+    lex_include_t *next = i->next;
+    free(i);
+    i = next;
+  }
+  for (uint32_t i = 1; i <= ctx->numFiles; ++i) {
+    free(ctx->files[i].name);
+  }
+  ctx->includes   = NULL;
+  ctx->numFiles   = 0;
+  ctx->lexFile    = NULL;
+  ctx->noIncludes = false;
 }
 
-bool lInit(const char *file) {
+char *lRead(const char *file, size_t *size) {
 
+  // the whole file terminated by '\0', NULL if it can not be opened
   FILE *fd = fopen(file, "rb");
   if (!fd) {
-    ERROR("Unable to open '%s'\n", file);
-    return false;
+    return NULL;
   }
 
   // file size
   fseek(fd, 0, SEEK_END);
   const long fdSize = ftell(fd);
   fseek(fd, 0, SEEK_SET);
-  if (fdSize <= 0) {
-    return false;
-  }
 
   // read file data
-  char *src = malloc(fdSize + 1);
+  char *src = malloc(fdSize > 0 ? fdSize + 1 : 1);
   if (!src) {
-    return false;
+    fclose(fd);
+    return NULL;
   }
-  fread(src, 1, fdSize, fd);
-  src[fdSize] = '\0';
+  *size = fdSize > 0 ? fread(src, 1, fdSize, fd) : 0;
+  src[*size] = '\0';
 
   // close file handle
   fclose(fd);
+  return src;
+}
+
+bool lInit(compiler_ctx_t *ctx, const char *file) {
+
+  size_t size;
+  char *src = lRead(file, &size);
+  if (!src) {
+    dReportText(ctx, DIAG_OPEN_FAILED, lLineNum(ctx), file, strlen(file));
+    return false;
+  }
+  if (!size) {
+    free(src);
+    return false;
+  }
+
+  lInitText(ctx, src, size, 1);
+  ctx->lexFile = file;
+  return true;
+}
 
-  // init lexer
-  lex.start = src;
-  lex.end = src + fdSize;
-  lex.lineNum = 1;
-  lex.lineStart = src;
-  lex.ptr = src;
+static char *lMapFile(int fd, size_t size) {
 
+  // reserve one byte more than the file so the text is always terminated,
+  // the anonymous page behind the file reads as zero
+  char *src = mmap(NULL, size + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (src == MAP_FAILED) {
+    return NULL;
+  }
+  if (mmap(src, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(src, size + 1);
+    return NULL;
+  }
+  return src;
+}
+
+bool lMap(compiler_ctx_t *ctx, const char *file) {
+
+  // map the file instead of reading it, its pages can be dropped again by
+  // the kernel once the lexer has moved past them
+  const int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    dReportText(ctx, DIAG_OPEN_FAILED, lLineNum(ctx), file, strlen(file));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  const size_t size = (size_t)st.st_size;
+  char *src = lMapFile(fd, size);
+  close(fd);
+  if (!src) {
+    return false;
+  }
+
+  lInitText(ctx, src, size, 1);
+  ctx->lexFile = file;
   return true;
 }
 
-static void lSkipWhitespace(void) {
+void lUnmap(compiler_ctx_t *ctx) {
+  // the text lMap mapped, nothing may point into it any more
+  while (ctx->lex.include) {
+    ctx->lex = ctx->lex.include->from;
+  }
+  munmap((void*)ctx->lex.start, (size_t)(ctx->lex.end - ctx->lex.start) + 1);
+  memset(&ctx->lex, 0, sizeof(ctx->lex));
+}
+
+void lInitText(compiler_ctx_t *ctx, const char *src, size_t size,
+               uint32_t line) {
+  // src must be terminated, src[size] == '\0'
+  ctx->lex.start = src;
+  ctx->lex.end = src + size;
+  ctx->lex.lineNum = line;
+  ctx->lex.lineStart = src;
+  ctx->lex.ptr = src;
+  ctx->lex.file = 0;
+  ctx->lex.include = NULL;
+}
+
+static void lSkipWhitespace(compiler_ctx_t *ctx) {
 
   bool inComment = false;
 
-  const char *p = lex.ptr;
+  const char *p = ctx->lex.ptr;
   for (;*p; ++p) {
 
     // track newlines
     if (*p == '\n') {
-      lex.lineNum++;
-      lex.lineStart = (p + 1);
+      ctx->lex.lineNum++;
+      ctx->lex.lineStart = (p + 1);
     }
 
     // multi line comments
@@ -89,7 +237,7 @@ static void lSkipWhitespace(void) {
     break;
   }
 
-  lex.ptr = p;
+  ctx->lex.ptr = p;
 }
 
 static bool lIsAlpha(char c) {
@@ -100,11 +248,11 @@ static bool lIsNumeric(char c) {
   return (c >= '0' && c <= '9');
 }
 
-static bool lMatch(const char *s) {
-  const char *p = lex.ptr;
+static bool lMatch(compiler_ctx_t *ctx, const char *s) {
+  const char *p = ctx->lex.ptr;
   for (;; ++p, ++s) {
     if (*s == '\0') {
-      lex.ptr = p;
+      ctx->lex.ptr = p;
       return true;
     }
     if (*s != *p) {
@@ -113,8 +261,22 @@ static bool lMatch(const char *s) {
   }
 }
 
-static bool lIdent(token_t *out) {
-  const char *p = lex.ptr;
+static bool lMatchKeyword(compiler_ctx_t *ctx, const char *s) {
+  // a keyword must not just be the prefix of a longer identifier
+  const char *save = ctx->lex.ptr;
+  if (!lMatch(ctx, s)) {
+    return false;
+  }
+  const char c = *ctx->lex.ptr;
+  if (lIsAlpha(c) || lIsNumeric(c) || c == '_') {
+    ctx->lex.ptr = save;
+    return false;
+  }
+  return true;
+}
+
+static bool lIdent(compiler_ctx_t *ctx, token_t *out) {
+  const char *p = ctx->lex.ptr;
   if (!lIsAlpha(*p) && *p != '_') {
     return false;
   }
@@ -131,41 +293,398 @@ static bool lIdent(token_t *out) {
     break;
   }
   out->end = p;
-  lex.ptr = p;
+  ctx->lex.ptr = p;
   return true;
 }
 
-static bool lIntLit(token_t *out) {
-  const char *p = lex.ptr;
+static bool lIntLit(compiler_ctx_t *ctx, token_t *out) {
+  const char *p = ctx->lex.ptr;
   for (; lIsNumeric(*p); ++p);
-  if (lex.ptr == p) {
+  if (ctx->lex.ptr == p) {
     return false;
   }
   out->end = p;
-  lex.ptr = p;
+  ctx->lex.ptr = p;
+  return true;
+}
+
+static const char *lBlank(const char *p, const char *end) {
+  // past whitespace and comments
+  while (p < end) {
+    if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+      ++p;
+    }
+    else if (p + 1 < end && p[0] == '/' && p[1] == '/') {
+      for (; p < end && *p != '\n'; ++p);
+    }
+    else if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+      for (p += 2; p + 1 < end && !(p[0] == '*' && p[1] == '/'); ++p);
+      p = p + 1 < end ? p + 2 : end;
+    }
+    else {
+      break;
+    }
+  }
+  return p;
+}
+
+static const char *lWord(const char *p, const char *end, const char **word,
+                         uint32_t *len) {
+  // the identifier after spaces and tabs, returns where it ends
+  for (; p < end && (*p == ' ' || *p == '\t'); ++p);
+  *word = p;
+  for (; p < end && (lIsAlpha(*p) || lIsNumeric(*p) || *p == '_'); ++p);
+  *len = (uint32_t)(p - *word);
+  return p;
+}
+
+static bool lIsWord(const char *word, uint32_t len, const char *s) {
+  return len == strlen(s) && memcmp(word, s, len) == 0;
+}
+
+static const char *lLineEnd(const char *p, const char *end) {
+  for (; p < end && *p != '\n'; ++p);
+  return p;
+}
+
+static void lScanHeader(lex_header_t *h, const char *text, size_t size) {
+
+  const char *end = text + size;
+  h->body    = text;
+  h->bodyEnd = end;
+
+  // #ifndef NAME, #define NAME, nothing but blanks after the define
+  const char *word;
+  uint32_t len;
+  const char *name = NULL;
+  uint32_t nameLen = 0;
+  const char *p = lBlank(text, end);
+  if (p < end && *p == '#') {
+    p = lWord(p + 1, end, &word, &len);
+    if (lIsWord(word, len, "ifndef")) {
+      p = lWord(p, end, &name, &nameLen);
+      p = lBlank(p, end);
+    }
+  }
+  const char *body = NULL;
+  if (nameLen && p < end && *p == '#') {
+    p = lWord(p + 1, end, &word, &len);
+    const char *define = NULL;
+    uint32_t defineLen = 0;
+    if (lIsWord(word, len, "define")) {
+      p = lWord(p, end, &define, &defineLen);
+    }
+    for (; p < end && (*p == ' ' || *p == '\t' || *p == '\r'); ++p);
+    if (defineLen == nameLen && memcmp(define, name, nameLen) == 0 &&
+        (p == end || *p == '\n')) {
+      body = p;
+    }
+  }
+
+  // the last thing in the file has to be the matching #endif, any other
+  // conditional and it is not a guard
+  const char *endif = NULL;
+  bool guarded = body != NULL;
+  for (p = body ? body : text; (p = lBlank(p, end)) < end;) {
+    if (*p != '#') {
+      guarded &= !endif;
+      ++p;
+      continue;
+    }
+    const char *at = p;
+    p = lWord(p + 1, end, &word, &len);
+    if (lIsWord(word, len, "pragma")) {
+      const char *once;
+      uint32_t onceLen;
+      lWord(p, end, &once, &onceLen);
+      h->once |= lIsWord(once, onceLen, "once");
+    }
+    if (lIsWord(word, len, "endif")) {
+      guarded &= !endif;
+      endif = at;
+    }
+    else if (lIsWord(word, len, "if") || lIsWord(word, len, "ifdef") ||
+             lIsWord(word, len, "ifndef") || lIsWord(word, len, "elif") ||
+             lIsWord(word, len, "else")) {
+      guarded = false;
+    }
+    else {
+      guarded &= !endif;
+    }
+    p = lLineEnd(p, end);
+  }
+
+  if (guarded && endif) {
+    h->body     = body;
+    h->bodyEnd  = endif;
+    h->guard    = name;
+    h->guardLen = nameLen;
+  }
+  h->bodyLine = 1;
+  for (p = text; p < h->body; ++p) {
+    h->bodyLine += *p == '\n' ? 1 : 0;
+  }
+}
+
+static const lex_header_t *lHeader(const char *path) {
+
+  // the mapped header at path, NULL if it can not be read
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&lexHeadersLock);
+
+  // a header that changed since is mapped again, the old text stays for
+  // trees still pointing into it
+  lex_header_t *h = lexHeaders;
+  for (; h; h = h->next) {
+    if (h->dev == st.st_dev && h->ino == st.st_ino && h->size == st.st_size &&
+        h->mtime.tv_sec == st.st_mtim.tv_sec &&
+        h->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+      break;
+    }
+  }
+
+  if (!h) {
+    const size_t size = (size_t)st.st_size;
+    const int fd = size ? open(path, O_RDONLY) : -1;
+    const char *text = size ? (fd >= 0 ? lMapFile(fd, size) : NULL) : "";
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (text) {
+      h = malloc(sizeof(lex_header_t));
+      assert(h);
+      memset(h, 0, sizeof(lex_header_t));
+      h->dev   = st.st_dev;
+      h->ino   = st.st_ino;
+      h->size  = st.st_size;
+      h->mtime = st.st_mtim;
+      lScanHeader(h, text, size);
+      h->next = lexHeaders;
+      lexHeaders = h;
+    }
+  }
+
+  pthread_mutex_unlock(&lexHeadersLock);
+  return h;
+}
+
+static bool lIncludeOnce(compiler_ctx_t *ctx, const lex_header_t *header,
+                         const char *path) {
+
+  // true when header was entered before and asked not to be again
+  for (uint32_t i = 1; i <= ctx->numFiles; ++i) {
+    const lex_header_t *h = ctx->files[i].header;
+    if (header ? h == header && h->once
+               : strcmp(ctx->files[i].name, path) == 0 && (h->once || h->guard)) {
+      return true;
+    }
+    if (header && header->guard && h->guard && h->guardLen == header->guardLen &&
+        memcmp(h->guard, header->guard, h->guardLen) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void lEnter(compiler_ctx_t *ctx, const lex_include_t *inc) {
+  const lex_header_t *h = inc->header;
+  ctx->lex.start     = h->body;
+  ctx->lex.end       = h->bodyEnd;
+  ctx->lex.ptr       = h->body;
+  ctx->lex.lineStart = h->body;
+  ctx->lex.lineNum   = h->bodyLine;
+  ctx->lex.file      = inc->file;
+  ctx->lex.include   = inc;
+}
+
+static uint32_t lAddFile(compiler_ctx_t *ctx, const lex_header_t *header,
+                         char *path) {
+
+  // a header without a guard keeps its number when included again, takes
+  // over path
+  uint32_t file = 1;
+  for (; file <= ctx->numFiles && ctx->files[file].header != header; ++file);
+  if (file <= ctx->numFiles) {
+    free(path);
+    return file;
+  }
+  if (ctx->numFiles + 1 >= ctx->maxFiles) {
+    ctx->maxFiles = ctx->maxFiles ? ctx->maxFiles * 2 : 16;
+    ctx->files = realloc(ctx->files, ctx->maxFiles * sizeof(lex_file_t));
+    assert(ctx->files);
+  }
+  file = ++ctx->numFiles;
+  ctx->files[file].header = header;
+  ctx->files[file].name   = path;
+  return file;
+}
+
+static void lInclude(compiler_ctx_t *ctx, const char *at, const char *name,
+                     uint32_t len) {
+
+  // lexed before, decide the same way
+  for (lex_include_t *i = ctx->includes; i; i = i->next) {
+    if (i->at == at && i->from.include == ctx->lex.include) {
+      if (i->header) {
+        lEnter(ctx, i);
+      }
+      return;
+    }
+  }
+
+  lex_include_t *inc = malloc(sizeof(lex_include_t));
+  assert(inc);
+  memset(inc, 0, sizeof(lex_include_t));
+  inc->from = ctx->lex;
+  inc->at   = at;
+  inc->next = ctx->includes;
+  ctx->includes = inc;
+
+  // next to the including file
+  const char *from = ctx->lex.file ? ctx->files[ctx->lex.file].name
+                                   : ctx->lexFile;
+  const char *slash = from && name[0] != '/' ? strrchr(from, '/') : NULL;
+  const size_t dir = slash ? (size_t)(slash - from) + 1 : 0;
+  char *path = malloc(dir + len + 1);
+  assert(path);
+  memcpy(path, from ? from : "", dir);
+  memcpy(path + dir, name, len);
+  path[dir + len] = '\0';
+
+  // a guarded header entered before is not even looked up again
+  uint32_t depth = 0;
+  for (const lex_include_t *i = ctx->lex.include; i; i = i->from.include) {
+    depth++;
+  }
+  const lex_header_t *header = NULL;
+  if (lIncludeOnce(ctx, NULL, path)) {
+    free(path);
+    return;
+  }
+  if (!(header = lHeader(path))) {
+    dReportText(ctx, DIAG_OPEN_FAILED, lLineNum(ctx), name, len);
+    free(path);
+    return;
+  }
+  if (depth >= LEX_MAX_DEPTH || ctx->numFiles >= LINE_FILE_MAX) {
+    dReportText(ctx, DIAG_INCLUDE_LIMIT, lLineNum(ctx), name, len);
+    free(path);
+    return;
+  }
+  if (lIncludeOnce(ctx, header, path)) {
+    free(path);
+    return;
+  }
+
+  inc->header = header;
+  inc->file   = lAddFile(ctx, header, path);
+  lEnter(ctx, inc);
+}
+
+uint32_t lPrefix(compiler_ctx_t *ctx, const char *file) {
+
+  // the file a snapshot of declarations was made from, taken as included
+  // before the compiled file so an #include of it is dropped, returns its
+  // number for the lines of the declarations or 0 if it is gone
+  const lex_header_t *header = lHeader(file);
+  if (!header || ctx->numFiles >= LINE_FILE_MAX) {
+    return 0;
+  }
+  char *path = strdup(file);
+  assert(path);
+  return lAddFile(ctx, header, path);
+}
+
+static bool lDirective(compiler_ctx_t *ctx) {
+
+  // #include "name" and #pragma once, anything else is an unknown token
+  const char *at = ctx->lex.ptr;
+  for (const char *p = ctx->lex.lineStart; p < at; ++p) {
+    if (*p != ' ' && *p != '\t') {
+      return false;
+    }
+  }
+  if (ctx->noIncludes) {
+    return false;
+  }
+
+  const char *end = ctx->lex.end;
+  const char *word;
+  uint32_t len;
+  const char *p = lWord(at + 1, end, &word, &len);
+
+  if (lIsWord(word, len, "pragma")) {
+    p = lWord(p, end, &word, &len);
+    if (!lIsWord(word, len, "once")) {
+      return false;
+    }
+    ctx->lex.ptr = p;
+    return true;
+  }
+
+  if (!lIsWord(word, len, "include")) {
+    return false;
+  }
+  for (; *p == ' ' || *p == '\t'; ++p);
+  const char *name = p + 1;
+  const char *close = *p == '"' ? name : NULL;
+  for (; close && *close != '"'; ++close) {
+    if (*close == '\n' || *close == '\0') {
+      return false;
+    }
+  }
+  if (!close || close == name) {
+    return false;
+  }
+  ctx->lex.ptr = close + 1;
+  lInclude(ctx, at, name, (uint32_t)(close - name));
   return true;
 }
 
-void lPop(token_t *out) {
+static void lSkip(compiler_ctx_t *ctx) {
+  // whitespace, directives and the ends of included files
+  for (;;) {
+    lSkipWhitespace(ctx);
+    if (ctx->lex.include &&
+        (ctx->lex.ptr >= ctx->lex.end || *ctx->lex.ptr == '\0')) {
+      ctx->lex = ctx->lex.include->from;
+      continue;
+    }
+    if (*ctx->lex.ptr == '#' && lDirective(ctx)) {
+      continue;
+    }
+    return;
+  }
+}
+
+void lPop(compiler_ctx_t *ctx, token_t *out) {
 
-  lSkipWhitespace();
+  ctx->lexBefore = ctx->lex;
+  lSkip(ctx);
 
   // prepare outgoing token
   out->type  = TOK_UNKNOWN;
-  out->line  = lex.lineNum;
-  out->start = lex.ptr;
+  out->line  = lLineNum(ctx);
+  out->start = ctx->lex.ptr;
   out->end   = NULL;
 
-#define TEST(FOR, TOK) if (lMatch(FOR)) { out->type = TOK; break; }
+#define TEST(FOR, TOK) if (lMatch(ctx, FOR)) { out->type = TOK; break; }
+#define KEYWORD(FOR, TOK) if (lMatchKeyword(ctx, FOR)) { out->type = TOK; break; }
 
   // first stage simple classifier
-  switch (*lex.ptr) {
+  switch (*ctx->lex.ptr) {
   case '\0': out->type = TOK_EOF;       break;
   case ';':  out->type = TOK_SEMICOLON; break;
   case '(':  out->type = TOK_LPAREN;    break;
   case ')':  out->type = TOK_RPAREN;    break;
   case '{':  out->type = TOK_LBRACE;    break;
   case '}':  out->type = TOK_RBRACE;    break;
+  case '[':  out->type = TOK_LBRACKET;  break;
+  case ']':  out->type = TOK_RBRACKET;  break;
   case '+':  out->type = TOK_ADD;       break;
   case '-':  out->type = TOK_SUB;       break;
   case '*':  out->type = TOK_MUL;       break;
@@ -200,64 +719,93 @@ void lPop(token_t *out) {
     TEST("!=", TOK_NEQ);
     out->type = TOK_LOG_NOT;
     break;
-  case 'b':   TEST("break",     TOK_BREAK);     break;
-  case 'c':   TEST("char",      TOK_CHAR);
-              TEST("continue",  TOK_CONTINUE);  break;
-  case 'd':   TEST("do",        TOK_DO);        break;
-  case 'e':   TEST("else",      TOK_ELSE);      break;
-  case 'f':   TEST("for",       TOK_FOR);       break;
-  case 'i':   TEST("int",       TOK_INT);
-              TEST("if",        TOK_IF);        break;
-  case 'r':   TEST("return",    TOK_RETURN);    break;
-  case 's':   TEST("short",     TOK_SHORT);     break;
-  case 'v':   TEST("void",      TOK_VOID);      break;
-  case 'w':   TEST("while",     TOK_WHILE);     break;
+  case ':':  out->type = TOK_COLON;     break;
+  case 'b':   KEYWORD("break",     TOK_BREAK);     break;
+  case 'c':   KEYWORD("case",      TOK_CASE);
+              KEYWORD("char",      TOK_CHAR);
+              KEYWORD("const",     TOK_CONST);
+              KEYWORD("continue",  TOK_CONTINUE);  break;
+  case 'd':   KEYWORD("default",   TOK_DEFAULT);
+              KEYWORD("do",        TOK_DO);        break;
+  case 'e':   KEYWORD("else",      TOK_ELSE);      break;
+  case 'f':   KEYWORD("for",       TOK_FOR);       break;
+  case 'i':   KEYWORD("int",       TOK_INT);
+              KEYWORD("if",        TOK_IF);        break;
+  case 'r':   KEYWORD("return",    TOK_RETURN);    break;
+  case 's':   KEYWORD("short",     TOK_SHORT);
+              KEYWORD("static",    TOK_STATIC);
+              KEYWORD("switch",    TOK_SWITCH);    break;
+  case 'v':   KEYWORD("void",      TOK_VOID);      break;
+  case 'w':   KEYWORD("while",     TOK_WHILE);     break;
   }
 
   // second stage classifier
   if (out->type == TOK_UNKNOWN) {
     do {
-      if (lIdent(out))  { out->type = TOK_IDENT;   break; }
-      if (lIntLit(out)) { out->type = TOK_INT_LIT; break; }
+      if (lIdent(ctx, out))  { out->type = TOK_IDENT;   break; }
+      if (lIntLit(ctx, out)) { out->type = TOK_INT_LIT; break; }
 
-      ERROR("unknown token on line %u", lex.lineNum);
+      // peeking lexes the same token again, report it once
+      if (out->start != ctx->lexBadAt) {
+        dReport(ctx, DIAG_UNKNOWN_TOKEN, lLineNum(ctx), ctx->lex.lineNum);
+        ctx->lexBadAt = out->start;
+      }
 
     } while (0);
   }
 
-  // fixup for one character tokens
-  if (lex.ptr == out->start) {
-    ++lex.ptr;
+  // fixup for one character tokens, the end of the text stays put
+  if (ctx->lex.ptr == out->start && out->type != TOK_EOF) {
+    ++ctx->lex.ptr;
   }
 
   // fill in token end
-  out->end = lex.ptr;
+  out->end = ctx->lex.ptr;
+  ctx->lexBad = out->type == TOK_UNKNOWN;
+}
+
+void lPeek(compiler_ctx_t *ctx, token_t *out) {
+  const lex_t save = ctx->lex;
+  lPop(ctx, out);
+  ctx->lex = save;
 }
 
-void lPeek(token_t *out) {
-  const lex_t save = lex;
-  lPop(out);
-  lex = save;
+void lSave(compiler_ctx_t *ctx, lex_t *out) {
+  *out = ctx->lex;
 }
 
-void lExpect(token_type_t type, token_t *t) {
+void lRestore(compiler_ctx_t *ctx, const lex_t *in) {
+  ctx->lex = *in;
+}
+
+void lExpect(compiler_ctx_t *ctx, token_type_t type, token_t *t) {
   token_t q;
   t = t ? t : &q;
-  lPop(t);
+  lPop(ctx, t);
   if (t->type == type) {
     return;
   }
-  ERROR("expected %s token", tTypeName(type));
+  lFail(ctx, DIAG_EXPECTED_TOKEN, type);
+}
+
+void lFail(compiler_ctx_t *ctx, diag_kind_t kind, uint32_t num) {
+  // a token the lexer did not understand has been reported already
+  if (!ctx->lexBad) {
+    dReport(ctx, kind, lLineNum(ctx), num);
+  }
+  // put back the token that failed, it may be the ';' or '}' to resync at
+  ctx->lex = ctx->lexBefore;
+  dAbort(ctx);
 }
 
-bool lFound(token_type_t type, token_t *out) {
+bool lFound(compiler_ctx_t *ctx, token_type_t type, token_t *out) {
 
   token_t temp;
   out = out ? out : &temp;
 
-  lPeek(out);
+  lPeek(ctx, out);
   if (out->type == type) {
-    lPop(out);
+    lPop(ctx, out);
     return true;
   }
   return false;
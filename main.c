@@ -1,24 +1,866 @@
 #include "defs.h"
 
-int main(int argc, char **args) {
+#include <sys/stat.h>
 
-  if (argc <= 1) {
-    printf("usage: %s <file.c>\n", args[0]);
-    return 0;
+static void usage(const char *exe) {
+  printf("usage: %s [options] <file.c>...\n", exe);
+  printf("  -funroll               unroll counted for loops\n");
+  printf("  -funroll-factor=<n>    partial unroll factor (default 4)\n");
+  printf("  -funroll-budget=<n>    max nodes an unrolled loop may produce\n");
+  printf("  -finline               inline small non-recursive functions\n");
+  printf("  -finline-size=<n>      max callee size in nodes (default 32)\n");
+  printf("  -finline-budget=<n>    max nodes added to each caller\n");
+  printf("  -ftail-calls           turn self recursive tail calls into loops\n");
+  printf("  -fpromote              keep non escaping locals in registers\n");
+  printf("  --profile-generate     instrument branches and function entries\n");
+  printf("  --profile-use=<file>   optimize using a recorded profile\n");
+  printf("  -fif-convert           replace small if/else assignments by selects\n");
+  printf("  -fif-convert-cost=<n>  max nodes in the converted arms (default 8)\n");
+  printf("  -forder                drop unreachable functions, order the rest\n");
+  printf("  -fexport=<a,b>         extra roots for -forder besides main\n");
+  printf("  -fswitch               pick a lowering for each switch, convert if chains\n");
+  printf("  -fpeephole             simplify small local patterns to a fixpoint\n");
+  printf("  -faddr-modes           fold constant index parts into scale and offset\n");
+  printf("  -fconst-prop           replace reads of const globals by their value\n");
+  printf("  -fvectorize            strip mine element-wise loops for SSE2\n");
+  printf("  -fconst-eval           run pure calls with constant arguments\n");
+  printf("  -fstats                print optimization statistics\n");
+  printf("  --lazy                 only parse the function bodies that are needed\n");
+  printf("  --dump-func=<name>     dump a single function\n");
+  printf("  --edit=<off,len,text>  apply an edit and reparse incrementally\n");
+  printf("  --stream               check and dump one declaration at a time\n");
+  printf("  -j <n>                 compile the files on n threads\n");
+  printf("  --server[=<socket>]    answer compile requests from stdin or a socket\n");
+  printf("  --run-tests[=<dir>]    run the golden tests, on -j threads\n");
+  printf("  --cache=<dir>          reuse outputs of earlier identical compiles\n");
+  printf("  --cache-size=<MiB>     evict the oldest entries beyond this (256)\n");
+  printf("  --cache-stats          print hits, misses and size of the cache\n");
+  printf("  --pch-write=<file>     write the declarations of a header as a snapshot\n");
+  printf("  --pch=<file>           start from the declarations of a snapshot\n");
+}
+
+static bool isNamed(const token_t *t, const char *name) {
+  return (size_t)tSize(t) == strlen(name) &&
+         memcmp(t->start, name, strlen(name)) == 0;
+}
+
+static ast_node_p findFunc(ast_node_p n, const char *name) {
+  // the definition if there is one, else the last prototype
+  ast_node_p found = NULL;
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type != AST_DECL_FUNC || !isNamed(&f->declFunc.ident, name)) {
+      continue;
+    }
+    if (!found || f->declFunc.body || f->declFunc.isLazy) {
+      found = f;
+    }
+  }
+  return found;
+}
+
+#define MAX_EDITS 16
+
+typedef struct {
+  size_t  offset;
+  size_t  removed;
+  char   *text;
+} edit_t;
+
+typedef struct {
+  const char   *file;
+  const char   *text;       // source sent with a request, else file is read
+  size_t        size;
+  const edit_t *edits;
+  uint32_t      numEdits;
+} input_t;
+
+typedef struct {
+  opt_t        opt;
+  const char **files;
+  uint32_t     numFiles;
+  uint32_t     threads;
+  edit_t       edits[MAX_EDITS];
+  uint32_t     numEdits;
+  const char  *server;      // socket to listen on, "-" for stdin
+  const char  *tests;       // directory of golden tests to run
+  cache_t      cache;
+  const char  *cacheDir;
+  uint32_t     cacheSize;   // in MiB
+  bool         cacheStats;
+} driver_t;
+
+static bool parseEdit(const char *arg, edit_t *out) {
+  // <offset>,<removed>,<text> where text may use \n, \t and \\ escapes
+  char *end;
+  out->offset = (size_t)strtoul(arg, &end, 10);
+  if (*end++ != ',') {
+    return false;
+  }
+  out->removed = (size_t)strtoul(end, &end, 10);
+  if (*end++ != ',') {
+    return false;
+  }
+  out->text = malloc(strlen(end) + 1);
+  char *o = out->text;
+  for (; *end; ++end) {
+    if (end[0] == '\\' && end[1]) {
+      ++end;
+      *o++ = *end == 'n' ? '\n' : *end == 't' ? '\t' : *end;
+      continue;
+    }
+    *o++ = *end;
+  }
+  *o = '\0';
+  return true;
+}
+
+static bool parseUint(const char *arg, const char *prefix, uint32_t *out) {
+  const size_t len = strlen(prefix);
+  if (strncmp(arg, prefix, len) != 0) {
+    return false;
+  }
+  *out = (uint32_t)strtoul(arg + len, NULL, 10);
+  return true;
+}
+
+static void streamDrop(ast_node_p d) {
+  // keep only what later declarations can refer to
+  if (d->type == AST_DECL_FUNC && d->declFunc.body) {
+    aNodeFree(d->declFunc.body);
+    d->declFunc.body = NULL;
+    d->declFunc.isDropped = true;
+  }
+  if (d->type == AST_DECL_VAR) {
+    aNodeFree(d->declVar.size);
+    aNodeFree(d->declVar.expr);
+    d->declVar.size = NULL;
+    d->declVar.expr = NULL;
+  }
+}
+
+static void prependDecls(ast_node_p root, ast_node_p decls) {
+  // declarations from a snapshot go before those of the file
+  if (!decls) {
+    return;
+  }
+  ast_node_p first = root->root.node;
+  decls->last->next = first;
+  decls->last = first ? first->last : decls->last;
+  root->root.node = decls;
+}
+
+static bool loadInput(compiler_ctx_t *ctx, const input_t *in) {
+
+  // the text goes with the tree on cReset
+  if (in->text) {
+    ctx->source = malloc(in->size + 1);
+    assert(ctx->source);
+    memcpy(ctx->source, in->text, in->size);
+    ctx->source[in->size] = '\0';
+    lInitText(ctx, ctx->source, in->size, 1);
+    ctx->lexFile = in->file;
+    return true;
+  }
+  if (!lInit(ctx, in->file)) {
+    return false;
+  }
+  ctx->source = (char*)ctx->lex.start;
+  return true;
+}
+
+static bool loadHeader(compiler_ctx_t *ctx, const input_t *in) {
+
+  // a header is read the way an #include reads it, guard and all
+  if (in->text) {
+    return loadInput(ctx, in);
+  }
+  const size_t size = strlen(in->file) + sizeof("#include \"\"\n");
+  ctx->source = malloc(size);
+  assert(ctx->source);
+  snprintf(ctx->source, size, "#include \"%s\"\n", in->file);
+  lInitText(ctx, ctx->source, size - 1, 1);
+  return true;
+}
+
+static int streamFile(compiler_ctx_t *ctx, const input_t *in,
+                      const opt_t *opt) {
+
+  // each declaration is parsed, checked and dumped before the next is read,
+  // so memory only grows with the number of global symbols
+  ast_node_p prefix = NULL;
+  if ((opt->pch && !phLoad(ctx, opt->pch, &prefix)) ||
+      (in->text ? !loadInput(ctx, in) : !lMap(ctx, in->file))) {
+    aNodeFree(prefix);
+    dEmit(ctx);
+    return 1;
+  }
+
+  // counted from here, earlier files on this thread may have left nodes
+  const uint32_t live = aNodeLive();
+
+  ast_node_p root = aNodeNew(AST_ROOT);
+  ctx->root = root;
+  aDump(root, opt->out);
+
+  uint32_t decls = 0;
+  uint32_t peak = 0;
+
+  // declarations of a snapshot join the symbol table without a check
+  while (prefix) {
+    ast_node_p d = prefix;
+    prefix = d->next;
+    d->next = NULL;
+    sCheckNext(ctx, d);
+    aDumpDepth(d, 1, opt->out);
+    root->root.node = aNodeInsert(root->root.node, d);
+  }
+
+  // after a syntax error only the parse carries on, to report the rest
+  bool broken = false;
+
+  while (!lFound(ctx, TOK_EOF, NULL)) {
+    ast_node_p d = pParseDecl(ctx);
+    broken |= !d;
+    if (broken) {
+      continue;
+    }
+    sCheckNext(ctx, d);
+    if (!dErrors(ctx)) {
+      aDumpDepth(d, 1, opt->out);
+    }
+
+    peak = aNodeLive() - live > peak ? aNodeLive() - live : peak;
+    streamDrop(d);
+    root->root.node = aNodeInsert(root->root.node, d);
+    decls++;
+  }
+
+  const bool failed = dErrors(ctx) != 0;
+  if (failed) {
+    dEmit(ctx);
+  }
+  if (!in->text) {
+    lUnmap(ctx);
+  }
+  if (failed) {
+    return 1;
+  }
+  if (opt->stats) {
+    fprintf(opt->out, "stream: %u declarations, at most %u nodes live\n",
+      decls, peak);
+  }
+  return 0;
+}
+
+static int compileFile(compiler_ctx_t *ctx, const input_t *in,
+                       const opt_t *opt) {
+
+  ast_node_p n = NULL;
+  ast_node_p dump = NULL;
+
+  if (in->numEdits) {
+    // the edits are replayed the way an editor would send them
+    incr_t incr;
+    if (!iOpen(&incr, ctx, in->file)) {
+      dEmit(ctx);
+      return 1;
+    }
+    incr.reparsed = 0;
+    for (uint32_t i = 0; i < in->numEdits; ++i) {
+      const edit_t *e = &in->edits[i];
+      if (!iEdit(&incr, e->offset, e->removed, e->text)) {
+        fprintf(opt->out, "edit %u out of range\n", i);
+        return 1;
+      }
+    }
+    if (opt->stats) {
+      fprintf(opt->out, "incr: reparsed %u of %u declarations\n",
+        incr.reparsed, incr.numDecls);
+    }
+    n = incr.root;
+  }
+  else {
+    ast_node_p prefix = NULL;
+    if ((opt->pch && !phLoad(ctx, opt->pch, &prefix)) ||
+        !(opt->pchWrite ? loadHeader(ctx, in) : loadInput(ctx, in))) {
+      aNodeFree(prefix);
+      dEmit(ctx);
+      return 1;
+    }
+    n = pParse(ctx, opt->lazy);
+    prependDecls(n, prefix);
+    ctx->root = n;
+  }
+
+  // a lazy parse skipped every body, read back the ones this run looks at
+  if (opt->dumpFunc && !(dump = findFunc(n, opt->dumpFunc))) {
+    fprintf(opt->out, "function '%s' not found\n", opt->dumpFunc);
+    return 1;
+  }
+  if (!in->numEdits) {
+    for (ast_node_p f = n->root.node; f; f = f->next) {
+      if (f->type == AST_DECL_FUNC &&
+          (opt->transforms || !dump || f == dump)) {
+        pParseBody(ctx, f);
+      }
+    }
+    // a tree put together around syntax errors is not worth checking
+    if (!dErrors(ctx)) {
+      sCheck(ctx, n);
+    }
   }
 
-  if (!lInit(args[1])) {
+  if (dErrors(ctx) || (opt->pchWrite &&
+                       !phWrite(ctx, n, opt->pchWrite))) {
+    dEmit(ctx);
     return 1;
   }
+  if (opt->pchWrite) {
+    return 0;
+  }
+
+  // counters are numbered on the checked tree before anything reshapes it
+  if (opt->profileGenerate) {
+    oProfileGenerate(n, opt);
+  }
 
-  ast_node_p n = pParse();
-  if (!n) {
+  if (opt->profileUse && !oProfileUse(n, opt)) {
     return 1;
   }
 
-  sCheck(n);
+  // functions unchanged since an earlier compile skip the passes
+  splice_t *splice = in->numEdits ? NULL : spBegin(n, opt);
+
+  // first so the constants are visible to every pass below
+  if (opt->constProp) {
+    oConstProp(n, opt);
+  }
 
-  aDump(n);
+  // before inlining turns the calls it could fold into statements
+  if (opt->constEval) {
+    oConstEval(n, opt);
+  }
+
+  if (opt->tailCalls) {
+    oTailCall(n, opt);
+  }
+
+  if (opt->inlineFuncs) {
+    oInline(n, opt);
+  }
+
+  // short loops are unrolled completely first, the longer ones are widened
+  // by the vectorizer before what it leaves is partially unrolled
+  if (opt->unroll) {
+    oUnroll(n, opt, !opt->vectorize);
+  }
+
+  if (opt->vectorize) {
+    oVectorize(n, opt);
+  }
+
+  if (opt->unroll && opt->vectorize) {
+    oUnroll(n, opt, true);
+  }
+
+  if (opt->ifConvert) {
+    oIfConvert(n, opt);
+  }
+
+  if (opt->switches) {
+    oSwitch(n, opt);
+  }
+
+  if (opt->order) {
+    oOrder(n, opt);
+  }
+
+  if (opt->promote) {
+    oPromote(n, opt);
+  }
+
+  // last so it cleans up after the passes above
+  if (opt->peephole) {
+    oPeephole(n, opt);
+  }
+
+  // after constant folding so folded indices land in the displacement
+  if (opt->addrModes) {
+    oAddrMode(n, opt);
+  }
+
+  if (splice) {
+    spEnd(splice, opt->out);
+  }
+  else if (dump) {
+    ast_node_p next = dump->next;
+    dump->next = NULL;
+    aDump(dump, opt->out);
+    dump->next = next;
+  }
+  else {
+    aDump(n, opt->out);
+  }
 
   return 0;
 }
+
+static bool includes(const char *text, size_t size) {
+  // whether the text may include a header, whose text is not in the key
+  const char *end = text + size;
+  for (const char *p = text; (p = memchr(p, '#', (size_t)(end - p))); ++p) {
+    const char *word = p + 1;
+    for (; word < end && (*word == ' ' || *word == '\t'); ++word);
+    if (end - word >= 7 && memcmp(word, "include", 7) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int compileInput(compiler_ctx_t *ctx, const input_t *in,
+                        const opt_t *opt) {
+
+  if (!opt->cache || opt->pchWrite) {
+    return opt->stream ? streamFile(ctx, in, opt) : compileFile(ctx, in, opt);
+  }
+
+  // the output is found by the source and the options, and a profile read
+  // by a pass, a hit never gets to the lexer
+  input_t read = *in;
+  char *text = NULL;
+  if (!read.text) {
+    text = lRead(in->file, &read.size);
+    read.text = text;
+  }
+  if (!read.text || includes(read.text, read.size)) {
+    const int result = opt->stream ? streamFile(ctx, &read, opt)
+                                   : compileFile(ctx, &read, opt);
+    free(text);
+    return result;
+  }
+  uint64_t key = caHash(0, &opt->cache->build, sizeof(uint64_t));
+  key = caHash(key, &opt->optionsKey, sizeof(uint64_t));
+  key = caHash(key, read.text, read.size);
+  if (opt->profileUse) {
+    size_t size;
+    char *profile = lRead(opt->profileUse, &size);
+    key = profile ? caHash(key, profile, size) : key;
+    free(profile);
+  }
+  if (opt->pch) {
+    size_t size;
+    char *snapshot = lRead(opt->pch, &size);
+    key = snapshot ? caHash(key, snapshot, size) : key;
+    free(snapshot);
+  }
+
+  size_t size;
+  char *cached = caGet(opt->cache, key, &size);
+  caCount(opt->cache, cached ? 1 : 0, cached ? 0 : 1);
+  if (cached) {
+    fwrite(cached, 1, size, opt->out);
+    free(cached);
+    free(text);
+    return 0;
+  }
+
+  // only a compile that succeeded is kept
+  opt_t into = *opt;
+  char *output = NULL;
+  into.out = open_memstream(&output, &size);
+  assert(into.out);
+  ctx->out = into.out;
+  const int result = opt->stream ? streamFile(ctx, &read, &into)
+                                 : compileFile(ctx, &read, &into);
+  fclose(into.out);
+  ctx->out = opt->out;
+
+  if (!result) {
+    caPut(opt->cache, key, output, size);
+  }
+  fwrite(output, 1, size, opt->out);
+  free(output);
+  free(text);
+  return result;
+}
+
+typedef struct {
+  const char *file;
+  char       *text;         // everything compiling the file printed
+  size_t      size;
+  int         result;
+} build_file_t;
+
+typedef struct {
+  build_file_t    *files;
+  compiler_ctx_t **ctx;     // one for each worker
+  const opt_t     *opt;
+} build_t;
+
+static void buildFile(void *user, uint32_t worker, uint32_t job) {
+
+  build_t *b = user;
+  build_file_t *f = &b->files[job];
+  compiler_ctx_t *ctx = b->ctx[worker];
+
+  // collected so it can be printed in the order the files were given
+  opt_t opt = *b->opt;
+  opt.out = open_memstream(&f->text, &f->size);
+  assert(opt.out);
+
+  input_t in;
+  memset(&in, 0, sizeof(in));
+  in.file = f->file;
+
+  cReset(ctx);
+  ctx->out = opt.out;
+  f->result = compileInput(ctx, &in, &opt);
+  fclose(opt.out);
+}
+
+static int buildFiles(const char **files, uint32_t numFiles, uint32_t threads,
+                      const opt_t *opt) {
+
+  build_t b;
+  b.opt   = opt;
+  b.files = calloc(numFiles, sizeof(build_file_t));
+  b.ctx   = calloc(threads, sizeof(compiler_ctx_t*));
+  uint64_t *cost = calloc(numFiles, sizeof(uint64_t));
+  assert(b.files && b.ctx && cost);
+
+  // the size of a file is a fair guess at how long it takes
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    struct stat st;
+    b.files[i].file = files[i];
+    cost[i] = stat(files[i], &st) == 0 ? (uint64_t)st.st_size : 0;
+  }
+  for (uint32_t i = 0; i < threads; ++i) {
+    b.ctx[i] = cNew();
+  }
+
+  jobs_t *jobs = jStart(numFiles, cost, threads, buildFile, &b);
+
+  int result = 0;
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    jWait(jobs, i);
+    fprintf(opt->out, "==> %s <==\n", files[i]);
+    fwrite(b.files[i].text, 1, b.files[i].size, opt->out);
+    fflush(opt->out);
+    result |= b.files[i].result;
+    free(b.files[i].text);
+  }
+
+  const uint32_t stolen = jFinish(jobs);
+  if (opt->stats) {
+    fprintf(opt->out, "jobs: %u files on %u threads, %u stolen\n",
+      numFiles, threads, stolen);
+  }
+
+  for (uint32_t i = 0; i < threads; ++i) {
+    cFree(b.ctx[i]);
+  }
+  free(b.ctx);
+  free(b.files);
+  free(cost);
+  return result;
+}
+
+static bool parseArgs(driver_t *d, int argc, char **args, FILE *out) {
+
+  memset(d, 0, sizeof(driver_t));
+  d->opt.unrollFactor  = 4;
+  d->opt.unrollBudget  = 128;
+  d->opt.inlineSize    = 32;
+  d->opt.inlineBudget  = 256;
+  d->opt.ifConvertCost = 8;
+  d->opt.out           = out;
+  d->files = calloc(argc + 1, sizeof(char*));
+  assert(d->files);
+
+  for (int i = 0; i < argc; ++i) {
+    const char *a = args[i];
+    if (a[0] != '-') {
+      d->files[d->numFiles++] = a;
+      continue;
+    }
+    // everything but how and where the driver runs is part of a cache key
+    if (strncmp(a, "-j", 2) != 0 && strncmp(a, "--cache", 7) != 0 &&
+        strncmp(a, "--server", 8) != 0 && strncmp(a, "--run-tests", 11) != 0) {
+      d->opt.optionsKey = caHash(d->opt.optionsKey, a, strlen(a) + 1);
+    }
+    // anything that transforms the tree needs every body
+    if ((strncmp(a, "-f", 2) == 0 && strcmp(a, "-fstats") != 0) ||
+        strncmp(a, "--profile-", 10) == 0) {
+      d->opt.transforms = true;
+    }
+    if (strcmp(a, "--lazy") == 0) {
+      d->opt.lazy = true;
+      continue;
+    }
+    if (strncmp(a, "--dump-func=", 12) == 0) {
+      d->opt.dumpFunc = a + 12;
+      continue;
+    }
+    if (strcmp(a, "-j") == 0 && i + 1 < argc) {
+      d->threads = (uint32_t)strtoul(args[++i], NULL, 10);
+      continue;
+    }
+    if (strncmp(a, "-j", 2) == 0 && a[2] >= '0' && a[2] <= '9') {
+      d->threads = (uint32_t)strtoul(a + 2, NULL, 10);
+      continue;
+    }
+    if (strncmp(a, "--cache=", 8) == 0) {
+      d->cacheDir = a + 8;
+      continue;
+    }
+    if (parseUint(a, "--cache-size=", &d->cacheSize)) {
+      continue;
+    }
+    if (strcmp(a, "--cache-stats") == 0) {
+      d->cacheStats = true;
+      continue;
+    }
+    if (strcmp(a, "--run-tests") == 0) {
+      d->tests = "tests";
+      continue;
+    }
+    if (strncmp(a, "--run-tests=", 12) == 0) {
+      d->tests = a + 12;
+      continue;
+    }
+    if (strcmp(a, "--server") == 0) {
+      d->server = "-";
+      continue;
+    }
+    if (strncmp(a, "--server=", 9) == 0) {
+      d->server = a + 9;
+      continue;
+    }
+    if (strncmp(a, "--pch=", 6) == 0) {
+      d->opt.pch = a + 6;
+      continue;
+    }
+    if (strncmp(a, "--pch-write=", 12) == 0) {
+      d->opt.pchWrite = a + 12;
+      continue;
+    }
+    if (strcmp(a, "--stream") == 0) {
+      d->opt.stream = true;
+      continue;
+    }
+    if (strncmp(a, "--edit=", 7) == 0) {
+      if (d->numEdits >= MAX_EDITS ||
+          !parseEdit(a + 7, &d->edits[d->numEdits++])) {
+        fprintf(out, "bad edit '%s'\n", a);
+        return false;
+      }
+      continue;
+    }
+    if (strcmp(a, "-funroll") == 0) {
+      d->opt.unroll = true;
+      continue;
+    }
+    if (strcmp(a, "-finline") == 0) {
+      d->opt.inlineFuncs = true;
+      continue;
+    }
+    if (strcmp(a, "-ftail-calls") == 0) {
+      d->opt.tailCalls = true;
+      continue;
+    }
+    if (strcmp(a, "-fpromote") == 0) {
+      d->opt.promote = true;
+      continue;
+    }
+    if (strcmp(a, "--profile-generate") == 0) {
+      d->opt.profileGenerate = true;
+      continue;
+    }
+    if (strncmp(a, "--profile-use=", 14) == 0) {
+      d->opt.profileUse = a + 14;
+      continue;
+    }
+    if (strcmp(a, "-fif-convert") == 0) {
+      d->opt.ifConvert = true;
+      continue;
+    }
+    if (strcmp(a, "-forder") == 0) {
+      d->opt.order = true;
+      continue;
+    }
+    if (strncmp(a, "-fexport=", 9) == 0) {
+      d->opt.exports = a + 9;
+      continue;
+    }
+    if (strcmp(a, "-fswitch") == 0) {
+      d->opt.switches = true;
+      continue;
+    }
+    if (strcmp(a, "-fpeephole") == 0) {
+      d->opt.peephole = true;
+      continue;
+    }
+    if (strcmp(a, "-faddr-modes") == 0) {
+      d->opt.addrModes = true;
+      continue;
+    }
+    if (strcmp(a, "-fconst-prop") == 0) {
+      d->opt.constProp = true;
+      continue;
+    }
+    if (strcmp(a, "-fvectorize") == 0) {
+      d->opt.vectorize = true;
+      continue;
+    }
+    if (strcmp(a, "-fconst-eval") == 0) {
+      d->opt.constEval = true;
+      continue;
+    }
+    if (strcmp(a, "-fstats") == 0) {
+      d->opt.stats = true;
+      continue;
+    }
+    if (parseUint(a, "-funroll-factor=",   &d->opt.unrollFactor) ||
+        parseUint(a, "-funroll-budget=",   &d->opt.unrollBudget) ||
+        parseUint(a, "-finline-size=",     &d->opt.inlineSize)   ||
+        parseUint(a, "-finline-budget=",   &d->opt.inlineBudget) ||
+        parseUint(a, "-fif-convert-cost=", &d->opt.ifConvertCost)) {
+      continue;
+    }
+    fprintf(out, "unknown option '%s'\n", a);
+    return false;
+  }
+
+
+  if (d->opt.stream &&
+      (d->opt.transforms || d->opt.lazy || d->opt.dumpFunc || d->numEdits)) {
+    fprintf(out, "--stream only checks and dumps the whole file\n");
+    return false;
+  }
+  if (d->numEdits && (d->numFiles > 1 || d->threads)) {
+    fprintf(out, "--edit takes a single file\n");
+    return false;
+  }
+  if (d->numEdits && d->opt.pch) {
+    fprintf(out, "--edit does not start from a snapshot\n");
+    return false;
+  }
+  if (d->opt.pchWrite &&
+      (d->numFiles > 1 || d->threads || d->numEdits || d->opt.stream)) {
+    fprintf(out, "--pch-write takes a single file\n");
+    return false;
+  }
+  if (d->cacheStats && !d->cacheDir) {
+    fprintf(out, "--cache-stats needs --cache=<dir>\n");
+    return false;
+  }
+  if (d->cacheDir) {
+    const uint64_t size = (uint64_t)(d->cacheSize ? d->cacheSize : 256) << 20;
+    if (!caOpen(&d->cache, d->cacheDir, size)) {
+      fprintf(out, "Unable to open cache '%s'\n", d->cacheDir);
+      return false;
+    }
+    d->opt.cache = &d->cache;
+  }
+  return true;
+}
+
+static int runDriver(compiler_ctx_t *ctx, const driver_t *d,
+                     const char *text, size_t size) {
+
+  // several files share the process, each is compiled on its own context
+  if (d->numFiles > 1 || d->threads) {
+    return buildFiles(d->files, d->numFiles, d->threads ? d->threads : 1,
+                      &d->opt);
+  }
+
+  input_t in;
+  memset(&in, 0, sizeof(in));
+  in.file     = text ? "<request>" : d->files[0];
+  in.text     = text;
+  in.size     = size;
+  in.edits    = d->edits;
+  in.numEdits = d->numEdits;
+
+  ctx->out = d->opt.out;
+  return compileInput(ctx, &in, &d->opt);
+}
+
+static int runRequest(void *user, int argc, char **args,
+                      const char *text, size_t size, FILE *out) {
+
+  // a request to the server, or one golden test, on a warm context
+  compiler_ctx_t *ctx = user;
+  if (argc == 1 && strcmp(args[0], "--shutdown") == 0) {
+    return -1;
+  }
+
+  driver_t d;
+  if (!parseArgs(&d, argc, args, out)) {
+    free(d.files);
+    return 1;
+  }
+  if (d.server || d.tests || (text && (d.numFiles || d.threads)) ||
+      (!text && !d.numFiles)) {
+    fprintf(out, "a request compiles files or a buffer\n");
+    free(d.files);
+    return 1;
+  }
+
+  cReset(ctx);
+  const int result = runDriver(ctx, &d, text, size);
+  free(d.files);
+  return result;
+}
+
+static int serve(const driver_t *d) {
+  compiler_ctx_t *ctx = cNew();
+  const int result = svServe(d->server, runRequest, ctx);
+  cFree(ctx);
+  return result;
+}
+
+static int runTests(const driver_t *d) {
+
+  // every worker keeps one context for all the tests it runs
+  const uint32_t threads = d->threads ? d->threads : jCores();
+  void **ctx = calloc(threads, sizeof(void*));
+  assert(ctx);
+  for (uint32_t i = 0; i < threads; ++i) {
+    ctx[i] = cNew();
+  }
+  const int result = rtRun(d->tests, threads, runRequest, ctx, stdout);
+  for (uint32_t i = 0; i < threads; ++i) {
+    cFree(ctx[i]);
+  }
+  free(ctx);
+  return result;
+}
+
+int main(int argc, char **args) {
+
+  driver_t d;
+  if (!parseArgs(&d, argc - 1, args + 1, stdout)) {
+    return 1;
+  }
+
+  if (d.server) {
+    return serve(&d);
+  }
+  if (d.tests) {
+    return runTests(&d);
+  }
+
+  if (!d.numFiles && !d.cacheStats) {
+    usage(args[0]);
+    return 0;
+  }
+
+  // one compilation per run, the context goes with the process
+  const int result = d.numFiles ? runDriver(cNew(), &d, NULL, 0) : 0;
+  if (d.cacheStats) {
+    caStats(&d.cache, stdout);
+  }
+  return result;
+}
@@ -0,0 +1,136 @@
+#include "defs.h"
+
+
+// Dead function elimination and call graph driven function ordering.
+//
+// Functions are reachable from the roots: main plus any names given with
+// -fexport=a,b. A file with neither is treated as a library and every
+// function with external linkage is a root. Static functions are only ever
+// reached through calls from this file. Unreachable functions (and their
+// prototypes) are dropped and the rest are laid out in depth first order
+// from the roots so callers sit next to their callees. Functions the
+// profile marked cold go last. Globals and prototypes keep their relative
+// order ahead of the function definitions.
+
+
+typedef struct {
+  cg_t      cg;
+  bool     *reached;
+  uint32_t *order;
+  uint32_t  numOrder;
+} order_t;
+
+static bool orderIsNamed(const token_t *t, const char *name, size_t len) {
+  return (size_t)tSize(t) == len && memcmp(t->start, name, len) == 0;
+}
+
+static bool orderIsExport(const opt_t *opt, const token_t *t) {
+  const char *p = opt->exports;
+  while (p && *p) {
+    const char *end = strchr(p, ',');
+    const size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (orderIsNamed(t, p, len)) {
+      return true;
+    }
+    p = end ? end + 1 : NULL;
+  }
+  return false;
+}
+
+static void orderVisit(order_t *o, uint32_t i) {
+  if (o->reached[i]) {
+    return;
+  }
+  o->reached[i] = true;
+  o->order[o->numOrder++] = i;
+  cg_func_t *f = &o->cg.funcs[i];
+  for (uint32_t j = 0; j < f->numCallees; ++j) {
+    orderVisit(o, f->callees[j]);
+  }
+}
+
+void oOrder(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  order_t o;
+  memset(&o, 0, sizeof(o));
+  cgBuild(n, &o.cg);
+
+  const uint32_t num = o.cg.numFuncs;
+  o.reached = calloc(num + 1, sizeof(bool));
+  o.order   = calloc(num + 1, sizeof(uint32_t));
+  assert(o.reached && o.order);
+
+  // roots
+  bool isLibrary = true;
+  for (uint32_t i = 0; i < num; ++i) {
+    ast_node_p f = o.cg.funcs[i].func;
+    const token_t *t = &f->declFunc.ident;
+    if (orderIsNamed(t, "main", 4) ||
+        (orderIsExport(opt, t) && !aIsStatic(f->declFunc.type))) {
+      isLibrary = false;
+      orderVisit(&o, i);
+    }
+  }
+  if (isLibrary) {
+    for (uint32_t i = 0; i < num; ++i) {
+      if (!aIsStatic(o.cg.funcs[i].func->declFunc.type)) {
+        orderVisit(&o, i);
+      }
+    }
+  }
+
+  // report what goes
+  for (uint32_t i = 0; i < num && opt->stats; ++i) {
+    ast_node_p f = o.cg.funcs[i].func;
+    if (!o.reached[i] && f->declFunc.body) {
+      const uint32_t size = 1 + aNodeCount(f->declFunc.type) +
+                                aNodeCount(f->declFunc.args) +
+                                aNodeCount(f->declFunc.body);
+      fprintf(opt->out, "order: removed %.*s, %u nodes\n",
+        tSize(&f->declFunc.ident), f->declFunc.ident.start, size);
+    }
+  }
+
+  // everything other than a definition keeps its place up front
+  ast_node_p out  = NULL;
+  ast_node_p next = NULL;
+  for (ast_node_p d = n->root.node; d; d = next) {
+    next = d->next;
+    if (d->type == AST_DECL_FUNC) {
+      cg_func_t *f = cgFind(&o.cg, d);
+      if (d->declFunc.body || !o.reached[f - o.cg.funcs]) {
+        continue;
+      }
+    }
+    out = aNodeInsert(out, d);
+  }
+
+  // definitions, hot before cold
+  for (uint32_t pass = 0; pass < 2; ++pass) {
+    for (uint32_t i = 0; i < o.numOrder; ++i) {
+      ast_node_p f = o.cg.funcs[o.order[i]].func;
+      if (!f->declFunc.body || f->decorate.isCold != (pass == 1)) {
+        continue;
+      }
+      out = aNodeInsert(out, f);
+    }
+  }
+  n->root.node = out;
+
+  if (opt->stats) {
+    fprintf(opt->out, "order:");
+    for (ast_node_p d = out; d; d = d->next) {
+      if (d->type == AST_DECL_FUNC && d->declFunc.body) {
+        fprintf(opt->out, " %.*s",
+          tSize(&d->declFunc.ident), d->declFunc.ident.start);
+      }
+    }
+    fprintf(opt->out, "\n");
+  }
+
+  free(o.reached);
+  free(o.order);
+  cgFree(&o.cg);
+}
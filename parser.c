@@ -7,45 +7,59 @@
   INTO = aNodeInsert(INTO, NODE); \
 }
 
-static ast_node_p pExpr(int minPrec);
-static ast_node_p pStmt(void);
-static ast_node_p pDeclType(void);
-
-static parser_t parser;
-
-static void exprStackPush(ast_node_p n) {
-  static const size_t exprStackSize = sizeof(parser.exprStack) / sizeof(ast_node_p);
-  assert(parser.exprStackHead < exprStackSize);
-  parser.exprStack[ parser.exprStackHead++ ] = n;
+static ast_node_p pExpr(compiler_ctx_t *ctx, int minPrec);
+static ast_node_p pStmt(compiler_ctx_t *ctx);
+static ast_node_p pDeclType(compiler_ctx_t *ctx);
+
+static void exprStackPush(compiler_ctx_t *ctx, ast_node_p n) {
+  static const size_t exprStackSize =
+    sizeof(ctx->parser.exprStack) / sizeof(ast_node_p);
+  assert(ctx->parser.exprStackHead < exprStackSize);
+  ctx->parser.exprStack[ ctx->parser.exprStackHead++ ] = n;
 }
 
-static ast_node_p exprStackPop(void) {
-  assert(parser.exprStackHead > 0);
-  return parser.exprStack[ --parser.exprStackHead ];
+static ast_node_p exprStackPop(compiler_ctx_t *ctx) {
+  assert(ctx->parser.exprStackHead > 0);
+  return ctx->parser.exprStack[ --ctx->parser.exprStackHead ];
 }
 
-static ast_node_p pExprCall(token_t *ident) {
+static ast_node_p pExprCall(compiler_ctx_t *ctx, token_t *ident) {
 
   ast_node_p n = aNodeNew(AST_EXPR_CALL);
   n->exprCall.ident = *ident;
 
-  if (!lFound(TOK_RPAREN, NULL)) {
+  if (!lFound(ctx, TOK_RPAREN, NULL)) {
     do {
 
-      ast_node_p e = pExpr(/*minPrec=*/0);
+      ast_node_p e = pExpr(ctx, /*minPrec=*/0);
       AST_NODE_INSERT(n->exprCall.arg, e);
 
-    } while (lFound(TOK_COMMA, NULL));
-    lExpect(TOK_RPAREN, NULL);
+    } while (lFound(ctx, TOK_COMMA, NULL));
+    lExpect(ctx, TOK_RPAREN, NULL);
   }
 
   return n;
 }
 
-static ast_node_p pExprPrimary(void) {
+static ast_node_p pExprIndex(compiler_ctx_t *ctx, ast_node_p base) {
+
+  token_t t;
+  while (lFound(ctx, TOK_LBRACKET, &t)) {
+    ast_node_p n = aNodeNew(AST_EXPR_INDEX);
+    n->exprIndex.token = t;
+    n->exprIndex.base  = base;
+    n->exprIndex.index = pExpr(ctx, /*minPrec=*/0);
+    lExpect(ctx, TOK_RBRACKET, NULL);
+    base = n;
+  }
+
+  return base;
+}
+
+static ast_node_p pExprPrimary(compiler_ctx_t *ctx) {
 
   token_t p;
-  lPop(&p);
+  lPop(ctx, &p);
 
   // unary operator
   if (tIs(&p, TOK_LOG_NOT) ||
@@ -55,7 +69,7 @@ static ast_node_p pExprPrimary(void) {
       tIs(&p, TOK_MUL)) {
     ast_node_p n = aNodeNew(AST_EXPR_UNARY_OP);
     n->exprUnaryOp.op = p;
-    n->exprUnaryOp.rhs = pExprPrimary();
+    n->exprUnaryOp.rhs = pExprPrimary(ctx);
     return n;
   }
 
@@ -63,31 +77,31 @@ static ast_node_p pExprPrimary(void) {
   if (tIs(&p, TOK_LPAREN)) {
 
     // cast
-    ast_node_p c = pDeclType();
+    ast_node_p c = pDeclType(ctx);
     if (c) {
-      lExpect(TOK_RPAREN, NULL);
+      lExpect(ctx, TOK_RPAREN, NULL);
       ast_node_p cast = aNodeNew(AST_EXPR_CAST);
       cast->exprCast.type = c;
-      cast->exprCast.expr = pExprPrimary();
+      cast->exprCast.expr = pExprPrimary(ctx);
       return cast;
     }
 
     // parenthesized expression
-    ast_node_p n = pExpr(/*minPrec=*/0);
-    lExpect(TOK_RPAREN, NULL);
-    return n;
+    ast_node_p n = pExpr(ctx, /*minPrec=*/0);
+    lExpect(ctx, TOK_RPAREN, NULL);
+    return pExprIndex(ctx, n);
   }
 
   // identifier
   if (tIs(&p, TOK_IDENT)) {
 
-    if (lFound(TOK_LPAREN, NULL)) {
-      return pExprCall(&p);
+    if (lFound(ctx, TOK_LPAREN, NULL)) {
+      return pExprIndex(ctx, pExprCall(ctx, &p));
     }
 
     ast_node_p n = aNodeNew(AST_EXPR_IDENT);
     n->exprIdent.ident = p;
-    return n;
+    return pExprIndex(ctx, n);
   }
 
   // integer literal
@@ -97,7 +111,7 @@ static ast_node_p pExprPrimary(void) {
     return n;
   }
 
-  ERROR("Primary expression expected");
+  lFail(ctx, DIAG_EXPECTED_PRIMARY, 0);
   return NULL;
 }
 
@@ -110,16 +124,16 @@ static bool pCheckPrec(token_t *t, int minPrec) {
   }
 }
 
-static ast_node_p pExpr(int minPrec) {
+static ast_node_p pExpr(compiler_ctx_t *ctx, int minPrec) {
 
   // lhs
-  exprStackPush(pExprPrimary());
+  exprStackPush(ctx, pExprPrimary(ctx));
 
   for (;;) {
 
     // look for an operator
     token_t op;
-    lPeek(&op);
+    lPeek(ctx, &op);
     if (!tIsOperator(&op)) {
       break;
     }
@@ -130,329 +144,496 @@ static ast_node_p pExpr(int minPrec) {
     }
 
     // pop the operator
-    lPop(&op);
+    lPop(ctx, &op);
 
     // rhs
-    ast_node_p rhs = pExpr(tPrec(&op));
-    ast_node_p lhs = exprStackPop();    
+    ast_node_p rhs = pExpr(ctx, tPrec(&op));
+    ast_node_p lhs = exprStackPop(ctx);    
 
     ast_node_p bin_op = aNodeNew(AST_EXPR_BIN_OP);
     bin_op->exprBinOp.op  = op;
     bin_op->exprBinOp.lhs = lhs;
     bin_op->exprBinOp.rhs = rhs;
-    exprStackPush(bin_op);
+    exprStackPush(ctx, bin_op);
   }
 
-  return exprStackPop();
+  return exprStackPop(ctx);
 }
 
-static ast_node_p pStmtIf(void) {
+static ast_node_p pStmtIf(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_IF);
-  lPop(&n->stmtIf.token);
+  lPop(ctx, &n->stmtIf.token);
 
   // condition
-  lExpect(TOK_LPAREN, NULL);
-  n->stmtIf.expr = pExpr(/*minPrec=*/0);
-  lExpect(TOK_RPAREN, NULL);
+  lExpect(ctx, TOK_LPAREN, NULL);
+  n->stmtIf.expr = pExpr(ctx, /*minPrec=*/0);
+  lExpect(ctx, TOK_RPAREN, NULL);
 
   // is true branch
-  n->stmtIf.isTrue = pStmt();
+  n->stmtIf.isTrue = pStmt(ctx);
 
   // if false branch
-  if (lFound(TOK_ELSE, NULL)) {
-    n->stmtIf.isFalse = pStmt();
+  if (lFound(ctx, TOK_ELSE, NULL)) {
+    n->stmtIf.isFalse = pStmt(ctx);
   }
 
   return n;
 }
 
-static ast_node_p pStmtWhile(void) {
+static ast_node_p pStmtWhile(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_WHILE);
-  lPop(&n->stmtWhile.token);
+  lPop(ctx, &n->stmtWhile.token);
 
   // condition
-  lExpect(TOK_LPAREN, NULL);
-  n->stmtWhile.expr = pExpr(/*minPrec=*/0);
-  lExpect(TOK_RPAREN, NULL);
+  lExpect(ctx, TOK_LPAREN, NULL);
+  n->stmtWhile.expr = pExpr(ctx, /*minPrec=*/0);
+  lExpect(ctx, TOK_RPAREN, NULL);
   
   // statement
-  n->stmtWhile.body = pStmt();
+  n->stmtWhile.body = pStmt(ctx);
 
   return n;
 }
 
-static ast_node_p pStmtReturn(void) {
+static ast_node_p pStmtReturn(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_RETURN);
-  lPop(&n->stmtReturn.token);
+  lPop(ctx, &n->stmtReturn.token);
 
-  if (lFound(TOK_SEMICOLON, NULL)) {
+  if (lFound(ctx, TOK_SEMICOLON, NULL)) {
     return n;
   }
 
-  ast_node_p e = pExpr(/*minPrec=*/0);
+  ast_node_p e = pExpr(ctx, /*minPrec=*/0);
   AST_NODE_INSERT(n->stmtReturn.expr, e);
 
-  lExpect(TOK_SEMICOLON, NULL);
+  lExpect(ctx, TOK_SEMICOLON, NULL);
   return n;
 }
 
-static ast_node_p pStmtBreak(void) {
+static ast_node_p pStmtBreak(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_BREAK);
-  lPop(&n->stmtBreak.token);
+  lPop(ctx, &n->stmtBreak.token);
 
-  lExpect(TOK_SEMICOLON, NULL);
+  lExpect(ctx, TOK_SEMICOLON, NULL);
   return n;
 }
 
-static ast_node_p pStmtContinue(void) {
+static ast_node_p pStmtContinue(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_CONTINUE);
-  lPop(&n->stmtContinue.token);
+  lPop(ctx, &n->stmtContinue.token);
 
-  lExpect(TOK_SEMICOLON, NULL);
+  lExpect(ctx, TOK_SEMICOLON, NULL);
   return n;
 }
 
-static ast_node_p pStmtLocalDecl(void) {
+static void pDeclArray(compiler_ctx_t *ctx, ast_node_p n) {
+  // optional array length
+  if (lFound(ctx, TOK_LBRACKET, NULL)) {
+    n->declVar.size = pExpr(ctx, /*minPrec=*/0);
+    lExpect(ctx, TOK_RBRACKET, NULL);
+  }
+}
+
+static ast_node_p pStmtLocalDecl(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_DECL_VAR);
 
-  n->declVar.type = pDeclType();
+  n->declVar.type = pDeclType(ctx);
   if (!n->declVar.type) {
-    ERROR("Type expected");
+    lFail(ctx, DIAG_EXPECTED_TYPE, 0);
   }
 
-  lExpect(TOK_IDENT, &n->declVar.ident);
+  lExpect(ctx, TOK_IDENT, &n->declVar.ident);
+  pDeclArray(ctx, n);
 
-  if (lFound(TOK_ASSIGN, NULL)) {
-    AST_NODE_INSERT(n->declVar.expr, pExpr(/*minPrec=*/0));
+  if (lFound(ctx, TOK_ASSIGN, NULL)) {
+    AST_NODE_INSERT(n->declVar.expr, pExpr(ctx, /*minPrec=*/0));
   }
 
-  lExpect(TOK_SEMICOLON, NULL);
+  lExpect(ctx, TOK_SEMICOLON, NULL);
   return n;
 }
 
-static ast_node_p pStmtCompound(void) {
-
-  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+static void pSync(compiler_ctx_t *ctx, bool topLevel) {
+  // skip the rest of a broken statement or declaration, up to and including
+  // its ';' or the '}' closing a block it opened
+  uint32_t depth = 0;
+  for (;;) {
+    token_t t;
+    lPeek(ctx, &t);
+    if (tIs(&t, TOK_EOF) || (tIs(&t, TOK_RBRACE) && !depth && !topLevel)) {
+      return;
+    }
+    lPop(ctx, &t);
+    if (tIs(&t, TOK_LBRACE)) {
+      ++depth;
+    }
+    if (tIs(&t, TOK_RBRACE) && depth && --depth == 0) {
+      return;
+    }
+    if (tIs(&t, TOK_SEMICOLON) && !depth) {
+      return;
+    }
+  }
+}
 
-  while (!lFound(TOK_RBRACE, NULL)) {
-    ast_node_p n = pStmt();
-    AST_NODE_INSERT(c->stmtCompound.stmt, n);
+static void pBlock(compiler_ctx_t *ctx, ast_node_p *into) {
+  // statements up to the closing '}', a broken one is reported and skipped
+  while (!lFound(ctx, TOK_RBRACE, NULL)) {
+    const size_t head = ctx->parser.exprStackHead;
+    jmp_buf env;
+    jmp_buf *outer = dTrap(ctx, &env);
+    if (!setjmp(env)) {
+      ast_node_p n = pStmt(ctx);
+      dTrap(ctx, outer);
+      AST_NODE_INSERT(*into, n);
+      continue;
+    }
+    dTrap(ctx, outer);
+    ctx->parser.exprStackHead = head;
+    pSync(ctx, /*topLevel=*/false);
+    // without a '}' the enclosing declaration is broken too
+    if (lFound(ctx, TOK_EOF, NULL)) {
+      dAbort(ctx);
+    }
   }
+}
 
+static ast_node_p pStmtCompound(compiler_ctx_t *ctx) {
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  pBlock(ctx, &c->stmtCompound.stmt);
   return c;
 }
 
-static ast_node_p pStmtDo(void) {
+static ast_node_p pStmtDo(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_DO);
-  lPop(&n->stmtDo.token);
+  lPop(ctx, &n->stmtDo.token);
 
-  AST_NODE_INSERT(n->stmtDo.body, pStmt());
+  AST_NODE_INSERT(n->stmtDo.body, pStmt(ctx));
 
-  lExpect(TOK_WHILE, NULL);
-  lExpect(TOK_LPAREN, NULL);
-  AST_NODE_INSERT(n->stmtDo.expr, pExpr(/*minPrec=*/0));
-  lExpect(TOK_RPAREN, NULL);
-  lExpect(TOK_SEMICOLON, NULL);
+  lExpect(ctx, TOK_WHILE, NULL);
+  lExpect(ctx, TOK_LPAREN, NULL);
+  AST_NODE_INSERT(n->stmtDo.expr, pExpr(ctx, /*minPrec=*/0));
+  lExpect(ctx, TOK_RPAREN, NULL);
+  lExpect(ctx, TOK_SEMICOLON, NULL);
 
   return n;
 }
 
-static ast_node_p pStmtFor(void) {
+static ast_node_p pStmtFor(compiler_ctx_t *ctx) {
 
   ast_node_p n = aNodeNew(AST_STMT_FOR);
-  lPop(&n->stmtFor.token);
+  lPop(ctx, &n->stmtFor.token);
+
+  lExpect(ctx, TOK_LPAREN, NULL);
+  AST_NODE_INSERT(n->stmtFor.init, pExpr(ctx, /*minPrec=*/0));
+  lExpect(ctx, TOK_SEMICOLON, NULL);
+  AST_NODE_INSERT(n->stmtFor.cond, pExpr(ctx, /*minPrec=*/0));
+  lExpect(ctx, TOK_SEMICOLON, NULL);
+  AST_NODE_INSERT(n->stmtFor.update, pExpr(ctx, /*minPrec=*/0));
+  lExpect(ctx, TOK_RPAREN, NULL);
+
+  AST_NODE_INSERT(n->stmtFor.body, pStmt(ctx));
+
+  return n;
+}
+
+static ast_node_p pStmtSwitch(compiler_ctx_t *ctx) {
 
-  lExpect(TOK_LPAREN, NULL);
-  AST_NODE_INSERT(n->stmtFor.init, pExpr(/*minPrec=*/0));
-  lExpect(TOK_SEMICOLON, NULL);
-  AST_NODE_INSERT(n->stmtFor.cond, pExpr(/*minPrec=*/0));
-  lExpect(TOK_SEMICOLON, NULL);
-  AST_NODE_INSERT(n->stmtFor.update, pExpr(/*minPrec=*/0));
-  lExpect(TOK_RPAREN, NULL);
+  ast_node_p n = aNodeNew(AST_STMT_SWITCH);
+  lPop(ctx, &n->stmtSwitch.token);
 
-  AST_NODE_INSERT(n->stmtFor.body, pStmt());
+  // controlling expression
+  lExpect(ctx, TOK_LPAREN, NULL);
+  n->stmtSwitch.expr = pExpr(ctx, /*minPrec=*/0);
+  lExpect(ctx, TOK_RPAREN, NULL);
+
+  // statement
+  n->stmtSwitch.body = pStmt(ctx);
 
   return n;
 }
 
-static ast_node_p pStmt(void) {
+static ast_node_p pStmtCase(compiler_ctx_t *ctx) {
+
+  ast_node_p n = aNodeNew(AST_STMT_CASE);
+  lPop(ctx, &n->stmtCase.token);
+
+  n->stmtCase.expr = pExpr(ctx, /*minPrec=*/0);
+
+  lExpect(ctx, TOK_COLON, NULL);
+  return n;
+}
+
+static ast_node_p pStmtDefault(compiler_ctx_t *ctx) {
+
+  ast_node_p n = aNodeNew(AST_STMT_DEFAULT);
+  lPop(ctx, &n->stmtDefault.token);
+
+  lExpect(ctx, TOK_COLON, NULL);
+  return n;
+}
+
+static ast_node_p pStmt(compiler_ctx_t *ctx) {
 
   token_t la;
-  lPeek(&la);
+  lPeek(ctx, &la);
 
   // local decl
   if (tIsType(&la)) {
-    return pStmtLocalDecl();
+    return pStmtLocalDecl(ctx);
   }
 
   // if conditional
   if (tIs(&la, TOK_IF)) {
-    return pStmtIf();
+    return pStmtIf(ctx);
   }
 
   // while loop
   if (tIs(&la, TOK_WHILE)) {
-    return pStmtWhile();
+    return pStmtWhile(ctx);
   }
 
   // do loop
   if (tIs(&la, TOK_DO)) {
-    return pStmtDo();
+    return pStmtDo(ctx);
   }
 
   // for loop
   if (tIs(&la, TOK_FOR)) {
-    return pStmtFor();
+    return pStmtFor(ctx);
+  }
+
+  // switch statement
+  if (tIs(&la, TOK_SWITCH)) {
+    return pStmtSwitch(ctx);
+  }
+
+  // case label
+  if (tIs(&la, TOK_CASE)) {
+    return pStmtCase(ctx);
+  }
+
+  // default label
+  if (tIs(&la, TOK_DEFAULT)) {
+    return pStmtDefault(ctx);
   }
 
   // break statement
   if (tIs(&la, TOK_BREAK)) {
-    return pStmtBreak();
+    return pStmtBreak(ctx);
   }
 
   // continue statement
   if (tIs(&la, TOK_CONTINUE)) {
-    return pStmtContinue();
+    return pStmtContinue(ctx);
   }
 
   // return statement
   if (tIs(&la, TOK_RETURN)) {
-    return pStmtReturn();
+    return pStmtReturn(ctx);
   }
 
   // empty statement
   if (tIs(&la, TOK_SEMICOLON)) {
-    lPop(&la);
+    lPop(ctx, &la);
     return aNodeNew(AST_STMT_COMPOUND);
   }
 
   // compound statements
   if (tIs(&la, TOK_LBRACE)) {
-    lPop(&la);
-    return pStmtCompound();
+    lPop(ctx, &la);
+    return pStmtCompound(ctx);
   }
 
   // fallback to trying to parse an expression
-  ast_node_p expr = pExpr(/*minPrec=*/0);
+  ast_node_p expr = pExpr(ctx, /*minPrec=*/0);
   ast_node_p stmtExpr = aNodeNew(AST_STMT_EXPR);
   AST_NODE_INSERT(stmtExpr->stmtExpr.expr, stmtExpr);
-  lExpect(TOK_SEMICOLON, NULL);
+  lExpect(ctx, TOK_SEMICOLON, NULL);
 
   return expr;
 }
 
-static void pFunc(ast_node_t *decl) {
+static void pSkipBody(compiler_ctx_t *ctx) {
+  // brace matching on the token stream up to the closing '}'
+  uint32_t depth = 1;
+  while (depth) {
+    token_t t;
+    lPop(ctx, &t);
+    switch (t.type) {
+    case TOK_LBRACE: ++depth; break;
+    case TOK_RBRACE: --depth; break;
+    case TOK_EOF:    lFail(ctx, DIAG_EXPECTED_TOKEN, TOK_RBRACE);
+    default:         break;
+    }
+  }
+}
+
+void pParseBody(compiler_ctx_t *ctx, ast_node_p f) {
+
+  assert(f->type == AST_DECL_FUNC);
+  if (!f->declFunc.isLazy) {
+    return;
+  }
+
+  // parse from where the body was skipped, then carry on from here
+  lex_t save;
+  lSave(ctx, &save);
+  lRestore(ctx, &f->declFunc.bodyLex);
+
+  jmp_buf env;
+  jmp_buf *outer = dTrap(ctx, &env);
+  if (!setjmp(env)) {
+    pBlock(ctx, &f->declFunc.body);
+  }
+  dTrap(ctx, outer);
+  f->declFunc.isLazy = false;
+
+  lRestore(ctx, &save);
+}
+
+static void pFunc(compiler_ctx_t *ctx, ast_node_t *decl) {
 
   // parse arguments
-  if (!lFound(TOK_RPAREN, NULL)) {
+  if (!lFound(ctx, TOK_RPAREN, NULL)) {
       do {
 
         ast_node_p arg = aNodeNew(AST_DECL_VAR);
         AST_NODE_INSERT(decl->declFunc.args, arg);
 
         // argument type
-        ast_node_p type = pDeclType();
+        ast_node_p type = pDeclType(ctx);
         if (!type) {
-          ERROR("Type expected");
+          lFail(ctx, DIAG_EXPECTED_TYPE, 0);
         }
         arg->declVar.type = type;
 
         // argument name is optional
         token_t ident;
-        if (lFound(TOK_IDENT, &ident)) {
+        if (lFound(ctx, TOK_IDENT, &ident)) {
           arg->declVar.ident = ident;
         }
 
-      } while (lFound(TOK_COMMA, NULL));
-    lExpect(TOK_RPAREN, NULL);
+      } while (lFound(ctx, TOK_COMMA, NULL));
+    lExpect(ctx, TOK_RPAREN, NULL);
   }
 
-  if (lFound(TOK_LBRACE, NULL)) {
-    // parse function body
-    while (!lFound(TOK_RBRACE, NULL)) {
-        ast_node_p stmt = pStmt();
-        AST_NODE_INSERT(decl->declFunc.body, stmt);
+  if (lFound(ctx, TOK_LBRACE, NULL)) {
+    if (ctx->parser.lazy) {
+      // only note where the body is, it is parsed when asked for
+      lSave(ctx, &decl->declFunc.bodyLex);
+      decl->declFunc.isLazy = true;
+      pSkipBody(ctx);
+      return;
     }
+    // parse function body
+    pBlock(ctx, &decl->declFunc.body);
   }
   else {
     // function decl
-    lExpect(TOK_SEMICOLON, NULL);
+    lExpect(ctx, TOK_SEMICOLON, NULL);
   }
 }
 
-ast_node_p pDeclType(void) {
+ast_node_p pDeclType(compiler_ctx_t *ctx) {
 
   token_t t;
-  lPeek(&t);
+  lPeek(ctx, &t);
 
   ast_node_p out = NULL;
 
   // parse types
   while (tIsType(&t)) {
-    lPop(&t);
+    lPop(ctx, &t);
     ast_node_p n = aNodeNew(AST_DECL_TYPE);
     n->declType.token = t;
     out = aNodeInsert(out, n);
-    lPeek(&t);
+    lPeek(ctx, &t);
   }
 
-  // parse any indirection
+  // parse any indirection, each level may be const itself
   if (out) {
-    while (tIs(&t, TOK_MUL)) {
-      lPop(&t);
+    while (tIs(&t, TOK_MUL) || tIs(&t, TOK_CONST)) {
+      lPop(ctx, &t);
       ast_node_p n = aNodeNew(AST_DECL_TYPE);
       n->declType.token = t;
       out = aNodeInsert(out, n);
-      lPeek(&t);
+      lPeek(ctx, &t);
     }
   }
 
   return out;
 }
 
-ast_node_p pParse(void) {
+static ast_node_p pDecl(compiler_ctx_t *ctx) {
 
-  ast_node_p r = aNodeNew(AST_ROOT);
-  parser.astRoot = r;
+  ast_node_p type = pDeclType(ctx);
 
-  token_t token;
-  while (!lFound(TOK_EOF, &token)) {
+  token_t ident;
+  lExpect(ctx, TOK_IDENT, &ident);
 
-    ast_node_p type = pDeclType();
+  // function declaration
+  if (lFound(ctx, TOK_LPAREN, NULL)) {
 
-    token_t ident;
-    lExpect(TOK_IDENT, &ident);
+    ast_node_p f = aNodeNew(AST_DECL_FUNC);
+    f->declFunc.type = type;
+    f->declFunc.ident = ident;
 
-    // function declaration
-    if (lFound(TOK_LPAREN, NULL)) {
+    pFunc(ctx, f);
+    return f;
+  }
 
-      ast_node_p f = aNodeNew(AST_DECL_FUNC);
-      AST_NODE_INSERT(r->root.node, f);
-      f->declFunc.type = type;
-      f->declFunc.ident = ident;
+  ast_node_p v = aNodeNew(AST_DECL_VAR);
+  v->declVar.type = type;
+  v->declVar.ident = ident;
+  pDeclArray(ctx, v);
 
-      pFunc(f);
-      continue;
-    }
+  // global decl with initializer
+  if (lFound(ctx, TOK_ASSIGN, NULL)) {
+    v->declVar.expr = pExpr(ctx, /*minPrec*/0);
+  }
+
+  lExpect(ctx, TOK_SEMICOLON, NULL);
+  return v;
+}
+
+ast_node_p pParseDecl(compiler_ctx_t *ctx) {
+
+  // NULL if the declaration was broken, parsing carries on after it
+  const size_t head = ctx->parser.exprStackHead;
+  jmp_buf env;
+  jmp_buf *outer = dTrap(ctx, &env);
+  if (setjmp(env)) {
+    dTrap(ctx, outer);
+    ctx->parser.exprStackHead = head;
+    pSync(ctx, /*topLevel=*/true);
+    return NULL;
+  }
+  ast_node_p d = pDecl(ctx);
+  dTrap(ctx, outer);
+  return d;
+}
 
-    ast_node_p v = aNodeNew(AST_DECL_VAR);
-    AST_NODE_INSERT(r->root.node, v);
-    v->declVar.type = type;
-    v->declVar.ident = ident;
+ast_node_p pParse(compiler_ctx_t *ctx, bool lazy) {
 
-    // global decl with initializer
-    if (lFound(TOK_ASSIGN, NULL)) {
-      v->declVar.expr = pExpr(/*minPrec*/0);
+  ast_node_p r = aNodeNew(AST_ROOT);
+  ctx->parser.astRoot = r;
+  ctx->parser.lazy = lazy;
+
+  token_t token;
+  while (!lFound(ctx, TOK_EOF, &token)) {
+    ast_node_p d = pParseDecl(ctx);
+    if (d) {
+      AST_NODE_INSERT(r->root.node, d);
     }
-    
-    lExpect(TOK_SEMICOLON, NULL);
   }
 
   return r;
@@ -0,0 +1,635 @@
+#include "defs.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Precompiled headers.
+//
+// A file of prototypes and globals, once parsed and checked, is written out
+// as a snapshot of its declarations. A later compile maps the snapshot and
+// starts with its declarations in the tree and in the symbol table, instead
+// of lexing, parsing and checking them again:
+//
+//   compiler --pch-write=common.pch common.h
+//   compiler --pch=common.pch main.c
+//
+// The snapshot is one block, read in place:
+//
+//   ph_header_t               magic, compiler build and the counts below
+//   ph_source_t[numSources]   every file read to make it, as it was then
+//   ph_node_t  [numNodes]     the declarations, in pre-order
+//   ph_type_t  [numTypes]     the types sema gave them, each stored once
+//   char       [stringsSize]  the spelling of every token, each stored once
+//
+// A node refers to its children and its next sibling by index, and they
+// always come after it. The first node is the first declaration. The
+// tokens of a loaded declaration point into the mapped strings, so a
+// snapshot is mapped once per process and never unmapped, like a header.
+//
+// Only bodyless functions and globals whose value is a constant can be
+// written, their subtrees never refer to another declaration. A snapshot is
+// stale once any of its sources changed or is gone. The sources are entered
+// as if they had been included, an #include of one is then dropped when it
+// has a guard or '#pragma once', and each node keeps the line and the source
+// its token came from.
+
+
+#define PH_MAGIC   0x31484350u    // "PCH1"
+#define PH_VERSION 2
+
+// ph_node_t.flags
+#define PH_ESCAPING 0x01
+
+// ph_type_t.flags
+#define PH_VOID     0x01
+#define PH_CONST    0x02
+#define PH_STATIC   0x04
+#define PH_SIGNED   0x08
+#define PH_RVALUE   0x10
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t build;         // hash of the compiler that wrote it
+  uint32_t numSources;
+  uint32_t numNodes;
+  uint32_t numTypes;
+  uint32_t stringsSize;
+} ph_header_t;
+
+typedef struct {
+  uint64_t size;          // the file when the snapshot was written
+  int64_t  sec;
+  int64_t  nsec;
+  uint32_t path;          // full path in the strings, terminated
+  uint32_t len;
+} ph_source_t;
+
+typedef struct {
+  uint8_t  type;          // ast_node_type_t
+  uint8_t  token;         // token_type_t
+  uint8_t  flags;
+  uint8_t  pad;
+  uint32_t text;          // spelling of the token in the strings
+  uint32_t len;
+  uint32_t line;
+  uint32_t source;        // index + 1 of the file of the line, 0 if it is
+                          // the one compiled
+  uint32_t decorate;      // index + 1 of the type, 0 if it has none
+  uint32_t next;          // index of the sibling, 0 if there is none
+  uint32_t child[AST_MAX_CHILDREN];
+} ph_node_t;
+
+typedef struct {
+  uint32_t count;
+  uint8_t  width;
+  uint8_t  ptrLevel;
+  uint8_t  flags;
+  uint8_t  constDeref;
+} ph_type_t;
+
+typedef struct ph_file_s ph_file_t;
+
+struct ph_file_s {
+  dev_t              dev;
+  ino_t              ino;
+  off_t              size;
+  struct timespec    mtime;
+  const ph_header_t *header;    // NULL if the file is no snapshot
+  const ph_source_t *sources;
+  const ph_node_t   *nodes;
+  const ph_type_t   *types;
+  const char        *strings;
+  ph_file_t         *next;
+};
+
+typedef struct {
+  uint64_t hash;
+  uint32_t value;         // index + 1, 0 for a free slot
+  uint32_t len;
+} ph_slot_t;
+
+typedef struct {
+  ph_source_t *sources;
+  uint32_t   numSources;
+  ph_node_t *nodes;
+  uint32_t   numNodes;
+  uint32_t   maxNodes;
+  ph_type_t *types;
+  uint32_t   numTypes;
+  uint32_t   maxTypes;
+  char      *strings;
+  uint32_t   stringsSize;
+  uint32_t   maxStrings;
+  ph_slot_t *slots;       // strings and types, by hash
+  uint32_t   numSlots;    // a power of two
+  uint32_t   usedSlots;
+} ph_writer_t;
+
+static pthread_mutex_t phFilesLock = PTHREAD_MUTEX_INITIALIZER;
+static ph_file_t *phFiles;
+
+
+//----------------------------------------------------------------------------
+// Writing
+//----------------------------------------------------------------------------
+
+static void phGrow(void **p, uint32_t *max, uint32_t need, size_t size) {
+  if (need <= *max) {
+    return;
+  }
+  while (*max < need) {
+    *max = *max ? *max * 2 : 256;
+  }
+  *p = realloc(*p, *max * size);
+  assert(*p);
+}
+
+static void phRehash(ph_writer_t *w) {
+
+  // twice the slots once half are taken
+  ph_slot_t *old = w->slots;
+  const uint32_t oldSlots = w->numSlots;
+  w->numSlots = oldSlots ? oldSlots * 2 : 1024;
+  w->slots = calloc(w->numSlots, sizeof(ph_slot_t));
+  assert(w->slots);
+  for (uint32_t i = 0; i < oldSlots; ++i) {
+    if (!old[i].value) {
+      continue;
+    }
+    uint32_t at = (uint32_t)old[i].hash & (w->numSlots - 1);
+    for (; w->slots[at].value; at = (at + 1) & (w->numSlots - 1));
+    w->slots[at] = old[i];
+  }
+  free(old);
+}
+
+static ph_slot_t *phFind(ph_writer_t *w, uint64_t hash, bool isType,
+                         const void *data, uint32_t len) {
+
+  // the slot holding data, or the free one it goes into
+  if ((w->usedSlots + 1) * 2 > w->numSlots) {
+    phRehash(w);
+  }
+  uint32_t at = (uint32_t)hash & (w->numSlots - 1);
+  for (;; at = (at + 1) & (w->numSlots - 1)) {
+    ph_slot_t *s = &w->slots[at];
+    if (!s->value) {
+      return s;
+    }
+    if (s->hash != hash || s->len != len) {
+      continue;
+    }
+    const void *held = isType ? (const void*)&w->types[s->value - 1]
+                              : (const void*)(w->strings + s->value - 1);
+    if (memcmp(held, data, len) == 0) {
+      return s;
+    }
+  }
+}
+
+static uint32_t phString(ph_writer_t *w, const char *text, uint32_t len) {
+
+  // offset of text in the strings, terminated so a path can be used as is
+  uint64_t hash = caHash(0, "s", 1);
+  hash = caHash(hash, text, len);
+  ph_slot_t *s = phFind(w, hash, false, text, len);
+  if (!s->value) {
+    phGrow((void**)&w->strings, &w->maxStrings, w->stringsSize + len + 1, 1);
+    memcpy(w->strings + w->stringsSize, text, len);
+    w->strings[w->stringsSize + len] = '\0';
+    s->hash  = hash;
+    s->len   = len;
+    s->value = w->stringsSize + 1;
+    w->stringsSize += len + 1;
+    w->usedSlots++;
+  }
+  return s->value - 1;
+}
+
+static uint32_t phType(ph_writer_t *w, const ast_type_t *t) {
+
+  // index + 1 of t in the types
+  if (!t) {
+    return 0;
+  }
+  ph_type_t p;
+  memset(&p, 0, sizeof(p));
+  p.count      = t->count;
+  p.width      = t->width;
+  p.ptrLevel   = t->ptrLevel;
+  p.constDeref = t->constDeref;
+  p.flags      = (t->isVoid   ? PH_VOID   : 0) |
+                 (t->isConst  ? PH_CONST  : 0) |
+                 (t->isStatic ? PH_STATIC : 0) |
+                 (t->isSigned ? PH_SIGNED : 0) |
+                 (t->isRvalue ? PH_RVALUE : 0);
+
+  uint64_t hash = caHash(0, "t", 1);
+  hash = caHash(hash, &p, sizeof(p));
+  ph_slot_t *s = phFind(w, hash, true, &p, sizeof(p));
+  if (!s->value) {
+    phGrow((void**)&w->types, &w->maxTypes, w->numTypes + 1, sizeof(ph_type_t));
+    w->types[w->numTypes++] = p;
+    s->hash  = hash;
+    s->len   = sizeof(p);
+    s->value = w->numTypes;
+    w->usedSlots++;
+  }
+  return s->value;
+}
+
+static uint32_t phWriteChain(ph_writer_t *w, ast_node_p n);
+
+static uint32_t phWriteNode(ph_writer_t *w, ast_node_p n) {
+
+  // n and everything below it, returns the index of n
+  const uint32_t index = w->numNodes++;
+  phGrow((void**)&w->nodes, &w->maxNodes, w->numNodes, sizeof(ph_node_t));
+  ph_node_t p;
+  memset(&p, 0, sizeof(p));
+  p.type     = (uint8_t)n->type;
+  p.decorate = phType(w, n->decorate.type);
+  if (n->type == AST_DECL_VAR && n->declVar.isEscaping) {
+    p.flags |= PH_ESCAPING;
+  }
+  const token_t *t = aToken(n);
+  if (t) {
+    p.token = (uint8_t)t->type;
+    p.len   = (uint32_t)tSize(t);
+    p.text  = phString(w, t->start ? t->start : "", p.len);
+    p.line  = tLineOf(t->line) & LINE_MASK;
+    // the sources are numbered the way the lexer numbered the files
+    if (t->line & LINE_HEADER) {
+      p.source = (t->line >> LINE_FILE_SHIFT) & LINE_FILE_MAX;
+    }
+  }
+  ast_node_p *slots[AST_MAX_CHILDREN];
+  const uint32_t count = aChildren(n, slots);
+  for (uint32_t i = 0; i < count; ++i) {
+    p.child[i] = phWriteChain(w, *slots[i]);
+  }
+  w->nodes[index] = p;
+  return index;
+}
+
+static uint32_t phWriteChain(ph_writer_t *w, ast_node_p n) {
+  // the index of the first node, its siblings linked after it
+  uint32_t first = 0;
+  uint32_t prev  = 0;
+  for (ast_node_p at = n; at; at = at->next) {
+    const uint32_t index = phWriteNode(w, at);
+    if (at == n) {
+      first = index;
+    }
+    else {
+      w->nodes[prev].next = index;
+    }
+    prev = index;
+  }
+  return first;
+}
+
+static bool phCheckDecls(compiler_ctx_t *ctx, ast_node_p root) {
+
+  // only declarations that never refer to another one can be stored
+  for (ast_node_p d = root->root.node; d; d = d->next) {
+    const bool body = d->type == AST_DECL_FUNC &&
+      (d->declFunc.body || d->declFunc.isLazy || d->declFunc.isDropped);
+    int64_t value;
+    const bool constant = d->type != AST_DECL_VAR || !d->declVar.expr ||
+      aIntLitValue(d->declVar.expr, &value);
+    if (body || !constant) {
+      const token_t *t = aToken(d);
+      dReportText(ctx, DIAG_PCH_DECL, t->line, t->start, tSize(t));
+    }
+  }
+  return !dErrors(ctx);
+}
+
+static bool phWriteSources(compiler_ctx_t *ctx, ph_writer_t *w) {
+
+  // every file entered while reading the declarations, found again by its
+  // full path from any directory
+  w->numSources = ctx->numFiles;
+  w->sources = calloc(w->numSources + 1, sizeof(ph_source_t));
+  assert(w->sources);
+  for (uint32_t i = 0; i < w->numSources; ++i) {
+    const char *name = ctx->files[i + 1].name;
+    char full[PATH_MAX];
+    struct stat st;
+    if (!realpath(name, full) || stat(full, &st) != 0) {
+      dReportText(ctx, DIAG_OPEN_FAILED, 0, name, strlen(name));
+      return false;
+    }
+    ph_source_t *s = &w->sources[i];
+    s->len  = (uint32_t)strlen(full);
+    s->path = phString(w, full, s->len);
+    s->size = (uint64_t)st.st_size;
+    s->sec  = (int64_t)st.st_mtim.tv_sec;
+    s->nsec = (int64_t)st.st_mtim.tv_nsec;
+  }
+  return true;
+}
+
+bool phWrite(compiler_ctx_t *ctx, ast_node_p root, const char *path) {
+
+  assert(root->type == AST_ROOT);
+  if (!phCheckDecls(ctx, root)) {
+    return false;
+  }
+
+  ph_writer_t w;
+  memset(&w, 0, sizeof(w));
+  ph_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.magic   = PH_MAGIC;
+  h.version = PH_VERSION;
+  h.build   = caBuildHash();
+
+  // the first declaration is node 0, nothing refers back to it
+  bool written = phWriteSources(ctx, &w);
+  if (written) {
+    phWriteChain(&w, root->root.node);
+  }
+  h.numSources  = w.numSources;
+  h.numNodes    = w.numNodes;
+  h.numTypes    = w.numTypes;
+  h.stringsSize = w.stringsSize;
+
+  // published whole or not at all, another compile may be reading it
+  const size_t len = strlen(path) + 32;
+  char *temp = malloc(len);
+  assert(temp);
+  snprintf(temp, len, "%s.tmp.%ld", path, (long)getpid());
+  FILE *fd = written ? fopen(temp, "wb") : NULL;
+  written = fd &&
+    fwrite(&h, sizeof(h), 1, fd) == 1 &&
+    fwrite(w.sources, sizeof(ph_source_t), w.numSources, fd) == w.numSources &&
+    fwrite(w.nodes, sizeof(ph_node_t), w.numNodes, fd) == w.numNodes &&
+    fwrite(w.types, sizeof(ph_type_t), w.numTypes, fd) == w.numTypes &&
+    fwrite(w.strings, 1, w.stringsSize, fd) == w.stringsSize;
+  written &= fd && fclose(fd) == 0;
+  if (!written || rename(temp, path) != 0) {
+    unlink(temp);
+    dReportText(ctx, DIAG_OPEN_FAILED, 0, path, strlen(path));
+    written = false;
+  }
+
+  free(temp);
+  free(w.sources);
+  free(w.nodes);
+  free(w.types);
+  free(w.strings);
+  free(w.slots);
+  return written;
+}
+
+
+//----------------------------------------------------------------------------
+// Loading
+//----------------------------------------------------------------------------
+
+static bool phAllowed(uint32_t type) {
+  // what phCheckDecls lets through
+  switch (type) {
+  case AST_DECL_TYPE:
+  case AST_DECL_VAR:
+  case AST_DECL_FUNC:
+  case AST_EXPR_INT_LIT:
+  case AST_EXPR_UNARY_OP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool phRef(uint32_t from, uint32_t to, uint32_t num, uint8_t *seen) {
+  // a reference points ahead, to a node nothing else refers to
+  if (!to) {
+    return true;
+  }
+  if (to <= from || to >= num || seen[to]) {
+    return false;
+  }
+  seen[to] = 1;
+  return true;
+}
+
+static bool phValid(const ph_file_t *f, size_t size) {
+
+  // everything loading follows is inside the file, every node is reached
+  // exactly once, and the tree is one of declarations
+  const ph_header_t *h = f->header;
+  if (size < sizeof(ph_header_t) || h->magic != PH_MAGIC ||
+      h->version != PH_VERSION || h->build != caBuildHash()) {
+    return false;
+  }
+  const uint64_t need = sizeof(ph_header_t) +
+                        (uint64_t)h->numSources * sizeof(ph_source_t) +
+                        (uint64_t)h->numNodes * sizeof(ph_node_t) +
+                        (uint64_t)h->numTypes * sizeof(ph_type_t) +
+                        h->stringsSize;
+  if (need != size || h->numSources > LINE_FILE_MAX) {
+    return false;
+  }
+  for (uint32_t i = 0; i < h->numSources; ++i) {
+    const ph_source_t *s = &f->sources[i];
+    if ((uint64_t)s->path + s->len >= h->stringsSize ||
+        f->strings[s->path + s->len] != '\0') {
+      return false;
+    }
+  }
+
+  uint8_t *seen = calloc(h->numNodes + 1, 1);
+  assert(seen);
+  bool valid = true;
+  for (uint32_t i = 0; i < h->numNodes && valid; ++i) {
+    const ph_node_t *p = &f->nodes[i];
+    ast_node_t n;
+    memset(&n, 0, sizeof(n));
+    n.type = (ast_node_type_t)p->type;
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = phAllowed(p->type) ? aChildren(&n, slots) : 0;
+    valid = phAllowed(p->type) && p->token <= TOK_EOF &&
+            (uint64_t)p->text + p->len <= h->stringsSize &&
+            p->line <= LINE_MASK && p->source <= h->numSources &&
+            p->decorate <= h->numTypes &&
+            phRef(i, p->next, h->numNodes, seen);
+    for (uint32_t c = 0; c < AST_MAX_CHILDREN && valid; ++c) {
+      valid = c < count ? phRef(i, p->child[c], h->numNodes, seen)
+                        : !p->child[c];
+    }
+  }
+  for (uint32_t i = 1; i < h->numNodes && valid; ++i) {
+    valid = seen[i];
+  }
+  // the declarations themselves, functions without a body
+  for (uint32_t i = 0; i < h->numNodes && valid;) {
+    const ph_node_t *p = &f->nodes[i];
+    valid = p->type == AST_DECL_VAR ||
+            (p->type == AST_DECL_FUNC && !p->child[2]);
+    i = p->next ? p->next : h->numNodes;
+  }
+  free(seen);
+  return valid;
+}
+
+static const ph_file_t *phOpen(const char *path) {
+
+  // the mapped snapshot at path, NULL if it can not be read
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&phFilesLock);
+
+  ph_file_t *f = phFiles;
+  for (; f; f = f->next) {
+    if (f->dev == st.st_dev && f->ino == st.st_ino && f->size == st.st_size &&
+        f->mtime.tv_sec == st.st_mtim.tv_sec &&
+        f->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+      break;
+    }
+  }
+
+  // looked over once, an invalid file is remembered as such
+  if (!f) {
+    // the counts are only trusted once phValid checked the sizes, the
+    // pointers below are not followed before that
+    const size_t size = (size_t)st.st_size;
+    const char *text = size >= sizeof(ph_header_t)
+      ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    f = malloc(sizeof(ph_file_t));
+    assert(f);
+    memset(f, 0, sizeof(ph_file_t));
+    f->dev   = st.st_dev;
+    f->ino   = st.st_ino;
+    f->size  = st.st_size;
+    f->mtime = st.st_mtim;
+    if (text != MAP_FAILED) {
+      f->header  = (const ph_header_t*)text;
+      f->sources = (const ph_source_t*)(f->header + 1);
+      f->nodes   = (const ph_node_t*)(f->sources + f->header->numSources);
+      f->types   = (const ph_type_t*)(f->nodes + f->header->numNodes);
+      f->strings = (const char*)(f->types + f->header->numTypes);
+      if (!phValid(f, size)) {
+        munmap((void*)text, size);
+        f->header = NULL;
+      }
+    }
+    f->next = phFiles;
+    phFiles = f;
+  }
+
+  pthread_mutex_unlock(&phFilesLock);
+  close(fd);
+  return f;
+}
+
+static ast_type_p phTypeNew(const ph_type_t *p) {
+  ast_type_p t = calloc(1, sizeof(ast_type_t));
+  assert(t);
+  t->count      = p->count;
+  t->width      = p->width;
+  t->ptrLevel   = p->ptrLevel;
+  t->constDeref = p->constDeref;
+  t->isVoid     = (p->flags & PH_VOID)   != 0;
+  t->isConst    = (p->flags & PH_CONST)  != 0;
+  t->isStatic   = (p->flags & PH_STATIC) != 0;
+  t->isSigned   = (p->flags & PH_SIGNED) != 0;
+  t->isRvalue   = (p->flags & PH_RVALUE) != 0;
+  return t;
+}
+
+static ast_node_p phBuild(const ph_file_t *f, const uint32_t *files) {
+
+  // last node first, so what a node refers to is always built already
+  const ph_header_t *h = f->header;
+  ast_node_p *built = calloc(h->numNodes + 1, sizeof(ast_node_p));
+  assert(built);
+  for (uint32_t i = h->numNodes; i-- > 0;) {
+    const ph_node_t *p = &f->nodes[i];
+    ast_node_p n = aNodeNew((ast_node_type_t)p->type);
+    token_t *t = aToken(n);
+    if (t) {
+      t->type  = (token_type_t)p->token;
+      t->start = f->strings + p->text;
+      t->end   = t->start + p->len;
+      const uint32_t file = files[p->source];
+      t->line  = file ? LINE_HEADER | (file << LINE_FILE_SHIFT) | p->line
+                      : p->line;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t c = 0; c < count; ++c) {
+      *slots[c] = p->child[c] ? built[p->child[c]] : NULL;
+    }
+    n->next = p->next ? built[p->next] : NULL;
+    n->last = n->next ? n->next->last : n;
+    n->decorate.type = p->decorate ? phTypeNew(&f->types[p->decorate - 1])
+                                   : NULL;
+    if (n->type == AST_DECL_VAR) {
+      n->declVar.isEscaping    = (p->flags & PH_ESCAPING) != 0;
+      n->declVar.isPrecompiled = true;
+    }
+    if (n->type == AST_DECL_FUNC) {
+      n->declFunc.isPrecompiled = true;
+    }
+    built[i] = n;
+  }
+  ast_node_p first = built[0];
+  free(built);
+  return first;
+}
+
+bool phLoad(compiler_ctx_t *ctx, const char *path, ast_node_p *decls) {
+
+  *decls = NULL;
+  const ph_file_t *f = phOpen(path);
+  if (!f) {
+    dReportText(ctx, DIAG_OPEN_FAILED, 0, path, strlen(path));
+    return false;
+  }
+  if (!f->header) {
+    dReportText(ctx, DIAG_PCH_INVALID, 0, path, strlen(path));
+    return false;
+  }
+
+  // declarations out of date with any file they were read from would be
+  // silently wrong, so would those of a file which is gone
+  const ph_header_t *h = f->header;
+  for (uint32_t i = 0; i < h->numSources; ++i) {
+    const ph_source_t *s = &f->sources[i];
+    const char *source = f->strings + s->path;
+    struct stat st;
+    if (stat(source, &st) != 0 ||
+        (uint64_t)st.st_size != s->size ||
+        (int64_t)st.st_mtim.tv_sec != s->sec ||
+        (int64_t)st.st_mtim.tv_nsec != s->nsec) {
+      dReportText(ctx, DIAG_PCH_STALE, 0, source, s->len);
+      return false;
+    }
+  }
+
+  // the number each source has in this compile, index 0 is the compiled file
+  uint32_t *files = calloc(h->numSources + 1, sizeof(uint32_t));
+  assert(files);
+  for (uint32_t i = 0; i < h->numSources; ++i) {
+    files[i + 1] = lPrefix(ctx, f->strings + f->sources[i].path);
+  }
+  *decls = phBuild(f, files);
+  free(files);
+  return true;
+}
@@ -0,0 +1,577 @@
+#include "defs.h"
+
+
+// Peephole optimization.
+//
+// A table of small local rewrites is slid over every function until none of
+// them fires any more. Expression rules look at a node and its operands and
+// rewrite the node in place:
+//
+//   x + 0, x * 1, x | 0, - -x, 2 * 3, (a < b) != 0, (a < b) == 0
+//
+// statement rules look at a window of one or two consecutive statements and
+// drop the first one when it is redundant:
+//
+//   x = x;                      self assignment
+//   x = 1; x = 2;               store which is overwritten before any use
+//   x = e; return x;            store which is only reloaded by the return,
+//                               when it does not change the type of e
+//   continue; or return;        jump to where control would go anyway
+//
+// Each rule counts how often it fired, reported with opt->stats.
+
+
+// upper bound on the size of the rule table
+#define PEEP_MAX_RULES 16
+
+typedef enum {
+  PEEP_TAIL_NONE,   // more code follows this statement
+  PEEP_TAIL_LOOP,   // last statement of a loop body
+  PEEP_TAIL_FUNC,   // last statement of a void function
+} peep_tail_t;
+
+typedef struct {
+  uint32_t   changed;   // rewrites made by the current sweep
+  uint32_t   hits[PEEP_MAX_RULES];
+} peep_t;
+
+typedef struct {
+  const char *name;
+  // rewrite an expression node in place
+  bool      (*expr)(peep_t *p, ast_node_p n);
+  // remove the statement at *link given the window starting there
+  bool      (*stmt)(peep_t *p, ast_node_p *link, peep_tail_t tail);
+} peep_rule_t;
+
+static bool peepIsLit(ast_node_p n, int64_t value) {
+  int64_t v;
+  return aIntLitValue(n, &v) && v == value;
+}
+
+static bool peepIsAssign(ast_node_p n) {
+  return n && n->type == AST_EXPR_BIN_OP &&
+         tIs(&n->exprBinOp.op, TOK_ASSIGN) &&
+         n->exprBinOp.lhs->type == AST_EXPR_IDENT &&
+         n->exprBinOp.lhs->exprIdent.decl;
+}
+
+static bool peepIsLocal(peep_t *p, ast_node_p var) {
+
+  if (!var || var->type != AST_DECL_VAR || var->declVar.isEscaping) {
+    return false;
+  }
+
+  // globals may be read by any call
+  return !var->declVar.isGlobal;
+}
+
+static bool peepIsPure(ast_node_p n) {
+  for (; n; n = n->next) {
+    switch (n->type) {
+    case AST_EXPR_CALL:
+    case AST_EXPR_INDEX:
+      return false;
+    case AST_EXPR_BIN_OP:
+      if (tIs(&n->exprBinOp.op, TOK_ASSIGN) ||
+          tIs(&n->exprBinOp.op, TOK_DIV)    ||
+          tIs(&n->exprBinOp.op, TOK_MOD)) {
+        return false;
+      }
+      break;
+    case AST_EXPR_UNARY_OP:
+      if (tIs(&n->exprUnaryOp.op, TOK_MUL)) {
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!peepIsPure(*slots[i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool peepSameValue(const ast_type_t *a, const ast_type_t *b) {
+  // storing one into the other would neither narrow nor extend it
+  return a && b &&
+         a->width    == b->width    &&
+         a->ptrLevel == b->ptrLevel &&
+         a->isSigned == b->isSigned;
+}
+
+static bool peepReads(ast_node_p n, ast_node_p var) {
+  for (; n; n = n->next) {
+    if (n->type == AST_EXPR_IDENT && n->exprIdent.decl == var) {
+      return true;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (peepReads(*slots[i], var)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// x + 0, 0 + x, x - 0
+static bool peepAddZero(peep_t *p, ast_node_p n) {
+  if (n->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  ast_node_p lhs = n->exprBinOp.lhs;
+  ast_node_p rhs = n->exprBinOp.rhs;
+  switch (n->exprBinOp.op.type) {
+  case TOK_ADD:
+    if (peepIsLit(lhs, 0)) {
+      aNodeReplace(n, rhs);
+      return true;
+    }
+    // fall through
+  case TOK_SUB:
+    if (peepIsLit(rhs, 0)) {
+      aNodeReplace(n, lhs);
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+  return false;
+}
+
+// x * 1, 1 * x, x / 1
+static bool peepMulOne(peep_t *p, ast_node_p n) {
+  if (n->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  ast_node_p lhs = n->exprBinOp.lhs;
+  ast_node_p rhs = n->exprBinOp.rhs;
+  switch (n->exprBinOp.op.type) {
+  case TOK_MUL:
+    if (peepIsLit(lhs, 1)) {
+      aNodeReplace(n, rhs);
+      return true;
+    }
+    // fall through
+  case TOK_DIV:
+    if (peepIsLit(rhs, 1)) {
+      aNodeReplace(n, lhs);
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+  return false;
+}
+
+// x | 0, 0 | x, x ^ 0, 0 ^ x, x << 0, x >> 0
+static bool peepBitZero(peep_t *p, ast_node_p n) {
+  if (n->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  ast_node_p lhs = n->exprBinOp.lhs;
+  ast_node_p rhs = n->exprBinOp.rhs;
+  switch (n->exprBinOp.op.type) {
+  case TOK_BIT_OR:
+  case TOK_BIT_XOR:
+    if (peepIsLit(lhs, 0)) {
+      aNodeReplace(n, rhs);
+      return true;
+    }
+    // fall through
+  case TOK_SHL:
+  case TOK_SHR:
+    if (peepIsLit(rhs, 0)) {
+      aNodeReplace(n, lhs);
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+  return false;
+}
+
+// - -x, ~ ~x
+static bool peepDoubleNeg(peep_t *p, ast_node_p n) {
+  if (n->type != AST_EXPR_UNARY_OP) {
+    return false;
+  }
+  const token_type_t op = n->exprUnaryOp.op.type;
+  if (op != TOK_SUB && op != TOK_BIT_NOT) {
+    return false;
+  }
+  ast_node_p rhs = n->exprUnaryOp.rhs;
+  if (rhs->type != AST_EXPR_UNARY_OP || !tIs(&rhs->exprUnaryOp.op, op)) {
+    return false;
+  }
+  aNodeReplace(n, rhs->exprUnaryOp.rhs);
+  return true;
+}
+
+static bool peepFoldBinOp(token_type_t op, int64_t a, int64_t b, int64_t *out) {
+  switch (op) {
+  case TOK_ADD:     *out = a + b;    break;
+  case TOK_SUB:     *out = a - b;    break;
+  case TOK_MUL:     *out = a * b;    break;
+  case TOK_BIT_AND: *out = a & b;    break;
+  case TOK_BIT_OR:  *out = a | b;    break;
+  case TOK_BIT_XOR: *out = a ^ b;    break;
+  case TOK_LOG_AND: *out = a && b;   break;
+  case TOK_LOG_OR:  *out = a || b;   break;
+  case TOK_EQ:      *out = a == b;   break;
+  case TOK_NEQ:     *out = a != b;   break;
+  case TOK_LT:      *out = a < b;    break;
+  case TOK_LTE:     *out = a <= b;   break;
+  case TOK_GT:      *out = a > b;    break;
+  case TOK_GTE:     *out = a >= b;   break;
+  case TOK_DIV:
+  case TOK_MOD:
+    if (b == 0) {
+      return false;
+    }
+    *out = (op == TOK_DIV) ? a / b : a % b;
+    break;
+  case TOK_SHL:
+  case TOK_SHR:
+    // leave anything undefined or implementation defined for the target
+    if (a < 0 || b < 0 || b > 31) {
+      return false;
+    }
+    *out = (op == TOK_SHL) ? a << b : a >> b;
+    break;
+  default:
+    return false;
+  }
+  // int arithmetic which overflows is left alone
+  return *out >= INT32_MIN && *out <= INT32_MAX;
+}
+
+// 2 * 3, 1 < 2, ~0, !5
+static bool peepConstFold(peep_t *p, ast_node_p n) {
+
+  int64_t a, b, value;
+  uint32_t line;
+
+  if (n->type == AST_EXPR_BIN_OP) {
+    if (!aIntLitValue(n->exprBinOp.lhs, &a) ||
+        !aIntLitValue(n->exprBinOp.rhs, &b) ||
+        !peepFoldBinOp(n->exprBinOp.op.type, a, b, &value)) {
+      return false;
+    }
+    line = n->exprBinOp.op.line;
+  }
+  else if (n->type == AST_EXPR_UNARY_OP) {
+    ast_node_p rhs = n->exprUnaryOp.rhs;
+    if (!aIntLitValue(rhs, &a)) {
+      return false;
+    }
+    switch (n->exprUnaryOp.op.type) {
+    case TOK_SUB:
+      // -5 is already as folded as it gets
+      if (rhs->type == AST_EXPR_INT_LIT) {
+        return false;
+      }
+      value = -a;
+      break;
+    case TOK_BIT_NOT:
+      value = ~a;
+      break;
+    case TOK_LOG_NOT:
+      value = !a;
+      break;
+    default:
+      return false;
+    }
+    line = n->exprUnaryOp.op.line;
+  }
+  else {
+    return false;
+  }
+
+  aNodeReplace(n, aIntNew(value, line));
+  return true;
+}
+
+// (a < b) != 0 -> a < b, (a < b) == 0 -> a >= b
+static bool peepCmpZero(peep_t *p, ast_node_p n) {
+
+  if (n->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  const bool isEq = tIs(&n->exprBinOp.op, TOK_EQ);
+  if (!isEq && !tIs(&n->exprBinOp.op, TOK_NEQ)) {
+    return false;
+  }
+
+  ast_node_p c = n->exprBinOp.lhs;
+  if (peepIsLit(c, 0)) {
+    c = n->exprBinOp.rhs;
+  }
+  else if (!peepIsLit(n->exprBinOp.rhs, 0)) {
+    return false;
+  }
+  if (c->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+
+  token_type_t inverse;
+  switch (c->exprBinOp.op.type) {
+  case TOK_EQ:  inverse = TOK_NEQ; break;
+  case TOK_NEQ: inverse = TOK_EQ;  break;
+  case TOK_LT:  inverse = TOK_GTE; break;
+  case TOK_LTE: inverse = TOK_GT;  break;
+  case TOK_GT:  inverse = TOK_LTE; break;
+  case TOK_GTE: inverse = TOK_LT;  break;
+  default:
+    return false;
+  }
+
+  if (isEq) {
+    c->exprBinOp.op = tMake(inverse, c->exprBinOp.op.line);
+  }
+  aNodeReplace(n, c);
+  return true;
+}
+
+// x = x;
+static bool peepSelfAssign(peep_t *p, ast_node_p *link, peep_tail_t tail) {
+  ast_node_p n = *link;
+  if (!peepIsAssign(n)) {
+    return false;
+  }
+  ast_node_p rhs = n->exprBinOp.rhs;
+  if (rhs->type != AST_EXPR_IDENT ||
+      rhs->exprIdent.decl != n->exprBinOp.lhs->exprIdent.decl) {
+    return false;
+  }
+  *link = n->next;
+  return true;
+}
+
+// x = a; x = b;
+static bool peepDeadStore(peep_t *p, ast_node_p *link, peep_tail_t tail) {
+  ast_node_p n    = *link;
+  ast_node_p next = n->next;
+  if (!peepIsAssign(n) || !peepIsAssign(next)) {
+    return false;
+  }
+  ast_node_p var = n->exprBinOp.lhs->exprIdent.decl;
+  if (next->exprBinOp.lhs->exprIdent.decl != var ||
+      !peepIsLocal(p, var) ||
+      !peepIsPure(n->exprBinOp.rhs) ||
+      peepReads(next->exprBinOp.rhs, var)) {
+    return false;
+  }
+  *link = next;
+  return true;
+}
+
+// x = e; return x; -> return e;
+static bool peepStoreReturn(peep_t *p, ast_node_p *link, peep_tail_t tail) {
+  ast_node_p n    = *link;
+  ast_node_p next = n->next;
+  if (!peepIsAssign(n) || !next || next->type != AST_STMT_RETURN) {
+    return false;
+  }
+  ast_node_p var = n->exprBinOp.lhs->exprIdent.decl;
+  ast_node_p e   = next->stmtReturn.expr;
+  if (!e || e->type != AST_EXPR_IDENT || e->exprIdent.decl != var ||
+      !peepIsLocal(p, var)) {
+    return false;
+  }
+  // the store may have narrowed the value, char x; x = 300; returns 44
+  if (!peepSameValue(n->exprBinOp.rhs->decorate.type, var->decorate.type)) {
+    return false;
+  }
+  next->stmtReturn.expr = n->exprBinOp.rhs;
+  *link = next;
+  return true;
+}
+
+// continue; at the end of a loop body, return; at the end of a function
+static bool peepJumpNext(peep_t *p, ast_node_p *link, peep_tail_t tail) {
+  ast_node_p n = *link;
+  if (n->next) {
+    return false;
+  }
+  if (!(tail == PEEP_TAIL_LOOP && n->type == AST_STMT_CONTINUE) &&
+      !(tail == PEEP_TAIL_FUNC && n->type == AST_STMT_RETURN &&
+        !n->stmtReturn.expr)) {
+    return false;
+  }
+  *link = NULL;
+  return true;
+}
+
+static const peep_rule_t peepRules[] = {
+  { "add-zero",     peepAddZero,    NULL            },
+  { "mul-one",      peepMulOne,     NULL            },
+  { "bit-zero",     peepBitZero,    NULL            },
+  { "double-neg",   peepDoubleNeg,  NULL            },
+  { "const-fold",   peepConstFold,  NULL            },
+  { "cmp-zero",     peepCmpZero,    NULL            },
+  { "self-assign",  NULL,           peepSelfAssign  },
+  { "dead-store",   NULL,           peepDeadStore   },
+  { "store-return", NULL,           peepStoreReturn },
+  { "jump-next",    NULL,           peepJumpNext    },
+};
+
+static const uint32_t peepNumRules = sizeof(peepRules) / sizeof(peepRules[0]);
+
+static void peepExpr(peep_t *p, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    // operands first so folds cascade upwards
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      peepExpr(p, *slots[i]);
+    }
+
+    // a rewrite may expose another one on the same node
+    bool again = true;
+    while (again) {
+      again = false;
+      for (uint32_t i = 0; i < peepNumRules && !again; ++i) {
+        if (peepRules[i].expr && peepRules[i].expr(p, n)) {
+          p->hits[i]++;
+          p->changed++;
+          again = true;
+        }
+      }
+    }
+  }
+}
+
+static void peepBlock(peep_t *p, ast_node_p *head, peep_tail_t tail,
+                      bool canEmpty);
+
+static void peepStmt(peep_t *p, ast_node_p n, peep_tail_t tail) {
+  switch (n->type) {
+  case AST_STMT_COMPOUND:
+    peepBlock(p, &n->stmtCompound.stmt, tail, true);
+    break;
+  case AST_STMT_IF:
+    peepExpr(p, n->stmtIf.expr);
+    peepBlock(p, &n->stmtIf.isTrue, tail, false);
+    if (n->stmtIf.isFalse) {
+      peepBlock(p, &n->stmtIf.isFalse, tail, false);
+    }
+    break;
+  case AST_STMT_WHILE:
+    peepExpr(p, n->stmtWhile.expr);
+    peepBlock(p, &n->stmtWhile.body, PEEP_TAIL_LOOP, false);
+    break;
+  case AST_STMT_DO:
+    peepBlock(p, &n->stmtDo.body, PEEP_TAIL_LOOP, false);
+    peepExpr(p, n->stmtDo.expr);
+    break;
+  case AST_STMT_FOR:
+    peepExpr(p, n->stmtFor.init);
+    peepExpr(p, n->stmtFor.cond);
+    peepExpr(p, n->stmtFor.update);
+    if (n->stmtFor.body) {
+      peepBlock(p, &n->stmtFor.body, PEEP_TAIL_LOOP, false);
+    }
+    break;
+  case AST_STMT_SWITCH:
+    // control leaving the body may still be inside a loop, keep its jumps
+    peepExpr(p, n->stmtSwitch.expr);
+    peepBlock(p, &n->stmtSwitch.body, PEEP_TAIL_NONE, false);
+    break;
+  case AST_STMT_RETURN:
+    peepExpr(p, n->stmtReturn.expr);
+    break;
+  case AST_DECL_VAR:
+    peepExpr(p, n->declVar.expr);
+    break;
+  case AST_STMT_BREAK:
+  case AST_STMT_CONTINUE:
+  case AST_STMT_CASE:
+  case AST_STMT_DEFAULT:
+    break;
+  default: {
+    // expression statement, rewrite this node but not its siblings
+    ast_node_p next = n->next;
+    n->next = NULL;
+    peepExpr(p, n);
+    n->next = next;
+    break;
+  }
+  }
+}
+
+static void peepBlock(peep_t *p, ast_node_p *head, peep_tail_t tail,
+                      bool canEmpty) {
+
+  ast_node_p *link = head;
+  while (*link) {
+    ast_node_p n = *link;
+    peepStmt(p, n, n->next ? PEEP_TAIL_NONE : tail);
+
+    bool removed = false;
+    for (uint32_t i = 0; i < peepNumRules && !removed; ++i) {
+      if (peepRules[i].stmt && peepRules[i].stmt(p, link, tail)) {
+        p->hits[i]++;
+        p->changed++;
+        removed = true;
+      }
+    }
+    if (!removed) {
+      link = &n->next;
+    }
+  }
+
+  // only the head of a chain tracks its last node
+  if (*head) {
+    ast_node_p last = *head;
+    while (last->next) {
+      last = last->next;
+    }
+    (*head)->last = last;
+  }
+  else if (!canEmpty) {
+    // the empty statement, as the parser produces for ';'
+    *head = aNodeNew(AST_STMT_COMPOUND);
+    (*head)->last = *head;
+  }
+}
+
+void oPeephole(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+  assert(peepNumRules <= PEEP_MAX_RULES);
+
+  peep_t p;
+  memset(&p, 0, sizeof(p));
+
+  do {
+    p.changed = 0;
+    for (ast_node_p f = n->root.node; f; f = f->next) {
+      if (f->type == AST_DECL_VAR) {
+        peepExpr(&p, f->declVar.expr);
+      }
+      if (f->type == AST_DECL_FUNC && f->declFunc.body) {
+        const peep_tail_t tail =
+          aIsVoidType(f->declFunc.type) ? PEEP_TAIL_FUNC : PEEP_TAIL_NONE;
+        peepBlock(&p, &f->declFunc.body, tail, false);
+      }
+    }
+  } while (p.changed);
+
+  if (opt->stats) {
+    for (uint32_t i = 0; i < peepNumRules; ++i) {
+      fprintf(opt->out, "peephole: %s %u\n", peepRules[i].name, p.hits[i]);
+    }
+  }
+}
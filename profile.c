@@ -0,0 +1,401 @@
+#include "defs.h"
+
+
+// Profile guided optimization.
+//
+// Counters are numbered per function in a fixed pre-order walk of the checked
+// AST: counter 0 counts entries to the function, every if statement owns one
+// counter for each arm and every loop one counter for its body. Functions
+// are numbered by their order in the file.
+//
+// --profile-generate inserts a '__profile_enter(func, checksum, num counters)'
+// call on entry, which also counts counter 0, a '__profile_count(func,
+// counter)' call at each of the other points and a '__profile_dump()' call
+// once the value main returns has been evaluated. The checksum is a hash of
+// the name of the function. The runtime writes one line per function to the
+// profile file:
+//
+//   <func> <checksum> <num counters> <count 0> <count 1> ...
+//
+// --profile-use=<file> reads it back. Functions, loops and if arms which were
+// never executed are marked cold, cold functions are moved out of line to the
+// end of the file, and if/else statements are flipped so the hotter arm is
+// the one which falls through. The unroller and inliner skip cold code.
+
+
+typedef struct {
+  uint32_t  func;
+  uint32_t  checksum;
+  uint64_t *counts;
+  uint32_t  numCounts;
+} profile_func_t;
+
+typedef struct {
+  profile_func_t *funcs;
+  uint32_t        numFuncs;
+  uint32_t        maxFuncs;
+} profile_t;
+
+typedef struct {
+  bool            generate;
+  uint32_t        func;       // ordinal of the function being instrumented
+  uint32_t        next;       // next counter id
+  profile_func_t *data;       // counts when applying a profile
+} profile_walk_t;
+
+static token_t profileCountIdent = {
+  "__profile_count", "__profile_count" + 15, TOK_IDENT, 0
+};
+
+static token_t profileEnterIdent = {
+  "__profile_enter", "__profile_enter" + 15, TOK_IDENT, 0
+};
+
+static token_t profileDumpIdent = {
+  "__profile_dump", "__profile_dump" + 14, TOK_IDENT, 0
+};
+
+static token_t profileRetIdent = {
+  "__ret", "__ret" + 5, TOK_IDENT, 0
+};
+
+static uint32_t profileChecksum(ast_node_p f) {
+  // kept positive so it is spelled as a plain int literal
+  const token_t *t = &f->declFunc.ident;
+  return (uint32_t)caHash(0, t->start, tSize(t)) & 0x7fffffffu;
+}
+
+static ast_node_p profileCounter(uint32_t func, uint32_t id, uint32_t line) {
+  ast_node_p c = aNodeNew(AST_EXPR_CALL);
+  c->exprCall.ident = profileCountIdent;
+  c->exprCall.ident.line = line;
+  c->exprCall.arg = aNodeInsert(c->exprCall.arg, aIntLitNew(func, line));
+  c->exprCall.arg = aNodeInsert(c->exprCall.arg, aIntLitNew(id, line));
+  return c;
+}
+
+static ast_node_p profileEnter(uint32_t func, uint32_t checksum, uint32_t num,
+                               uint32_t line) {
+  ast_node_p c = aNodeNew(AST_EXPR_CALL);
+  c->exprCall.ident = profileEnterIdent;
+  c->exprCall.ident.line = line;
+  c->exprCall.arg = aNodeInsert(c->exprCall.arg, aIntLitNew(func, line));
+  c->exprCall.arg = aNodeInsert(c->exprCall.arg, aIntLitNew(checksum, line));
+  c->exprCall.arg = aNodeInsert(c->exprCall.arg, aIntLitNew(num, line));
+  return c;
+}
+
+static ast_node_p profileDump(uint32_t line) {
+  ast_node_p c = aNodeNew(AST_EXPR_CALL);
+  c->exprCall.ident = profileDumpIdent;
+  c->exprCall.ident.line = line;
+  return c;
+}
+
+static ast_node_p profilePrepend(ast_node_p stmt, ast_node_p first) {
+  // { first; stmt } in place of stmt
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt, first);
+  if (stmt) {
+    ast_node_p inner = aNodeNew(stmt->type);
+    memcpy(inner, stmt, sizeof(ast_node_t));
+    c->stmtCompound.stmt = aNodeInsert(c->stmtCompound.stmt, inner);
+    aNodeReplace(stmt, c);
+    return stmt;
+  }
+  return c;
+}
+
+static uint64_t profileCount(profile_walk_t *w, uint32_t id) {
+  return (id < w->data->numCounts) ? w->data->counts[id] : 0;
+}
+
+static void profileArm(profile_walk_t *w, ast_node_p *arm, uint32_t id,
+                       uint32_t line) {
+  if (w->generate) {
+    *arm = profilePrepend(*arm, profileCounter(w->func, id, line));
+  }
+  else if (*arm) {
+    (*arm)->decorate.isCold = profileCount(w, id) == 0;
+  }
+}
+
+static void profileWalk(profile_walk_t *w, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    uint32_t id = 0;
+
+    switch (n->type) {
+    case AST_STMT_IF:
+      id = w->next;
+      w->next += 2;
+      profileArm(w, &n->stmtIf.isTrue,  id + 0, n->stmtIf.token.line);
+      profileArm(w, &n->stmtIf.isFalse, id + 1, n->stmtIf.token.line);
+      break;
+    case AST_STMT_WHILE:
+      id = w->next++;
+      profileArm(w, &n->stmtWhile.body, id, n->stmtWhile.token.line);
+      break;
+    case AST_STMT_DO:
+      id = w->next++;
+      profileArm(w, &n->stmtDo.body, id, n->stmtDo.token.line);
+      break;
+    case AST_STMT_FOR:
+      id = w->next++;
+      profileArm(w, &n->stmtFor.body, id, n->stmtFor.token.line);
+      break;
+    default:
+      break;
+    }
+
+    // loops are cold when their body never ran
+    switch (n->type) {
+    case AST_STMT_WHILE:
+    case AST_STMT_DO:
+    case AST_STMT_FOR:
+      n->decorate.isCold = !w->generate && profileCount(w, id) == 0;
+      break;
+    default:
+      break;
+    }
+
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      profileWalk(w, *slots[i]);
+    }
+
+    // lay out the hotter arm as the fall through path, only once the arms
+    // were walked in the order their counters were numbered in
+    if (n->type == AST_STMT_IF && !w->generate && n->stmtIf.isFalse &&
+        profileCount(w, id + 1) > profileCount(w, id + 0)) {
+      ast_node_p e = aNodeNew(AST_EXPR_UNARY_OP);
+      e->exprUnaryOp.op  = tMake(TOK_LOG_NOT, n->stmtIf.token.line);
+      e->exprUnaryOp.rhs = n->stmtIf.expr;
+      ast_node_p t = n->stmtIf.isTrue;
+      n->stmtIf.expr    = e;
+      n->stmtIf.isTrue  = n->stmtIf.isFalse;
+      n->stmtIf.isFalse = t;
+    }
+  }
+}
+
+static uint32_t profileNumCounters(ast_node_p n) {
+  uint32_t num = 0;
+  for (; n; n = n->next) {
+    switch (n->type) {
+    case AST_STMT_IF:
+      num += 2;
+      break;
+    case AST_STMT_WHILE:
+    case AST_STMT_DO:
+    case AST_STMT_FOR:
+      num += 1;
+      break;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      num += profileNumCounters(*slots[i]);
+    }
+  }
+  return num;
+}
+
+static void profileReturn(ast_node_p main, ast_node_p n) {
+
+  // return e; -> { __ret = e; __profile_dump(); return __ret; }
+  // e may itself run counted code, a constant is returned as is
+  const uint32_t line = n->stmtReturn.token.line;
+  ast_node_p e = n->stmtReturn.expr;
+  int64_t value;
+  if (!e || aIntLitValue(e, &value)) {
+    profilePrepend(n, profileDump(line));
+    return;
+  }
+
+  ast_node_p t = aNodeNew(AST_DECL_VAR);
+  t->declVar.type = aTypeUnqual(main->declFunc.type);
+  t->declVar.ident = profileRetIdent;
+  t->declVar.ident.line = line;
+  t->declVar.expr = e;
+  n->stmtReturn.expr = aIdentNew(t, line);
+
+  ast_node_p out = aNodeInsert(NULL, t);
+  out = aNodeInsert(out, profileDump(line));
+  ast_node_p r = aNodeNew(AST_STMT_RETURN);
+  memcpy(r, n, sizeof(ast_node_t));
+  r->next = NULL;
+  r->last = r;
+  out = aNodeInsert(out, r);
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = out;
+  aNodeReplace(n, c);
+}
+
+static void profileDumpOnExit(ast_node_p main, ast_node_p n) {
+  // flush the counters before main returns
+  for (; n; n = n->next) {
+    if (n->type == AST_STMT_RETURN) {
+      profileReturn(main, n);
+      continue;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      profileDumpOnExit(main, *slots[i]);
+    }
+  }
+}
+
+static bool profileIsMain(ast_node_p f) {
+  static const token_t mainIdent = { "main", "main" + 4, TOK_IDENT, 0 };
+  return tEqual(&f->declFunc.ident, &mainIdent);
+}
+
+void oProfileGenerate(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  profile_walk_t w;
+  memset(&w, 0, sizeof(w));
+  w.generate = true;
+
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type != AST_DECL_FUNC || !f->declFunc.body) {
+      continue;
+    }
+    const uint32_t line = f->declFunc.ident.line;
+    const uint32_t num  = 1 + profileNumCounters(f->declFunc.body);
+
+    w.next = 1;
+    profileWalk(&w, f->declFunc.body);
+
+    if (profileIsMain(f)) {
+      ast_node_p body = f->declFunc.body;
+      const bool fallsOff = !body || body->last->type != AST_STMT_RETURN;
+      profileDumpOnExit(f, body);
+      if (fallsOff) {
+        f->declFunc.body = aNodeInsert(body, profileDump(line));
+      }
+    }
+
+    // function entry counter
+    ast_node_p entry = profileEnter(w.func, profileChecksum(f), num, line);
+    entry->next = f->declFunc.body;
+    entry->last = f->declFunc.body ? f->declFunc.body->last : entry;
+    f->declFunc.body = entry;
+
+    w.func++;
+  }
+}
+
+static bool profileRead(const char *path, profile_t *p) {
+
+  FILE *fd = fopen(path, "rb");
+  if (!fd) {
+    return false;
+  }
+
+  uint32_t func = 0;
+  uint32_t checksum = 0;
+  uint32_t num = 0;
+  while (fscanf(fd, "%u %u %u", &func, &checksum, &num) == 3) {
+    if (p->numFuncs >= p->maxFuncs) {
+      p->maxFuncs += 64;
+      p->funcs = realloc(p->funcs, p->maxFuncs * sizeof(profile_func_t));
+      assert(p->funcs);
+    }
+    profile_func_t *f = &p->funcs[p->numFuncs++];
+    f->func      = func;
+    f->checksum  = checksum;
+    f->numCounts = num;
+    f->counts    = calloc(num ? num : 1, sizeof(uint64_t));
+    assert(f->counts);
+    for (uint32_t i = 0; i < num; ++i) {
+      unsigned long long c = 0;
+      if (fscanf(fd, "%llu", &c) != 1) {
+        break;
+      }
+      f->counts[i] = c;
+    }
+  }
+
+  fclose(fd);
+  return true;
+}
+
+static void profileFree(profile_t *p) {
+  for (uint32_t i = 0; i < p->numFuncs; ++i) {
+    free(p->funcs[i].counts);
+  }
+  free(p->funcs);
+}
+
+static profile_func_t *profileFind(profile_t *p, ast_node_p f,
+                                   uint32_t func) {
+  // the same function when it has the same number and name
+  const uint32_t checksum = profileChecksum(f);
+  for (uint32_t i = 0; i < p->numFuncs; ++i) {
+    if (p->funcs[i].func == func && p->funcs[i].checksum == checksum) {
+      return &p->funcs[i];
+    }
+  }
+  return NULL;
+}
+
+bool oProfileUse(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  profile_t p;
+  memset(&p, 0, sizeof(p));
+  if (!profileRead(opt->profileUse, &p)) {
+    fprintf(opt->out, "Unable to open profile '%s'\n", opt->profileUse);
+    return false;
+  }
+
+  profile_walk_t w;
+  memset(&w, 0, sizeof(w));
+
+  ast_node_p hot  = NULL;
+  ast_node_p cold = NULL;
+
+  uint32_t func = 0;
+  ast_node_p next = NULL;
+  for (ast_node_p f = n->root.node; f; f = next) {
+    next = f->next;
+
+    // a stale profile which does not match the function is ignored
+    w.data = NULL;
+    if (f->type == AST_DECL_FUNC && f->declFunc.body) {
+      w.data = profileFind(&p, f, func++);
+    }
+    if (w.data &&
+        w.data->numCounts == 1 + profileNumCounters(f->declFunc.body)) {
+      w.next = 1;
+      profileWalk(&w, f->declFunc.body);
+      f->decorate.isCold = profileCount(&w, 0) == 0;
+    }
+
+    // cold functions are placed out of line after everything else
+    if (f->decorate.isCold) {
+      cold = aNodeInsert(cold, f);
+    }
+    else {
+      hot = aNodeInsert(hot, f);
+    }
+  }
+
+  if (hot && cold) {
+    hot->last->next = cold;
+    hot->last = cold->last;
+  }
+  n->root.node = hot ? hot : cold;
+
+  profileFree(&p);
+  return true;
+}
@@ -0,0 +1,37 @@
+#include "defs.h"
+
+
+// Register promotion.
+//
+// Sema marks every variable whose address is taken with unary '&' as
+// escaping. The remaining locals and parameters of a function can never be
+// reached through a pointer so they are marked to live in a register (or an
+// SSA value) instead of a stack slot, which removes the loads and stores
+// around each of their uses.
+
+
+static void promoteWalk(ast_node_p n) {
+  for (; n; n = n->next) {
+    if (n->type == AST_DECL_VAR &&
+        tIs(&n->declVar.ident, TOK_IDENT) &&
+        !n->declVar.isEscaping) {
+      n->declVar.isRegister = true;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      promoteWalk(*slots[i]);
+    }
+  }
+}
+
+void oPromote(ast_node_p n, const opt_t *opt) {
+  assert(n->type == AST_ROOT);
+  // globals stay in memory, only function scope variables are promoted
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type == AST_DECL_FUNC) {
+      promoteWalk(f->declFunc.args);
+      promoteWalk(f->declFunc.body);
+    }
+  }
+}
@@ -0,0 +1,240 @@
+#include "defs.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+
+// Running the golden tests inside the driver.
+//
+// Every .c file below the test directory is compiled with the options on
+// its first line, as runtests.py does, its output is kept in memory and
+// compared with the .c.expect file next to it:
+//
+//   // args: -funroll
+//
+// Each expected line has to match the next output line once surrounding
+// whitespace is dropped, output past the last expected line is ignored.
+// A test expecting errors passes when the errors match, whatever the exit
+// status. The tests run on a pool of threads and are reported in path
+// order with the time each took.
+
+
+#define RT_MAX_ARGS 64
+
+typedef struct {
+  char     *path;
+  char     *report;       // what is printed for the test
+  size_t    reportSize;
+  bool      passed;
+  uint64_t  nanos;
+} rt_test_t;
+
+typedef struct {
+  rt_test_t   *tests;
+  uint32_t     numTests;
+  uint32_t     maxTests;
+  serve_func_t func;
+  void       **user;        // one for each worker
+} rt_t;
+
+static uint64_t rtNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static char *rtRead(const char *path) {
+  // the whole file, terminated, NULL if it can not be read
+  FILE *fd = fopen(path, "rb");
+  if (!fd) {
+    return NULL;
+  }
+  fseek(fd, 0, SEEK_END);
+  const long len = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  char *text = malloc(len > 0 ? (size_t)len + 1 : 1);
+  assert(text);
+  const size_t got = len > 0 ? fread(text, 1, (size_t)len, fd) : 0;
+  text[got] = '\0';
+  fclose(fd);
+  return text;
+}
+
+static void rtFind(rt_t *r, const char *dir) {
+
+  DIR *d = opendir(dir);
+  if (!d) {
+    return;
+  }
+  for (struct dirent *e; (e = readdir(d));) {
+    if (e->d_name[0] == '.') {
+      continue;
+    }
+    const size_t len = strlen(dir) + strlen(e->d_name) + 2;
+    char *path = malloc(len);
+    assert(path);
+    snprintf(path, len, "%s/%s", dir, e->d_name);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+      rtFind(r, path);
+      free(path);
+      continue;
+    }
+    const size_t name = strlen(e->d_name);
+    if (name < 2 || strcmp(e->d_name + name - 2, ".c") != 0) {
+      free(path);
+      continue;
+    }
+    if (r->numTests >= r->maxTests) {
+      r->maxTests = r->maxTests ? r->maxTests * 2 : 256;
+      r->tests = realloc(r->tests, r->maxTests * sizeof(rt_test_t));
+      assert(r->tests);
+    }
+    rt_test_t *t = &r->tests[r->numTests++];
+    memset(t, 0, sizeof(rt_test_t));
+    t->path = path;
+  }
+  closedir(d);
+}
+
+static int rtCompare(const void *a, const void *b) {
+  return strcmp(((const rt_test_t*)a)->path, ((const rt_test_t*)b)->path);
+}
+
+static void rtTrim(const char **start, const char **end) {
+  // drop the whitespace around [start, end)
+  while (*start < *end && strchr(" \t\r\v\f", **start)) {
+    ++*start;
+  }
+  while (*end > *start && strchr(" \t\r\v\f", (*end)[-1])) {
+    --*end;
+  }
+}
+
+static const char *rtLine(const char *p, const char **start,
+                          const char **end) {
+  // the line at p, returns where the next one starts
+  *start = p;
+  while (*p && *p != '\n') {
+    ++p;
+  }
+  *end = p;
+  rtTrim(start, end);
+  return *p ? p + 1 : p;
+}
+
+static bool rtMatch(const char *got, const char *expect, FILE *report) {
+
+  while (*expect) {
+    const char *es, *ee, *gs, *ge;
+    expect = rtLine(expect, &es, &ee);
+    if (!*got) {
+      fprintf(report, "  output ends before: %.*s\n", (int)(ee - es), es);
+      return false;
+    }
+    got = rtLine(got, &gs, &ge);
+    if (ee - es != ge - gs || memcmp(es, gs, (size_t)(ee - es)) != 0) {
+      fprintf(report, "  got:%.*s expected:%.*s\n",
+        (int)(ge - gs), gs, (int)(ee - es), es);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void rtTest(void *user, uint32_t worker, uint32_t job) {
+
+  rt_t *r = user;
+  rt_test_t *t = &r->tests[job];
+  FILE *report = open_memstream(&t->report, &t->reportSize);
+  assert(report);
+
+  const uint64_t start = rtNow();
+
+  // the options on the first line, then the test itself
+  char *source = rtRead(t->path);
+  char *args[RT_MAX_ARGS + 1];
+  int argc = 0;
+  if (source && strncmp(source, "// args:", 8) == 0) {
+    char *p = source + 8;
+    char *save = NULL;
+    p[strcspn(p, "\n")] = '\0';
+    for (char *a = strtok_r(p, " \t\r", &save); a && argc < RT_MAX_ARGS;
+         a = strtok_r(NULL, " \t\r", &save)) {
+      args[argc++] = a;
+    }
+  }
+  args[argc++] = t->path;
+
+  char *got = NULL;
+  size_t gotSize = 0;
+  FILE *out = open_memstream(&got, &gotSize);
+  assert(out);
+  r->func(r->user[worker], argc, args, NULL, 0, out);
+  fclose(out);
+
+  const size_t len = strlen(t->path) + sizeof(".expect");
+  char *expectPath = malloc(len);
+  assert(expectPath);
+  snprintf(expectPath, len, "%s.expect", t->path);
+  char *expect = rtRead(expectPath);
+
+  t->nanos = rtNow() - start;
+  if (!expect) {
+    fprintf(report, "  %s not found\n", expectPath);
+  }
+  t->passed = expect && rtMatch(got, expect, report);
+  fclose(report);
+
+  free(expect);
+  free(expectPath);
+  free(got);
+  free(source);
+}
+
+int rtRun(const char *dir, uint32_t threads, serve_func_t func, void **user,
+          FILE *out) {
+
+  rt_t r;
+  memset(&r, 0, sizeof(r));
+  r.func = func;
+  r.user = user;
+
+  const uint64_t start = rtNow();
+  rtFind(&r, dir);
+  if (!r.numTests) {
+    fprintf(out, "no tests found in '%s'\n", dir);
+    return 1;
+  }
+  qsort(r.tests, r.numTests, sizeof(rt_test_t), rtCompare);
+
+  uint64_t *cost = malloc(r.numTests * sizeof(uint64_t));
+  assert(cost);
+  for (uint32_t i = 0; i < r.numTests; ++i) {
+    struct stat st;
+    cost[i] = stat(r.tests[i].path, &st) == 0 ? (uint64_t)st.st_size : 0;
+  }
+  jobs_t *jobs = jStart(r.numTests, cost, threads, rtTest, &r);
+
+  uint32_t failed = 0;
+  for (uint32_t i = 0; i < r.numTests; ++i) {
+    jWait(jobs, i);
+    rt_test_t *t = &r.tests[i];
+    fprintf(out, "%-40s %s %8.3f ms\n", t->path, t->passed ? "Pass" : "Fail",
+      (double)t->nanos / 1e6);
+    fwrite(t->report, 1, t->reportSize, out);
+    failed += t->passed ? 0 : 1;
+    free(t->report);
+    free(t->path);
+  }
+  jFinish(jobs);
+
+  fprintf(out, "%u passed, %u failed, %.3f ms on %u threads\n",
+    r.numTests - failed, failed, (double)(rtNow() - start) / 1e6, threads);
+
+  free(cost);
+  free(r.tests);
+  return failed ? 1 : 0;
+}
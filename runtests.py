@@ -39,10 +39,20 @@ def compare(out, path):
     return True
 
 
+def test_args(path):
+    # a test may pass extra driver options on its first line:
+    #   // args: -funroll
+    with open(path, 'r') as fd:
+        first = fd.readline().strip()
+    if first.startswith('// args:'):
+        return first[len('// args:'):].split()
+    return []
+
+
 def run_test(path):
     try:
         proc = subprocess.Popen(
-            [DRIVER, path],
+            [DRIVER] + test_args(path) + [path],
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE)
 
@@ -11,17 +11,6 @@
 // - check all types makes sense
 
 
-typedef struct {
-  ast_node_p* stack;
-  uint32_t    max;
-  uint32_t    head;
-} ast_stack_t;
-
-struct {
-  ast_stack_t stack;
-  ast_stack_t hist;
-} sema;
-
 static void stackPush(ast_stack_t *stack, ast_node_p node) {
   if (!stack->stack || stack->head >= stack->max) {
     stack->max += 128;
@@ -57,12 +46,87 @@ static bool stackEmpty(ast_stack_t *stack) {
 //----------------------------------------------------------------------------
 // SemaCheckLoops
 //
-// Check break and continue are only in loops
+// Check break and continue are only in loops, break may also leave a switch
+// and case labels must be inside of one
 //----------------------------------------------------------------------------
 
-static void semaCheckLoops(ast_node_p n) {
+static bool semaInSwitch(ast_stack_t *stack) {
+  for (uint32_t i = 0; i < stack->head; ++i) {
+    if (stack->stack[i]->type == AST_STMT_SWITCH) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool semaInLoop(ast_stack_t *stack) {
+  for (uint32_t i = 0; i < stack->head; ++i) {
+    if (stack->stack[i]->type != AST_STMT_SWITCH) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void semaCollectCases(ast_node_p n, ast_stack_t *cases) {
+  for (; n; n = n->next) {
+    switch (n->type) {
+    case AST_STMT_CASE:
+    case AST_STMT_DEFAULT:
+      stackPush(cases, n);
+      break;
+    case AST_STMT_SWITCH:
+      // labels in a nested switch belong to it
+      continue;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      semaCollectCases(*slots[i], cases);
+    }
+  }
+}
+
+static void semaCheckSwitch(compiler_ctx_t *ctx, ast_node_p n) {
+  assert(n->type == AST_STMT_SWITCH);
+
+  ast_stack_t cases = { NULL, 0, 0 };
+  semaCollectCases(n->stmtSwitch.body, &cases);
 
-  ast_stack_t *stack = &sema.stack;
+  bool hasDefault = false;
+
+  for (uint32_t i = 0; i < cases.head; ++i) {
+    ast_node_p c = cases.stack[i];
+
+    if (c->type == AST_STMT_DEFAULT) {
+      if (hasDefault) {
+        dReport(ctx, DIAG_MULTIPLE_DEFAULT, c->stmtDefault.token.line, 0);
+      }
+      hasDefault = true;
+      continue;
+    }
+
+    if (!aIntLitValue(c->stmtCase.expr, &c->stmtCase.value)) {
+      dReport(ctx, DIAG_CASE_NOT_CONST, c->stmtCase.token.line, 0);
+      continue;
+    }
+    for (uint32_t j = 0; j < i; ++j) {
+      ast_node_p d = cases.stack[j];
+      if (d->type == AST_STMT_CASE && d->stmtCase.value == c->stmtCase.value) {
+        dReport(ctx, DIAG_CASE_DUPLICATE, c->stmtCase.token.line, 0);
+        break;
+      }
+    }
+  }
+
+  free(cases.stack);
+}
+
+static void semaCheckLoops(compiler_ctx_t *ctx, ast_node_p n) {
+
+  ast_stack_t *stack = &ctx->sema.stack;
 
   uint32_t scope = 0;
 
@@ -70,44 +134,61 @@ static void semaCheckLoops(ast_node_p n) {
 
     switch (n->type) {
     case AST_ROOT:
-      semaCheckLoops(n->root.node);
+      semaCheckLoops(ctx, n->root.node);
       break;
     case AST_DECL_FUNC:
-      semaCheckLoops(n->declFunc.body);
+      semaCheckLoops(ctx, n->declFunc.body);
       break;
     case AST_STMT_COMPOUND:
-      semaCheckLoops(n->stmtCompound.stmt);
+      semaCheckLoops(ctx, n->stmtCompound.stmt);
       break;
     case AST_STMT_IF:
-      semaCheckLoops(n->stmtIf.isTrue);
-      semaCheckLoops(n->stmtIf.isFalse);
+      semaCheckLoops(ctx, n->stmtIf.isTrue);
+      semaCheckLoops(ctx, n->stmtIf.isFalse);
       break;
     case AST_STMT_WHILE:
       scope = stackSave(stack);
       stackPush(stack, n);
-      semaCheckLoops(n->stmtWhile.body);
+      semaCheckLoops(ctx, n->stmtWhile.body);
       stackRestore(stack, scope);
       break;
     case AST_STMT_DO:
       scope = stackSave(stack);
       stackPush(stack, n);
-      semaCheckLoops(n->stmtDo.body);
+      semaCheckLoops(ctx, n->stmtDo.body);
       stackRestore(stack, scope);
       break;
     case AST_STMT_FOR:
       scope = stackSave(stack);
       stackPush(stack, n);
-      semaCheckLoops(n->stmtFor.body);
+      semaCheckLoops(ctx, n->stmtFor.body);
+      stackRestore(stack, scope);
+      break;
+    case AST_STMT_SWITCH:
+      semaCheckSwitch(ctx, n);
+      scope = stackSave(stack);
+      stackPush(stack, n);
+      semaCheckLoops(ctx, n->stmtSwitch.body);
       stackRestore(stack, scope);
       break;
+    case AST_STMT_CASE:
+      if (!semaInSwitch(stack)) {
+        dReport(ctx, DIAG_CASE_OUTSIDE, n->stmtCase.token.line, 0);
+      }
+      break;
+    case AST_STMT_DEFAULT:
+      if (!semaInSwitch(stack)) {
+        dReport(ctx, DIAG_DEFAULT_OUTSIDE, n->stmtDefault.token.line, 0);
+      }
+      break;
     case AST_STMT_BREAK:
       if (stackEmpty(stack)) {
-        ERROR_LN(n->stmtBreak.token.line, "Break statement outside of loop");
+        dReport(ctx, DIAG_BREAK_OUTSIDE, n->stmtBreak.token.line, 0);
       }
       break;
     case AST_STMT_CONTINUE:
-      if (stackEmpty(stack)) {
-        ERROR_LN(n->stmtBreak.token.line, "Continue statement outside of loop");
+      if (!semaInLoop(stack)) {
+        dReport(ctx, DIAG_CONTINUE_OUTSIDE, n->stmtBreak.token.line, 0);
       }
       break;
     }
@@ -133,14 +214,15 @@ static void semaCheckDeclVarType(ast_node_p t) {
 
 }
 
-static void semaCheckTypesDecl(ast_node_p n, token_t* t) {
+static void semaCheckTypesDecl(compiler_ctx_t *ctx, ast_node_p n, token_t* t) {
 
-  for (uint32_t i = 0; i < sema.stack.head; ++i) {
-    ast_node_p d = sema.stack.stack[i];
+  for (uint32_t i = 0; i < ctx->sema.stack.head; ++i) {
+    ast_node_p d = ctx->sema.stack.stack[i];
     bool error = false;
     switch (d->type) {
     case AST_DECL_FUNC:
-      if (!d->declFunc.body) {
+      if (!d->declFunc.body && !d->declFunc.isLazy &&
+          !d->declFunc.isDropped) {
         // this is just a declaration not a definition
         break;
       }
@@ -151,16 +233,16 @@ static void semaCheckTypesDecl(ast_node_p n, token_t* t) {
       break;
     }
     if (error) {
-      ERROR_LN(
-        t->line,
-        "'%.*s' already declared", (int)(t->end - t->start), t->start);
+      dReportText(ctx, DIAG_ALREADY_DECLARED, t->line, t->start, tSize(t));
+      return;
     }
   }
 }
 
-static ast_node_p semaCheckTypesUse(ast_node_p n, token_t* t) {
-  for (uint32_t i = 0; i < sema.stack.head; ++i) {
-    ast_node_p d = sema.stack.stack[i];
+static ast_node_p semaCheckTypesUse(compiler_ctx_t *ctx, ast_node_p n,
+                                    token_t* t) {
+  for (uint32_t i = 0; i < ctx->sema.stack.head; ++i) {
+    ast_node_p d = ctx->sema.stack.stack[i];
     switch (d->type) {
     case AST_DECL_FUNC:
       if (tEqual(&d->declFunc.ident, t)) {
@@ -174,33 +256,241 @@ static ast_node_p semaCheckTypesUse(ast_node_p n, token_t* t) {
       break;
     }
   }
-  ERROR_LN(
-    t->line,
-    "'%.*s' not declared", (int)(t->end - t->start), t->start);
+  dReportText(ctx, DIAG_NOT_DECLARED, t->line, t->start, tSize(t));
   return NULL;
 }
 
-static void semaCheckTypesPropagage(ast_node_p n) {
+// pointers are 64 bit
+#define SEMA_PTR_WIDTH 8
+
+static ast_type_p semaTypeNew(void) {
+  ast_type_p t = calloc(1, sizeof(ast_type_t));
+  assert(t);
+  return t;
+}
+
+static ast_type_p semaTypeCopy(const ast_type_t *from) {
+  ast_type_p t = semaTypeNew();
+  *t = *from;
+  return t;
+}
+
+static ast_type_p semaTypeInt(void) {
+  ast_type_p t = semaTypeNew();
+  t->width    = 4;
+  t->isSigned = true;
+  t->isRvalue = true;
+  return t;
+}
+
+static void semaTypeAddressOf(ast_type_p t) {
+  // a pointer to t, whose constness is now that of the pointee
+  t->ptrLevel++;
+  t->constDeref = (uint8_t)(t->constDeref << 1) | (t->isConst ? 1 : 0);
+  t->isConst    = false;
+}
+
+static void semaTypeDeref(ast_type_p t) {
+  // what t points at, const when the pointee was declared const
+  t->ptrLevel  -= t->ptrLevel ? 1 : 0;
+  t->isConst    = (t->constDeref & 1) != 0;
+  t->constDeref >>= 1;
+}
+
+static ast_type_p semaTypeOfDecl(compiler_ctx_t *ctx, ast_node_p type,
+                                 ast_node_p size, uint32_t line) {
+
+  ast_type_p t = semaTypeNew();
+
+  // const applies to what has been declared so far, a '*' after it makes the
+  // pointer itself mutable again and moves the const to what it points at
+  for (; type; type = type->next) {
+    switch (type->declType.token.type) {
+    case TOK_CHAR:   t->width = 1; t->isSigned = true; break;
+    case TOK_SHORT:  t->width = 2; t->isSigned = true; break;
+    case TOK_INT:    t->width = 4; t->isSigned = true; break;
+    case TOK_VOID:   t->isVoid = true;                 break;
+    case TOK_MUL:    semaTypeAddressOf(t);             break;
+    case TOK_CONST:  t->isConst = true;                break;
+    case TOK_STATIC: t->isStatic = true;               break;
+    default:                                           break;
+    }
+  }
+
+  if (size) {
+    int64_t count = 0;
+    if (!aIntLitValue(size, &count) || count <= 0) {
+      dReport(ctx, DIAG_ARRAY_SIZE, line, 0);
+      count = 0;
+    }
+    t->count = (uint32_t)count;
+  }
+
+  return t;
+}
+
+static ast_type_p semaTypeOf(ast_node_p n) {
+  // expressions sema could not type are treated as int
+  return n->decorate.type ? n->decorate.type : semaTypeInt();
+}
+
+static uint32_t semaElemWidth(const ast_type_t *t) {
+  // width of what a pointer points at, void* steps in bytes
+  assert(t->ptrLevel);
+  if (t->ptrLevel > 1) {
+    return SEMA_PTR_WIDTH;
+  }
+  return t->isVoid ? 1 : t->width;
+}
+
+static ast_type_p semaTypeIdent(compiler_ctx_t *ctx, ast_node_p decl) {
+
+  if (decl->type == AST_DECL_FUNC) {
+    ast_type_p t = semaTypeOfDecl(ctx, decl->declFunc.type, NULL, 0);
+    t->ptrLevel++;
+    t->isRvalue = true;
+    return t;
+  }
+
+  // arrays decay to a pointer to their first element
+  ast_type_p t = semaTypeCopy(semaTypeOf(decl));
+  if (t->count) {
+    t->count = 0;
+    semaTypeAddressOf(t);
+    t->isRvalue = true;
+  }
+  return t;
+}
+
+static ast_type_p semaTypeBinOp(ast_node_p n) {
+
+  ast_type_p l = semaTypeOf(n->exprBinOp.lhs);
+  ast_type_p r = semaTypeOf(n->exprBinOp.rhs);
+  ast_type_p t = NULL;
+
+  switch (n->exprBinOp.op.type) {
+  case TOK_ASSIGN:
+    t = semaTypeCopy(l);
+    break;
+  case TOK_ADD:
+    // p + i and i + p step in elements
+    if (l->ptrLevel && !r->ptrLevel) {
+      n->exprBinOp.scale = semaElemWidth(l);
+      t = semaTypeCopy(l);
+    }
+    else if (r->ptrLevel && !l->ptrLevel) {
+      n->exprBinOp.scale = semaElemWidth(r);
+      t = semaTypeCopy(r);
+    }
+    break;
+  case TOK_SUB:
+    // p - i steps back in elements, p - q counts the elements between
+    if (l->ptrLevel && !r->ptrLevel) {
+      n->exprBinOp.scale = semaElemWidth(l);
+      t = semaTypeCopy(l);
+    }
+    else if (l->ptrLevel && r->ptrLevel) {
+      n->exprBinOp.scale = semaElemWidth(l);
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (!t) {
+    return semaTypeInt();
+  }
+  t->isRvalue = true;
+  return t;
+}
+
+static ast_type_p semaTypeUnaryOp(ast_node_p n) {
+
+  ast_type_p r = semaTypeOf(n->exprUnaryOp.rhs);
+  ast_type_p t = NULL;
+
+  switch (n->exprUnaryOp.op.type) {
+  case TOK_BIT_AND:
+    t = semaTypeCopy(r);
+    semaTypeAddressOf(t);
+    t->isRvalue = true;
+    break;
+  case TOK_MUL:
+    t = semaTypeCopy(r);
+    semaTypeDeref(t);
+    t->isRvalue = false;
+    break;
+  default:
+    t = semaTypeInt();
+    break;
+  }
+
+  return t;
+}
+
+static ast_type_p semaTypeIndex(compiler_ctx_t *ctx, ast_node_p n) {
+
+  ast_type_p b = semaTypeOf(n->exprIndex.base);
+  if (!b->ptrLevel) {
+    dReport(ctx, DIAG_SUBSCRIPT_BASE, n->exprIndex.token.line, 0);
+    return semaTypeInt();
+  }
+  if (semaTypeOf(n->exprIndex.index)->ptrLevel) {
+    dReport(ctx, DIAG_SUBSCRIPT_INDEX, n->exprIndex.token.line, 0);
+  }
+
+  // a[i] is *(a + i)
+  n->exprIndex.scale = semaElemWidth(b);
+
+  ast_type_p t = semaTypeCopy(b);
+  semaTypeDeref(t);
+  t->isRvalue = false;
+  return t;
+}
+
+static void semaCheckTypesPropagage(compiler_ctx_t *ctx, ast_node_p n) {
+
+  ast_type_p t = NULL;
 
   switch (n->type) {
+  case AST_EXPR_IDENT:
+    t = n->exprIdent.decl ? semaTypeIdent(ctx, n->exprIdent.decl) : semaTypeInt();
+    break;
+  case AST_EXPR_INT_LIT:
+    t = semaTypeInt();
+    break;
   case AST_EXPR_BIN_OP:
-    // TODO
+    t = semaTypeBinOp(n);
+    break;
   case AST_EXPR_UNARY_OP:
-    // TODO
+    t = semaTypeUnaryOp(n);
+    break;
   case AST_EXPR_CALL:
-    // TODO
+    if (n->exprCall.decl && n->exprCall.decl->type == AST_DECL_FUNC) {
+      t = semaTypeOfDecl(ctx, n->exprCall.decl->declFunc.type, NULL, 0);
+      t->isRvalue = true;
+      break;
+    }
+    t = semaTypeInt();
+    break;
   case AST_EXPR_CAST:
-    // TODO
+    t = semaTypeOfDecl(ctx, n->exprCast.type, NULL, 0);
+    t->isRvalue = true;
+    break;
+  case AST_EXPR_INDEX:
+    t = semaTypeIndex(ctx, n);
     break;
   default:
     assert(!"unreachable");
   }
+
+  n->decorate.type = t;
 }
 
-static void semaCheckReturnType(ast_node_p n) {
+static void semaCheckReturnType(compiler_ctx_t *ctx, ast_node_p n) {
   assert(n->type == AST_STMT_RETURN);
 
-  ast_node_p func = sema.hist.stack[0];
+  ast_node_p func = ctx->sema.hist.stack[0];
 
   if (n->stmtReturn.expr) {
     // TODO
@@ -211,15 +501,61 @@ static void semaCheckReturnType(ast_node_p n) {
 
 }
 
+static void semaCheckEscape(ast_node_p n) {
+  assert(n->type == AST_EXPR_UNARY_OP);
+
+  // taking the address of a variable lets it escape, it then has to live in
+  // memory for as long as it is in scope
+  ast_node_p e = n->exprUnaryOp.rhs;
+  if (!tIs(&n->exprUnaryOp.op, TOK_BIT_AND) || e->type != AST_EXPR_IDENT) {
+    return;
+  }
+  ast_node_p d = e->exprIdent.decl;
+  if (d && d->type == AST_DECL_VAR) {
+    d->declVar.isEscaping = true;
+  }
+}
+
+static void semaCheckAssign(compiler_ctx_t *ctx, ast_node_p n) {
+  assert(n->type == AST_EXPR_BIN_OP);
+
+  // a const variable, or an element or pointee declared const
+  ast_node_p l = n->exprBinOp.lhs;
+  if (tIs(&n->exprBinOp.op, TOK_ASSIGN) &&
+      l->decorate.type && l->decorate.type->isConst) {
+    dReport(ctx, DIAG_ASSIGN_CONST, n->exprBinOp.op.line, 0);
+  }
+}
+
+static void semaCheckStatic(compiler_ctx_t *ctx, ast_node_p n) {
+  assert(n->type == AST_DECL_VAR);
+
+  // statics are initialized once before the program starts
+  int64_t value;
+  if (n->decorate.type->isStatic && n->declVar.expr &&
+      !aIntLitValue(n->declVar.expr, &value)) {
+    dReport(ctx, DIAG_STATIC_INIT, n->declVar.ident.line, 0);
+  }
+}
+
 static void semaCheckInLoop(ast_node_p n) {
   // check we are inside of a loop
 }
 
-void semaCheckTypes(ast_node_p n) {
+static void semaMarkGlobals(ast_node_p n) {
+  // the variables of a chain of file scope declarations
+  for (; n; n = n->next) {
+    if (n->type == AST_DECL_VAR) {
+      n->declVar.isGlobal = true;
+    }
+  }
+}
+
+void semaCheckTypes(compiler_ctx_t *ctx, ast_node_p n) {
 
-  stackPush(&sema.hist, n);
+  stackPush(&ctx->sema.hist, n);
 
-  ast_stack_t *stack = &sema.stack;
+  ast_stack_t *stack = &ctx->sema.stack;
   
   uint32_t scope = 0;
 
@@ -227,56 +563,72 @@ void semaCheckTypes(ast_node_p n) {
 
     switch (n->type) {
     case AST_ROOT:
-      semaCheckTypes(n->root.node);
+      semaMarkGlobals(n->root.node);
+      semaCheckTypes(ctx, n->root.node);
       break;
     case AST_DECL_VAR:
+      if (n->declVar.isPrecompiled) {
+        stackPush(stack, n);                          // typed by the snapshot
+        break;
+      }
       semaCheckDeclVarType(n->declVar.type);
+      n->decorate.type = semaTypeOfDecl(ctx,
+        n->declVar.type, n->declVar.size, n->declVar.ident.line);
+      // arrays and statics always live in memory
+      n->declVar.isEscaping |= n->decorate.type->count != 0 ||
+                               n->decorate.type->isStatic;
+      semaCheckTypes(ctx, n->declVar.expr);           // check initializer
+      semaCheckStatic(ctx, n);
       // func args might not have a name...
       if (tIs(&n->declVar.ident, TOK_IDENT)) {
-        semaCheckTypesDecl(n, &n->declVar.ident);
+        semaCheckTypesDecl(ctx, n, &n->declVar.ident);
         stackPush(stack, n);
       }
       break;
     case AST_DECL_FUNC:
+      if (n->declFunc.isPrecompiled) {
+        stackPush(stack, n);                          // a prototype, no body
+        break;
+      }
       semaCheckFuncReturnType(n->declFunc.type);      // check return type
-      semaCheckTypesDecl(n, &n->declFunc.ident);      // check function name
+      semaCheckTypesDecl(ctx, n, &n->declFunc.ident); // check function name
       stackPush(stack, n);                            // record function name
       {
         scope = stackSave(stack);                     // enter scope
-        semaCheckTypes(n->declFunc.args);             // check args
-        semaCheckTypes(n->declFunc.body);             // walk body
+        semaCheckTypes(ctx, n->declFunc.args);        // check args
+        semaCheckTypes(ctx, n->declFunc.body);        // walk body
         stackRestore(stack, scope);                   // leave scope
       }
       break;
     case AST_STMT_RETURN:
-      semaCheckTypes(n->stmtReturn.expr);
-      semaCheckReturnType(n);
+      semaCheckTypes(ctx, n->stmtReturn.expr);
+      semaCheckReturnType(ctx, n);
       break;
     case AST_STMT_EXPR:
-      semaCheckTypes(n->stmtExpr.expr);
+      semaCheckTypes(ctx, n->stmtExpr.expr);
       break;
     case AST_STMT_COMPOUND:
       {
         scope = stackSave(stack);
-        semaCheckTypes(n->stmtCompound.stmt);
+        semaCheckTypes(ctx, n->stmtCompound.stmt);
         stackRestore(stack, scope);
       }
       break;
     case AST_STMT_IF:
-      semaCheckTypes(n->stmtIf.expr);
+      semaCheckTypes(ctx, n->stmtIf.expr);
       {
         scope = stackSave(stack);                     // enter scope
-        semaCheckTypes(n->stmtIf.isTrue);
+        semaCheckTypes(ctx, n->stmtIf.isTrue);
         stackRestore(stack, scope);                   // reset scope
-        semaCheckTypes(n->stmtIf.isFalse);
+        semaCheckTypes(ctx, n->stmtIf.isFalse);
         stackRestore(stack, scope);                   // leave scope
       }
       break;
     case AST_STMT_WHILE:
-      semaCheckTypes(n->stmtWhile.expr);
+      semaCheckTypes(ctx, n->stmtWhile.expr);
       {
         scope = stackSave(stack);                     // enter scope
-        semaCheckTypes(n->stmtWhile.body);
+        semaCheckTypes(ctx, n->stmtWhile.body);
         stackRestore(stack, scope);                   // leave scope
       }
       break;
@@ -289,55 +641,118 @@ void semaCheckTypes(ast_node_p n) {
     case AST_STMT_DO:
       {
         scope = stackSave(stack);
-        semaCheckTypes(n->stmtDo.body);
+        semaCheckTypes(ctx, n->stmtDo.body);
         stackRestore(stack, scope);
       }
-      semaCheckTypes(n->stmtDo.expr);
+      semaCheckTypes(ctx, n->stmtDo.expr);
       break;
     case AST_STMT_FOR:
-      semaCheckTypes(n->stmtFor.init);
-      semaCheckTypes(n->stmtFor.cond);
-      semaCheckTypes(n->stmtFor.update);
+      semaCheckTypes(ctx, n->stmtFor.init);
+      semaCheckTypes(ctx, n->stmtFor.cond);
+      semaCheckTypes(ctx, n->stmtFor.update);
+      {
+        scope = stackSave(stack);
+        semaCheckTypes(ctx, n->stmtFor.body);
+        stackRestore(stack, scope);
+      }
+      break;
+    case AST_STMT_SWITCH:
+      semaCheckTypes(ctx, n->stmtSwitch.expr);
       {
         scope = stackSave(stack);
-        semaCheckTypes(n->stmtFor.body);
+        semaCheckTypes(ctx, n->stmtSwitch.body);
         stackRestore(stack, scope);
       }
       break;
+    case AST_STMT_CASE:
+      semaCheckTypes(ctx, n->stmtCase.expr);
+      break;
+    case AST_STMT_DEFAULT:
+      break;
     case AST_EXPR_IDENT:
-      semaCheckTypesUse(n, &n->exprIdent.ident);
+      n->exprIdent.decl = semaCheckTypesUse(ctx, n, &n->exprIdent.ident);
+      semaCheckTypesPropagage(ctx, n);
       break;
     case AST_EXPR_INT_LIT:
+      semaCheckTypesPropagage(ctx, n);
       break;
     case AST_EXPR_BIN_OP:
-      semaCheckTypes(n->exprBinOp.lhs);
-      semaCheckTypes(n->exprBinOp.rhs);
-      semaCheckTypesPropagage(n);
+      semaCheckTypes(ctx, n->exprBinOp.lhs);
+      semaCheckTypes(ctx, n->exprBinOp.rhs);
+      semaCheckAssign(ctx, n);
+      semaCheckTypesPropagage(ctx, n);
       break;
     case AST_EXPR_UNARY_OP:
-      semaCheckTypes(n->exprUnaryOp.rhs);
-      semaCheckTypesPropagage(n);
+      semaCheckTypes(ctx, n->exprUnaryOp.rhs);
+      semaCheckEscape(n);
+      semaCheckTypesPropagage(ctx, n);
       break;
     case AST_EXPR_CALL:
-      semaCheckTypesUse(n, &n->exprCall.ident);
-      semaCheckTypes(n->exprCall.arg);
-      semaCheckTypesPropagage(n);
+      n->exprCall.decl = semaCheckTypesUse(ctx, n, &n->exprCall.ident);
+      semaCheckTypes(ctx, n->exprCall.arg);
+      semaCheckTypesPropagage(ctx, n);
       break;
     case AST_EXPR_CAST:
-      semaCheckTypes(n->exprCast.expr);
-      semaCheckTypesPropagage(n);
+      semaCheckTypes(ctx, n->exprCast.expr);
+      semaCheckTypesPropagage(ctx, n);
+      break;
+    case AST_EXPR_INDEX:
+      semaCheckTypes(ctx, n->exprIndex.base);
+      semaCheckTypes(ctx, n->exprIndex.index);
+      semaCheckTypesPropagage(ctx, n);
       break;
     default:
       assert(!"unreachable");
     }
   }
 
-  stackPop(&sema.hist);
+  stackPop(&ctx->sema.hist);
+}
+
+void sCheck(compiler_ctx_t *ctx, ast_node_p n) {
+  stackClear(&ctx->sema.stack);
+  semaCheckTypes(ctx, n);
+
+  stackClear(&ctx->sema.stack);
+  semaCheckLoops(ctx, n);
+}
+
+void sCheckDecl(compiler_ctx_t *ctx, ast_node_p root, ast_node_p d) {
+
+  assert(root->type == AST_ROOT);
+
+  // only the declarations before d are visible to it
+  stackClear(&ctx->sema.stack);
+  for (ast_node_p g = root->root.node; g != d; g = g->next) {
+    assert(g);
+    stackPush(&ctx->sema.stack, g);
+  }
+
+  // check d on its own, detached from the declarations following it
+  ast_node_p next = d->next;
+  d->next = NULL;
+  semaMarkGlobals(d);
+  semaCheckTypes(ctx, d);
+  stackClear(&ctx->sema.stack);
+  semaCheckLoops(ctx, d);
+  d->next = next;
 }
 
-void sCheck(ast_node_p n) {
-  semaCheckTypes(n);
+void sCheckNext(compiler_ctx_t *ctx, ast_node_p d) {
+
+  // d sees the declarations checked before it and then joins them
+  ast_node_p next = d->next;
+  d->next = NULL;
+  semaMarkGlobals(d);
+  semaCheckTypes(ctx, d);
+
+  // the loop check wants a stack of its own
+  ast_stack_t globals = ctx->sema.stack;
+  ctx->sema.stack = ctx->sema.spare;
+  stackClear(&ctx->sema.stack);
+  semaCheckLoops(ctx, d);
+  ctx->sema.spare = ctx->sema.stack;
+  ctx->sema.stack = globals;
 
-  stackClear(&sema.stack);
-  semaCheckLoops(n);
+  d->next = next;
 }
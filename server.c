@@ -0,0 +1,277 @@
+#include "defs.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Serving compile requests from a long running process.
+//
+// A request is the driver's arguments, each terminated by '\0', optionally
+// followed by an empty argument and the source text to compile in place of
+// a file. The reply is the exit status and everything the compile printed.
+// Both are framed by a little endian length:
+//
+//   request  [size:4] "-funroll\0" "a.c\0"
+//            [size:4] "--dump-func=f\0" "\0" "int f() { ... }"
+//   reply    [size:4] [status:4] "AST_ROOT\n..."
+//
+// The requests come from a Unix domain socket, one connection at a time,
+// each sending as many as it likes, or from stdin with the replies going to
+// stdout. The process and whatever the handler keeps between requests stay
+// warm in between.
+
+
+#define SV_MAX_REQUEST (64u << 20)
+#define SV_MAX_ARGS    256
+
+static bool svReadAll(int fd, void *buf, size_t size) {
+  // false on end of input or an error before size bytes arrived
+  uint8_t *p = buf;
+  while (size) {
+    const ssize_t got = read(fd, p, size);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    p += got;
+    size -= (size_t)got;
+  }
+  return true;
+}
+
+static bool svWriteAll(int fd, const void *buf, size_t size) {
+  const uint8_t *p = buf;
+  while (size) {
+    const ssize_t put = write(fd, p, size);
+    if (put < 0 && errno == EINTR) {
+      continue;
+    }
+    if (put <= 0) {
+      return false;
+    }
+    p += put;
+    size -= (size_t)put;
+  }
+  return true;
+}
+
+static void svPut32(uint8_t *out, uint32_t v) {
+  out[0] = (uint8_t)v;
+  out[1] = (uint8_t)(v >> 8);
+  out[2] = (uint8_t)(v >> 16);
+  out[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t svGet32(const uint8_t *in) {
+  return (uint32_t)in[0]       | (uint32_t)in[1] << 8 |
+         (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static bool svReply(int fd, int status, const char *text, size_t size) {
+  uint8_t head[8];
+  svPut32(head, (uint32_t)size);
+  svPut32(head + 4, (uint32_t)status);
+  return svWriteAll(fd, head, sizeof(head)) && svWriteAll(fd, text, size);
+}
+
+static bool svRequest(int in, int out, serve_func_t func, void *user,
+                      bool *stop) {
+
+  // one request and its reply, false once the peer is gone
+  uint8_t head[4];
+  if (!svReadAll(in, head, sizeof(head))) {
+    return false;
+  }
+  const uint32_t size = svGet32(head);
+  if (size > SV_MAX_REQUEST) {
+    return false;
+  }
+  char *payload = malloc(size + 1);
+  assert(payload);
+  if (!svReadAll(in, payload, size)) {
+    free(payload);
+    return false;
+  }
+  payload[size] = '\0';
+
+  // split the arguments, an empty one starts the source text
+  char *args[SV_MAX_ARGS];
+  int argc = 0;
+  const char *text = NULL;
+  size_t textSize = 0;
+  for (size_t at = 0; at < size;) {
+    const size_t len = strlen(payload + at);
+    if (!len) {
+      text = payload + at + 1;
+      textSize = size - at - 1;
+      break;
+    }
+    if (argc < SV_MAX_ARGS) {
+      args[argc++] = payload + at;
+    }
+    at += len + 1;
+  }
+
+  char *reply = NULL;
+  size_t replySize = 0;
+  FILE *fd = open_memstream(&reply, &replySize);
+  assert(fd);
+  const int status = func(user, argc, args, text, textSize, fd);
+  fclose(fd);
+
+  *stop = status < 0;
+  const bool sent = svReply(out, *stop ? 0 : status, reply, replySize);
+  free(reply);
+  free(payload);
+  return sent;
+}
+
+static int svListen(const char *path) {
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  // a socket left behind by an earlier server is taken over, one a server
+  // still accepts on and anything else at path are never removed
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      printf("'%s' exists and is not a socket\n", path);
+      return -1;
+    }
+    const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) {
+      return -1;
+    }
+    const bool live =
+      connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    const bool stale = !live && errno == ECONNREFUSED;
+    close(probe);
+    if (live) {
+      printf("'%s' is in use by a running server\n", path);
+      return -1;
+    }
+    if (!stale) {
+      return -1;
+    }
+    unlink(path);
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int svServe(const char *path, serve_func_t func, void *user) {
+
+  // a client going away mid reply must not end the server
+  signal(SIGPIPE, SIG_IGN);
+
+  bool stop = false;
+  if (strcmp(path, "-") == 0) {
+    while (!stop && svRequest(STDIN_FILENO, STDOUT_FILENO, func, user, &stop));
+    return 0;
+  }
+
+  const int fd = svListen(path);
+  if (fd < 0) {
+    printf("Unable to listen on '%s'\n", path);
+    return 1;
+  }
+  while (!stop) {
+    const int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    while (!stop && svRequest(conn, conn, func, user, &stop));
+    close(conn);
+  }
+  close(fd);
+  unlink(path);
+  return 0;
+}
+
+int svConnect(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool svSend(int fd, int argc, char **args, const char *text, size_t size) {
+
+  size_t total = text ? size + 1 : 0;
+  for (int i = 0; i < argc; ++i) {
+    total += strlen(args[i]) + 1;
+  }
+  if (total > SV_MAX_REQUEST) {
+    return false;
+  }
+
+  uint8_t *payload = malloc(total + 4);
+  assert(payload);
+  svPut32(payload, (uint32_t)total);
+  size_t at = 4;
+  for (int i = 0; i < argc; ++i) {
+    const size_t len = strlen(args[i]) + 1;
+    memcpy(payload + at, args[i], len);
+    at += len;
+  }
+  if (text) {
+    payload[at++] = '\0';
+    memcpy(payload + at, text, size);
+  }
+  const bool sent = svWriteAll(fd, payload, total + 4);
+  free(payload);
+  return sent;
+}
+
+bool svReceive(int fd, int *status, char **out, size_t *size) {
+
+  // out is allocated and terminated, the caller frees it
+  uint8_t head[8];
+  if (!svReadAll(fd, head, sizeof(head))) {
+    return false;
+  }
+  *size = svGet32(head);
+  *status = (int)svGet32(head + 4);
+  *out = malloc(*size + 1);
+  assert(*out);
+  if (!svReadAll(fd, *out, *size)) {
+    free(*out);
+    return false;
+  }
+  (*out)[*size] = '\0';
+  return true;
+}
@@ -0,0 +1,395 @@
+#include "defs.h"
+
+
+// Reusing the output of single functions from the cache.
+//
+// Each function definition gets a key of its own, hashed from its checked
+// tree with lines counted from the function's first line and from what the
+// passes may read about the rest of the file:
+//
+//   int g;                 the declaration of every global it reads, and
+//                          whether another function takes its address,
+//   int h(int a);          the type of every function it calls,
+//   int f(void) {          its own tree,
+//     return h(g);
+//   }
+//
+// With -finline or -fconst-eval the bodies of all functions it calls,
+// directly or not, are part of the key as well. Functions found in the
+// cache are taken out of the tree before the passes run, so only the
+// changed ones are optimized and dumped. Whatever the passes look at of a
+// changed function stays in: the globals, the prototypes, the functions it
+// calls and, for a static function that may be inlined, all of its callers.
+// The dump is put back together in source order.
+//
+// Entries keep their lines relative to the function, a function that only
+// moved is found again and its lines are shifted on the way out. Options
+// which look at the whole file at once, -forder, -fstats and the profile
+// ones, always compile everything.
+
+
+typedef struct {
+  ast_node_p  node;
+  uint64_t    key;
+  char       *text;       // cached dump, lines relative to the function
+  size_t      size;
+  bool        isFunc;     // a definition, cached on its own
+  bool        keep;       // seen by the passes
+} splice_decl_t;
+
+typedef struct {
+  ast_node_p  node;
+  uint32_t    decl;
+} splice_index_t;
+
+struct splice_s {
+  const opt_t    *opt;
+  ast_node_p      root;
+  splice_decl_t  *decls;
+  uint32_t        numDecls;
+  splice_index_t *index;    // top level nodes by address
+  cg_t            cg;
+  bool            interproc;
+  uint32_t       *seen;     // closure walks, by function
+  uint32_t        stamp;
+};
+
+static int spIndexCompare(const void *a, const void *b) {
+  const uintptr_t x = (uintptr_t)((const splice_index_t*)a)->node;
+  const uintptr_t y = (uintptr_t)((const splice_index_t*)b)->node;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int32_t spFind(const splice_t *s, ast_node_p n) {
+  // the top level declaration n is, -1 for anything nested
+  splice_index_t find = { n, 0 };
+  const splice_index_t *found = bsearch(&find, s->index, s->numDecls,
+    sizeof(splice_index_t), spIndexCompare);
+  return found ? (int32_t)found->decl : -1;
+}
+
+static uint64_t spHashTree(uint64_t hash, ast_node_p n, int64_t base,
+                           bool lines) {
+
+  // everything the parser put in n and below, lines relative to base
+  const uint32_t type = (uint32_t)n->type;
+  hash = caHash(hash, &type, sizeof(type));
+  const token_t *t = aToken(n);
+  if (t) {
+    const uint32_t kind = (uint32_t)t->type;
+    hash = caHash(hash, &kind, sizeof(kind));
+    hash = caHash(hash, t->start, t->start ? (size_t)tSize(t) : 0);
+    if (lines) {
+      const int64_t line = (int64_t)tLineNum(t) - base;
+      hash = caHash(hash, &line, sizeof(line));
+    }
+  }
+  ast_node_p *slots[AST_MAX_CHILDREN];
+  const uint32_t count = aChildren(n, slots);
+  for (uint32_t i = 0; i < count; ++i) {
+    for (ast_node_p c = *slots[i]; c; c = c->next) {
+      hash = spHashTree(hash, c, base, lines);
+    }
+    hash = caHash(hash, "/", 1);
+  }
+  return hash;
+}
+
+static uint64_t spHashDecorate(uint64_t hash, ast_node_p d) {
+
+  // what sema decided about d looking at the whole file, a global escapes
+  // when any function takes its address
+  const ast_type_t *t = d->decorate.type;
+  const uint8_t facts[] = {
+    d->type == AST_DECL_VAR && d->declVar.isEscaping,
+    d->type == AST_DECL_VAR && d->declVar.isRegister,
+    t != NULL,
+    t ? t->width : 0,
+    t ? t->ptrLevel : 0,
+    t && t->isVoid,
+    t && t->isConst,
+    t ? t->constDeref : 0,
+    t && t->isStatic,
+    t && t->isSigned,
+    t && t->isRvalue,
+  };
+  hash = caHash(hash, facts, sizeof(facts));
+  const uint32_t count = t ? t->count : 0;
+  return caHash(hash, &count, sizeof(count));
+}
+
+static uint64_t spHashSignature(uint64_t hash, ast_node_p f) {
+  // what a caller sees of f
+  for (ast_node_p t = f->declFunc.type; t; t = t->next) {
+    hash = spHashTree(hash, t, 0, false);
+  }
+  hash = caHash(hash, "(", 1);
+  for (ast_node_p a = f->declFunc.args; a; a = a->next) {
+    hash = spHashTree(hash, a, 0, false);
+    hash = spHashDecorate(hash, a);
+  }
+  return hash;
+}
+
+static uint64_t spHashRefs(splice_t *s, uint64_t hash, ast_node_p n) {
+
+  // the declarations outside the function that n refers to
+  for (; n; n = n->next) {
+    ast_node_p decl = NULL;
+    if (n->type == AST_EXPR_IDENT) {
+      decl = n->exprIdent.decl;
+    }
+    if (n->type == AST_EXPR_CALL && !s->interproc) {
+      decl = n->exprCall.decl;
+    }
+    if (decl && spFind(s, decl) >= 0) {
+      hash = decl->type == AST_DECL_FUNC ? spHashSignature(hash, decl)
+                                         : spHashTree(hash, decl, 0, false);
+      hash = spHashDecorate(hash, decl);
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      hash = spHashRefs(s, hash, *slots[i]);
+    }
+  }
+  return hash;
+}
+
+static uint64_t spHashCallees(splice_t *s, uint64_t hash, uint32_t func,
+                              int64_t base) {
+
+  // every function reachable from func, as the inliner would copy it
+  s->seen[func] = s->stamp;
+  const cg_func_t *f = &s->cg.funcs[func];
+  for (uint32_t i = 0; i < f->numCallees; ++i) {
+    const uint32_t c = f->callees[i];
+    if (s->seen[c] == s->stamp) {
+      continue;
+    }
+    const cg_func_t *callee = &s->cg.funcs[c];
+    hash = spHashTree(hash, callee->func, base, true);
+    hash = caHash(hash, &callee->numCallSites, sizeof(uint32_t));
+    hash = spHashRefs(s, hash, callee->func->declFunc.body);
+    hash = spHashCallees(s, hash, c, base);
+  }
+  return hash;
+}
+
+static uint64_t spKey(splice_t *s, ast_node_p f) {
+
+  const cache_t *c = s->opt->cache;
+  uint64_t key = caHash(0, "func", 4);
+  key = caHash(key, &c->build, sizeof(uint64_t));
+  key = caHash(key, &s->opt->optionsKey, sizeof(uint64_t));
+
+  const int64_t base = tLineNum(&f->declFunc.ident);
+  key = spHashTree(key, f, base, true);
+  key = spHashRefs(s, key, f->declFunc.body);
+
+  const cg_func_t *node = s->interproc ? cgFind(&s->cg, f) : NULL;
+  if (node) {
+    s->stamp++;
+    key = spHashCallees(s, key, (uint32_t)(node - s->cg.funcs), base);
+  }
+  return key;
+}
+
+static bool spKeepFunc(splice_t *s, uint32_t func) {
+  // returns true when the definition of func was not kept yet
+  const int32_t d = spFind(s, s->cg.funcs[func].func);
+  if (d < 0 || s->decls[d].keep) {
+    return false;
+  }
+  s->decls[d].keep = true;
+  return true;
+}
+
+static void spKeepCalls(splice_t *s, ast_node_p n) {
+  // functions a global initializer calls, constant evaluation runs them
+  for (; n; n = n->next) {
+    const cg_func_t *f = n->type == AST_EXPR_CALL
+      ? cgFind(&s->cg, n->exprCall.decl) : NULL;
+    if (f) {
+      spKeepFunc(s, (uint32_t)(f - s->cg.funcs));
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      spKeepCalls(s, *slots[i]);
+    }
+  }
+}
+
+static void spKeepClosure(splice_t *s) {
+
+  for (uint32_t i = 0; i < s->numDecls; ++i) {
+    if (s->decls[i].node->type == AST_DECL_VAR) {
+      spKeepCalls(s, s->decls[i].node->declVar.expr);
+    }
+  }
+
+  // what a kept function calls, and every caller of a kept static function
+  // so its number of call sites is the same as in the whole file
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (uint32_t i = 0; i < s->cg.numFuncs; ++i) {
+      const cg_func_t *f = &s->cg.funcs[i];
+      const int32_t d = spFind(s, f->func);
+      if (d < 0 || !s->decls[d].keep) {
+        continue;
+      }
+      for (uint32_t c = 0; c < f->numCallees; ++c) {
+        changed |= spKeepFunc(s, f->callees[c]);
+      }
+      if (!aIsStatic(f->func->declFunc.type)) {
+        continue;
+      }
+      for (uint32_t j = 0; j < s->cg.numFuncs; ++j) {
+        const cg_func_t *caller = &s->cg.funcs[j];
+        for (uint32_t c = 0; c < caller->numCallees; ++c) {
+          if (caller->callees[c] == i) {
+            changed |= spKeepFunc(s, j);
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void spRebase(const char *text, size_t size, int64_t delta, FILE *out) {
+
+  // copies a dump with every line number moved by delta, text is
+  // terminated like everything from caGet and open_memstream
+  const char *end = text + size;
+  while (text < end) {
+    const char *at = strstr(text, "line:");
+    if (!at || at >= end) {
+      fwrite(text, 1, (size_t)(end - text), out);
+      return;
+    }
+    at += 5;
+    fwrite(text, 1, (size_t)(at - text), out);
+    char *stop;
+    const long long line = strtoll(at, &stop, 10);
+    fprintf(out, "%lld", line + (long long)delta);
+    text = stop;
+  }
+}
+
+splice_t *spBegin(ast_node_p n, const opt_t *opt) {
+
+  // NULL when the whole file has to be compiled as usual
+  if (!opt->cache || opt->order || opt->stats || opt->profileGenerate ||
+      opt->profileUse || opt->dumpFunc) {
+    return NULL;
+  }
+
+  splice_t *s = malloc(sizeof(splice_t));
+  assert(s);
+  memset(s, 0, sizeof(splice_t));
+  s->opt       = opt;
+  s->root      = n;
+  s->interproc = opt->inlineFuncs || opt->constEval;
+
+  for (ast_node_p d = n->root.node; d; d = d->next) {
+    s->numDecls++;
+  }
+  s->decls = calloc(s->numDecls + 1, sizeof(splice_decl_t));
+  s->index = malloc((s->numDecls + 1) * sizeof(splice_index_t));
+  assert(s->decls && s->index);
+  uint32_t i = 0;
+  for (ast_node_p d = n->root.node; d; d = d->next, ++i) {
+    s->decls[i].node   = d;
+    s->decls[i].isFunc = d->type == AST_DECL_FUNC && d->declFunc.body;
+    s->decls[i].keep   = true;
+    s->index[i].node   = d;
+    s->index[i].decl   = i;
+  }
+  qsort(s->index, s->numDecls, sizeof(splice_index_t), spIndexCompare);
+
+  if (s->interproc) {
+    cgBuild(n, &s->cg);
+    s->seen = calloc(s->cg.numFuncs + 1, sizeof(uint32_t));
+    assert(s->seen);
+  }
+
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  for (i = 0; i < s->numDecls; ++i) {
+    splice_decl_t *d = &s->decls[i];
+    if (d->isFunc) {
+      d->key  = spKey(s, d->node);
+      d->text = caGet(opt->cache, d->key, &d->size);
+      d->keep = !d->text;
+      hits   += d->text ? 1 : 0;
+      misses += d->text ? 0 : 1;
+    }
+  }
+  caCount(opt->cache, hits, misses);
+  if (s->interproc) {
+    spKeepClosure(s);
+  }
+
+  // the passes only get to see what they have to
+  n->root.node = NULL;
+  for (i = 0; i < s->numDecls; ++i) {
+    if (s->decls[i].keep) {
+      n->root.node = aNodeInsert(n->root.node, s->decls[i].node);
+    }
+  }
+  return s;
+}
+
+void spEnd(splice_t *s, FILE *out) {
+
+  ast_node_p n = s->root;
+  n->root.node = NULL;
+  aDump(n, out);
+
+  for (uint32_t i = 0; i < s->numDecls; ++i) {
+    splice_decl_t *d = &s->decls[i];
+    const int64_t base = d->isFunc ? tLineNum(&d->node->declFunc.ident) : 0;
+    d->node->next = NULL;
+
+    if (d->text) {
+      spRebase(d->text, d->size, base, out);
+    }
+    else if (d->isFunc) {
+      char *text = NULL;
+      size_t size = 0;
+      FILE *fd = open_memstream(&text, &size);
+      assert(fd);
+      aDumpDepth(d->node, 1, fd);
+      fclose(fd);
+      fwrite(text, 1, size, out);
+
+      // stored as if the function started on line 0
+      char *rel = NULL;
+      size_t relSize = 0;
+      fd = open_memstream(&rel, &relSize);
+      assert(fd);
+      spRebase(text, size, -base, fd);
+      fclose(fd);
+      caPut(s->opt->cache, d->key, rel, relSize);
+      free(rel);
+      free(text);
+    }
+    else {
+      aDumpDepth(d->node, 1, out);
+    }
+
+    // back in source order so the tree is freed as a whole
+    n->root.node = aNodeInsert(n->root.node, d->node);
+    free(d->text);
+  }
+
+  if (s->interproc) {
+    cgFree(&s->cg);
+  }
+  free(s->seen);
+  free(s->index);
+  free(s->decls);
+  free(s);
+}
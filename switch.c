@@ -0,0 +1,281 @@
+#include "defs.h"
+
+
+// Switch lowering.
+//
+// Chains of if/else testing a single variable against constants:
+//
+//   if (x == 1) a; else if (x == 2) b; else if (x == 4) c; else d;
+//
+// are first turned into the equivalent switch:
+//
+//   switch (x) { case 1: a; break; case 2: b; break; case 4: c; break;
+//                default: d; break; }
+//
+// Every switch is then decorated with how a code generator should dispatch
+// on it, chosen from the density of the case values:
+//
+//   table    an indirect jump through a table indexed by x - min
+//   bittest  few distinct targets within a machine word, each tested with
+//            (1 << (x - min)) & mask
+//   bsearch  a balanced tree of compares over the sorted case values
+
+
+// if/else arms needed before a chain is worth a switch
+#define SWITCH_MIN_CHAIN 3
+
+// cases needed before a jump table pays for its bounds check and load
+#define SWITCH_MIN_TABLE 4
+
+// largest value range a jump table may span
+#define SWITCH_MAX_TABLE 1024
+
+// case values a bit test may span and targets it may dispatch to
+#define SWITCH_BITTEST_RANGE   32
+#define SWITCH_BITTEST_TARGETS 3
+
+typedef struct {
+  uint32_t converted;
+  uint32_t lowered[SWITCH_LOWER_BSEARCH + 1];
+} switch_t;
+
+typedef struct {
+  ast_node_p var;
+  int64_t    value;
+  ast_node_p lit;       // the constant as written
+} switch_test_t;
+
+static bool switchTest(ast_node_p cond, switch_test_t *t) {
+  // x == C or C == x
+  if (cond->type != AST_EXPR_BIN_OP || !tIs(&cond->exprBinOp.op, TOK_EQ)) {
+    return false;
+  }
+  ast_node_p x = cond->exprBinOp.lhs;
+  ast_node_p c = cond->exprBinOp.rhs;
+  if (x->type != AST_EXPR_IDENT) {
+    x = cond->exprBinOp.rhs;
+    c = cond->exprBinOp.lhs;
+  }
+  if (x->type != AST_EXPR_IDENT || !x->exprIdent.decl ||
+      !aIntLitValue(c, &t->value)) {
+    return false;
+  }
+  t->var = x->exprIdent.decl;
+  t->lit = c;
+  return true;
+}
+
+static bool switchHasBreak(ast_node_p n) {
+  // a break which would be captured by a switch wrapped around it
+  for (; n; n = n->next) {
+    switch (n->type) {
+    case AST_STMT_BREAK:
+      return true;
+    case AST_STMT_WHILE:
+    case AST_STMT_DO:
+    case AST_STMT_FOR:
+    case AST_STMT_SWITCH:
+      continue;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (switchHasBreak(*slots[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static uint32_t switchChain(ast_node_p n, ast_node_p *var) {
+  // number of leading arms of the chain that test the same variable
+  uint32_t arms = 0;
+  for (ast_node_p i = n; i && i->type == AST_STMT_IF; i = i->stmtIf.isFalse) {
+    switch_test_t t;
+    if (!switchTest(i->stmtIf.expr, &t) || (arms && t.var != *var)) {
+      break;
+    }
+    // a value tested again can never match, it would be a duplicate case
+    for (ast_node_p j = n; j != i; j = j->stmtIf.isFalse) {
+      switch_test_t u;
+      switchTest(j->stmtIf.expr, &u);
+      if (u.value == t.value) {
+        return arms;
+      }
+    }
+    *var = t.var;
+    ++arms;
+  }
+  return arms;
+}
+
+static bool switchConvert(switch_t *s, ast_node_p n) {
+
+  ast_node_p var = NULL;
+  const uint32_t arms = switchChain(n, &var);
+  if (arms < SWITCH_MIN_CHAIN) {
+    return false;
+  }
+
+  // a break in any arm would now leave the switch instead of a loop
+  ast_node_p i = n;
+  for (uint32_t k = 0; k < arms; ++k, i = i->stmtIf.isFalse) {
+    if (switchHasBreak(i->stmtIf.isTrue)) {
+      return false;
+    }
+  }
+  ast_node_p rest = i;
+  if (switchHasBreak(rest)) {
+    return false;
+  }
+
+  const uint32_t line = n->stmtIf.token.line;
+  ast_node_p body = NULL;
+
+  i = n;
+  for (uint32_t k = 0; k < arms; ++k, i = i->stmtIf.isFalse) {
+    switch_test_t t;
+    switchTest(i->stmtIf.expr, &t);
+
+    ast_node_p c = aNodeNew(AST_STMT_CASE);
+    c->stmtCase.token = tMake(TOK_CASE, i->stmtIf.token.line);
+    c->stmtCase.expr  = t.lit;
+    c->stmtCase.value = t.value;
+    body = aNodeInsert(body, c);
+    body = aNodeInsert(body, i->stmtIf.isTrue);
+
+    ast_node_p b = aNodeNew(AST_STMT_BREAK);
+    b->stmtBreak.token = tMake(TOK_BREAK, i->stmtIf.token.line);
+    body = aNodeInsert(body, b);
+  }
+
+  if (rest) {
+    ast_node_p d = aNodeNew(AST_STMT_DEFAULT);
+    d->stmtDefault.token = tMake(TOK_DEFAULT, line);
+    body = aNodeInsert(body, d);
+    body = aNodeInsert(body, rest);
+
+    ast_node_p b = aNodeNew(AST_STMT_BREAK);
+    b->stmtBreak.token = tMake(TOK_BREAK, line);
+    body = aNodeInsert(body, b);
+  }
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = body;
+
+  ast_node_p sw = aNodeNew(AST_STMT_SWITCH);
+  sw->stmtSwitch.token = tMake(TOK_SWITCH, line);
+  sw->stmtSwitch.expr  = aIdentNew(var, line);
+  sw->stmtSwitch.body  = c;
+
+  aNodeReplace(n, sw);
+  s->converted++;
+  return true;
+}
+
+static void switchScan(ast_node_p sw, ast_node_p n, uint32_t *targets) {
+  // gather the case values, labels with nothing between them share a target
+  ast_node_p prev = NULL;
+  for (; n; prev = n, n = n->next) {
+    if (n->type == AST_STMT_SWITCH) {
+      continue;
+    }
+    if (n->type == AST_STMT_CASE) {
+      const int64_t v = n->stmtCase.value;
+      if (!sw->stmtSwitch.numCases++) {
+        sw->stmtSwitch.minCase = v;
+        sw->stmtSwitch.maxCase = v;
+      }
+      sw->stmtSwitch.minCase = v < sw->stmtSwitch.minCase ? v : sw->stmtSwitch.minCase;
+      sw->stmtSwitch.maxCase = v > sw->stmtSwitch.maxCase ? v : sw->stmtSwitch.maxCase;
+      if (!prev || (prev->type != AST_STMT_CASE &&
+                    prev->type != AST_STMT_DEFAULT)) {
+        ++*targets;
+      }
+      continue;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      switchScan(sw, *slots[i], targets);
+    }
+  }
+}
+
+static void switchLower(switch_t *s, ast_node_p n) {
+
+  uint32_t targets = 0;
+  n->stmtSwitch.numCases = 0;
+  switchScan(n, n->stmtSwitch.body, &targets);
+
+  const int64_t cases = n->stmtSwitch.numCases;
+  const int64_t range = n->stmtSwitch.maxCase - n->stmtSwitch.minCase + 1;
+
+  if (cases == 0) {
+    // only a default, nothing to dispatch on
+    n->stmtSwitch.lower = SWITCH_LOWER_NONE;
+    return;
+  }
+
+  if (range <= SWITCH_BITTEST_RANGE && targets <= SWITCH_BITTEST_TARGETS &&
+      cases > targets) {
+    // fewer tests than there are values
+    n->stmtSwitch.lower = SWITCH_LOWER_BITTEST;
+  }
+  else if (cases >= SWITCH_MIN_TABLE && range <= SWITCH_MAX_TABLE &&
+           range * 2 <= cases * 5) {
+    // at least 40% of the table entries are used
+    n->stmtSwitch.lower = SWITCH_LOWER_TABLE;
+  }
+  else {
+    n->stmtSwitch.lower = SWITCH_LOWER_BSEARCH;
+  }
+
+  s->lowered[n->stmtSwitch.lower]++;
+}
+
+static void switchWalk(switch_t *s, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    // outermost first so a whole chain becomes one switch
+    if (n->type == AST_STMT_IF) {
+      switchConvert(s, n);
+    }
+
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      switchWalk(s, *slots[i]);
+    }
+
+    if (n->type == AST_STMT_SWITCH) {
+      switchLower(s, n);
+    }
+  }
+}
+
+void oSwitch(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  switch_t s;
+  memset(&s, 0, sizeof(s));
+
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type == AST_DECL_FUNC) {
+      switchWalk(&s, f->declFunc.body);
+    }
+  }
+
+  if (opt->stats) {
+    fprintf(opt->out,
+      "switch: %u converted, %u table, %u bittest, %u bsearch\n",
+      s.converted,
+      s.lowered[SWITCH_LOWER_TABLE],
+      s.lowered[SWITCH_LOWER_BITTEST],
+      s.lowered[SWITCH_LOWER_BSEARCH]);
+  }
+}
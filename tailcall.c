@@ -0,0 +1,254 @@
+#include "defs.h"
+
+
+// Tail call elimination.
+//
+// Self recursive calls in tail position, 'return f(x);' inside f, become a
+// loop: the body is wrapped in 'while (1) { ... }' and each such return
+// reassigns the parameters and continues back to the top of the function.
+// Any other call in tail position is decorated with exprCall.isTail so a
+// code generator can emit it as a jump which reuses the caller's frame.
+// Neither is done once a local or parameter has had its address taken, as
+// the callee could still be reading it, nor for a call whose result would
+// have to be narrowed or widened to the caller's return type.
+
+
+static token_t tailArgIdent(uint32_t index, uint32_t line) {
+  // __arg0, __arg1, ... so each temporary of one call has its own name
+  char buf[32];
+  const int len = snprintf(buf, sizeof(buf), "__arg%u", index);
+  char *text = malloc(len + 1);
+  assert(text);
+  memcpy(text, buf, len + 1);
+
+  token_t t = tMake(TOK_IDENT, line);
+  t.start = text;
+  t.end   = text + len;
+  return t;
+}
+
+static bool tailIsCall(ast_node_p e) {
+  return e && e->type == AST_EXPR_CALL && e->exprCall.decl &&
+         e->exprCall.decl->type == AST_DECL_FUNC;
+}
+
+static bool tailIsSelfCall(ast_node_p func, ast_node_p e) {
+  // the call may resolve to a prototype so match on the name
+  return tailIsCall(e) &&
+         tEqual(&e->exprCall.ident, &func->declFunc.ident);
+}
+
+static bool tailCanLoop(ast_node_p func) {
+  // every parameter needs a name to be reassigned
+  if (aIsVoidArgs(func->declFunc.args)) {
+    return true;
+  }
+  for (ast_node_p p = func->declFunc.args; p; p = p->next) {
+    if (!tIs(&p->declVar.ident, TOK_IDENT)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool tailHasEscaping(ast_node_p n) {
+  // a static lives outside the frame so it may outlive it
+  for (; n; n = n->next) {
+    if (n->type == AST_DECL_VAR && n->declVar.isEscaping &&
+        !(n->decorate.type && n->decorate.type->isStatic)) {
+      return true;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (tailHasEscaping(*slots[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static ast_node_p tailSkipQualifiers(ast_node_p t) {
+  while (t && (tIs(&t->declType.token, TOK_CONST) ||
+               tIs(&t->declType.token, TOK_STATIC))) {
+    t = t->next;
+  }
+  return t;
+}
+
+static bool tailSameType(ast_node_p a, ast_node_p b) {
+  // compare the type tokens, qualifiers do not change the value
+  for (;;) {
+    a = tailSkipQualifiers(a);
+    b = tailSkipQualifiers(b);
+    if (!a || !b) {
+      return !a && !b;
+    }
+    if (a->declType.token.type != b->declType.token.type) {
+      return false;
+    }
+    a = a->next;
+    b = b->next;
+  }
+}
+
+static bool tailArgsMatch(ast_node_p func, ast_node_p call) {
+  ast_node_p p = aIsVoidArgs(func->declFunc.args) ? NULL : func->declFunc.args;
+  ast_node_p a = call->exprCall.arg;
+  for (; p && a; p = p->next, a = a->next);
+  return !p && !a;
+}
+
+static bool tailIsParam(ast_node_p a, ast_node_p p) {
+  return a->type == AST_EXPR_IDENT && a->exprIdent.decl == p;
+}
+
+static void tailToLoop(ast_node_p func, ast_node_p n) {
+
+  const uint32_t line = n->stmtReturn.token.line;
+  ast_node_p call = n->stmtReturn.expr;
+  ast_node_p out  = NULL;
+
+  // parameters which actually change
+  uint32_t changed = 0;
+  ast_node_p a = call->exprCall.arg;
+  ast_node_p p = func->declFunc.args;
+  for (; a; a = a->next, p = p->next) {
+    changed += tailIsParam(a, p) ? 0 : 1;
+  }
+
+  // with one changed parameter it can be assigned directly, otherwise the
+  // arguments are evaluated into temporaries before any are assigned
+  ast_node_p assigns = NULL;
+  uint32_t temps = 0;
+  a = call->exprCall.arg;
+  p = func->declFunc.args;
+  while (a) {
+    ast_node_p nextA = a->next;
+    a->next = NULL;
+    if (!tailIsParam(a, p)) {
+      ast_node_p value = a;
+      if (changed > 1) {
+        ast_node_p t = aNodeNew(AST_DECL_VAR);
+        t->declVar.type = aTypeUnqual(p->declVar.type);
+        t->declVar.ident = tailArgIdent(temps++, line);
+        t->declVar.expr = a;
+        out = aNodeInsert(out, t);
+        value = aIdentNew(t, line);
+      }
+      assigns = aNodeInsert(assigns,
+        aBinOpNew(TOK_ASSIGN, aIdentNew(p, line), value, line));
+    }
+    a = nextA;
+    p = p->next;
+  }
+  while (assigns) {
+    ast_node_p next = assigns->next;
+    out = aNodeInsert(out, assigns);
+    assigns = next;
+  }
+
+  // jump back to the function entry
+  ast_node_p cont = aNodeNew(AST_STMT_CONTINUE);
+  cont->stmtContinue.token = tMake(TOK_CONTINUE, line);
+  out = aNodeInsert(out, cont);
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = out;
+  aNodeReplace(n, c);
+}
+
+static uint32_t tailWalk(ast_node_p func, ast_node_p n, bool inLoop,
+                         bool canLoop) {
+
+  uint32_t loops = 0;
+
+  for (; n; n = n->next) {
+
+    if (n->type == AST_STMT_RETURN && tailIsCall(n->stmtReturn.expr)) {
+      ast_node_p call = n->stmtReturn.expr;
+      // a continue inside a nested loop would target that loop
+      if (canLoop && !inLoop &&
+          tailIsSelfCall(func, call) && tailArgsMatch(func, call)) {
+        tailToLoop(func, n);
+        ++loops;
+      }
+      else if (tailSameType(call->exprCall.decl->declFunc.type,
+                            func->declFunc.type)) {
+        call->exprCall.isTail = true;
+      }
+      continue;
+    }
+
+    bool loop = inLoop;
+    switch (n->type) {
+    case AST_STMT_WHILE:
+    case AST_STMT_DO:
+    case AST_STMT_FOR:
+      loop = true;
+      break;
+    default:
+      break;
+    }
+
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      loops += tailWalk(func, *slots[i], loop, canLoop);
+    }
+  }
+
+  return loops;
+}
+
+static void tailFunc(ast_node_p func) {
+
+  ast_node_p body = func->declFunc.body;
+  if (!body) {
+    return;
+  }
+
+  if (tailHasEscaping(func->declFunc.args) || tailHasEscaping(body)) {
+    return;
+  }
+
+  const uint32_t line = func->declFunc.ident.line;
+  const bool fallsOff = body->last->type != AST_STMT_RETURN;
+
+  // a call as the last statement of a void function is also a tail call
+  if (fallsOff && aIsVoidType(func->declFunc.type) &&
+      tailIsCall(body->last)) {
+    body->last->exprCall.isTail = true;
+  }
+
+  if (!tailWalk(func, body, false, tailCanLoop(func))) {
+    return;
+  }
+
+  // while (1) { body; return; }
+  if (fallsOff) {
+    ast_node_p r = aNodeNew(AST_STMT_RETURN);
+    r->stmtReturn.token = tMake(TOK_RETURN, line);
+    body = aNodeInsert(body, r);
+  }
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = body;
+
+  ast_node_p w = aNodeNew(AST_STMT_WHILE);
+  w->stmtWhile.token = tMake(TOK_WHILE, line);
+  w->stmtWhile.expr  = aIntLitNew(1, line);
+  w->stmtWhile.body  = c;
+
+  func->declFunc.body = aNodeInsert(NULL, w);
+}
+
+void oTailCall(ast_node_p n, const opt_t *opt) {
+  assert(n->type == AST_ROOT);
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type == AST_DECL_FUNC) {
+      tailFunc(f);
+    }
+  }
+}
@@ -0,0 +1,7 @@
+// args: -faddr-modes -fstats
+int f(int *p, int i) {
+    *(p + i) = 1;
+    *(i + p) = 2;
+    *(p - 1) = 3;
+    return *(p + (i + 2));
+}
@@ -0,0 +1,10 @@
+// args: -faddr-modes -fstats
+int f(int *p, int i) {
+    int a[8];
+    short s[8];
+    a[i + 3] = 1;
+    a[2 * i] = 2;
+    s[i << 2] = 3;
+    a[i * 3] = 4;
+    return a[5] + s[i - 1];
+}
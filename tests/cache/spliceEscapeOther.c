@@ -0,0 +1,19 @@
+// args: --cache=/tmp/compiler-test-cache -fvectorize -j 1 tests/cache/spliceEscapeOther.inc
+// the .inc file differs only in g, it is compiled first and stores f
+// vectorized, here g lets p escape so f has to be compiled again
+int *p;
+int b[64];
+
+int f(void) {
+    int i;
+    for (i = 0; i < 64; i = i + 1) {
+        p[i] = b[i] + 1;
+    }
+    return 0;
+}
+
+int g(void) {
+    int **q;
+    q = &p;
+    return 0;
+}
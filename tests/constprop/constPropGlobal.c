@@ -0,0 +1,10 @@
+// args: -fconst-prop -fstats
+const int size = 16;
+const int neg = -3;
+int plain = 4;
+int * const ptr = &plain;
+
+int scale(int a) {
+    int *p = &size;
+    return a * size + neg + plain;
+}
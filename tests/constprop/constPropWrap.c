@@ -0,0 +1,8 @@
+// args: -fconst-prop -fstats
+const char c = 300;
+const short s = -40000;
+const char n = -5;
+
+int f(void) {
+    return c + s + n;
+}
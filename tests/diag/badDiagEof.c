@@ -0,0 +1,7 @@
+int f(int a) {
+    return a;
+}
+
+int main(void) {
+    if (f(1)) {
+        return 0;
@@ -0,0 +1,15 @@
+const int k = 1;
+
+int f(int a) {
+    k = a;
+    return b;
+}
+
+int f(int c) {
+    break;
+    return c[1];
+}
+
+int main(void) {
+    return f(1);
+}
@@ -0,0 +1,17 @@
+int g;
+
+int f(int a) {
+    a = ;
+    if (a) {
+        a = a + + ;
+    }
+    return a;
+}
+
+int h(int a b) {
+    return a;
+}
+
+int main(void) {
+    return f(1) @ 2;
+}
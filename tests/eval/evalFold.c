@@ -0,0 +1,42 @@
+// args: -fconst-eval -fstats
+const int base = 10;
+
+int fact(int n) {
+    if (n <= 1) {
+        return 1;
+    }
+    return n * fact(n - 1);
+}
+
+int sum(int n) {
+    int s = 0;
+    int i;
+    for (i = 0; i < n; i = i + 1) {
+        if (i == 3) {
+            continue;
+        }
+        s = s + i;
+    }
+    return s + base;
+}
+
+int pick(int x) {
+    switch (x) {
+    case 1: return 10;
+    case 2:
+    case 3: return 20;
+    default: break;
+    }
+    return -1;
+}
+
+char narrow(int x) {
+    char c = x;
+    return c;
+}
+
+int main(void) {
+    int a = fact(5);
+    int b = sum(fact(3));
+    return a + b + pick(3) + pick(7) + narrow(300);
+}
@@ -0,0 +1,41 @@
+// args: -fconst-eval -fstats
+int counter;
+
+int spin(int x) {
+    while (x) {
+        x = x + 0;
+    }
+    return x;
+}
+
+int deep(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return 1 + deep(n - 1);
+}
+
+int div(int a, int b) {
+    return a / b;
+}
+
+int uninit(int a) {
+    int b;
+    if (a) {
+        b = 1;
+    }
+    return b;
+}
+
+int reads(int a) {
+    return a + counter;
+}
+
+int ptr(int a) {
+    int *p = &a;
+    return *p;
+}
+
+int main(void) {
+    return spin(1) + deep(1000) + div(1, 0) + uninit(0) + reads(1) + ptr(2) + deep(10);
+}
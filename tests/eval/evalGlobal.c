@@ -0,0 +1,8 @@
+// args: -fconst-eval -fstats
+int sq(int x) {
+    return x * x;
+}
+
+int g = sq(4) + 1;
+short h = 70000;
+int k = g;
@@ -0,0 +1,12 @@
+// args: -fconst-eval -fstats
+const char c = 300;
+
+int twice(void) {
+    return c * 2;
+}
+
+int a = c;
+
+int main(void) {
+    return twice();
+}
@@ -0,0 +1,8 @@
+int f(int *p, short *s, char *c, int **pp, void *v) {
+    p = p + 1;
+    s = 2 + s;
+    c = c - 3;
+    pp = pp + 1;
+    v = v + 1;
+    return p - p;
+}
@@ -0,0 +1,10 @@
+// args: -fif-convert -fstats
+int max(int a, int b) {
+    int m;
+    if (a < b) {
+        m = b;
+    } else {
+        m = a;
+    }
+    return m;
+}
@@ -0,0 +1,6 @@
+// args: -fif-convert -fstats
+int reset(int a) {
+    if (a)
+        a = 0;
+    return a;
+}
@@ -0,0 +1,13 @@
+// args: -fif-convert -fstats
+int g;
+
+int f(int a, int *p) {
+    int x;
+    if (a)
+        x = *p;
+    else
+        x = 1;
+    if (a)
+        g = 1;
+    return x;
+}
@@ -0,0 +1,8 @@
+#ifndef BAD_H
+#define BAD_H
+
+int broken(int a) {
+    return a + missing;
+}
+
+#endif
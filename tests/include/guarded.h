@@ -0,0 +1,9 @@
+// a header with an include guard
+#ifndef GUARDED_H
+#define GUARDED_H
+
+int twice(int a);
+
+int count;
+
+#endif
@@ -0,0 +1,17 @@
+#include "guarded.h"
+#include "once.h"
+#include "guarded.h"
+#include "once.h"
+
+int twice(int a) {
+    return a + a;
+}
+
+int half(int a) {
+    return a / 2;
+}
+
+int main(void) {
+    count = twice(half(8));
+    return count;
+}
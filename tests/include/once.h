@@ -0,0 +1,5 @@
+#pragma once
+
+#include "guarded.h"
+
+int half(int a);
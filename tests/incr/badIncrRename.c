@@ -0,0 +1,8 @@
+// args: --edit=29,3,sum
+int add(int a, int b) {
+    return a + b;
+}
+
+int main(void) {
+    return add(1, 2);
+}
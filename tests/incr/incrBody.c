@@ -0,0 +1,11 @@
+// args: -fstats --edit=76,5,a*b
+int g;
+
+int add(int a, int b) {
+    return a + b;
+}
+
+int main(void) {
+    g = add(1, 2);
+    return g;
+}
@@ -0,0 +1,7 @@
+// args: -fstats --edit=34,7,
+int a;
+int b;
+
+int main(void) {
+    return b;
+}
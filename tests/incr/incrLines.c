@@ -0,0 +1,10 @@
+// args: -fstats --edit=63,0,x=x+1;\n\n
+int twice(int x) {
+    return x + x;
+}
+
+int main(void) {
+    int y;
+    y = twice(3);
+    return y;
+}
@@ -0,0 +1,11 @@
+// args: -finline
+int add(int a, int b) {
+    return a + b;
+}
+
+int main(void) {
+    int x;
+    x = add(1, 2);
+    int y = add(x, 3);
+    return add(x, y);
+}
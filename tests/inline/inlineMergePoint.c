@@ -0,0 +1,11 @@
+// args: -finline
+int sign(int a) {
+    if (a < 0)
+        return 0 - 1;
+    return 1;
+}
+
+void main(void) {
+    int x;
+    x = sign(5);
+}
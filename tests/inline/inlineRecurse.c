@@ -0,0 +1,8 @@
+// args: -finline
+int foo(int a) {
+    return foo(a + 1);
+}
+
+int bar(int a) {
+    return foo(a);
+}
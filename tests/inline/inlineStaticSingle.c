@@ -0,0 +1,18 @@
+// args: -finline -finline-size=4 -forder -fstats
+static int once(int a) {
+    int b = a * 2;
+    int c = b + a;
+    return c * c;
+}
+
+int twice(int a) {
+    int b = a * 2;
+    int c = b + a;
+    return c * c;
+}
+
+int main(void) {
+    int x = once(3);
+    int y = twice(x);
+    return twice(y);
+}
@@ -0,0 +1,7 @@
+int f(int a) {
+    return a + b;
+}
+
+int main(void) {
+    return g(1);
+}
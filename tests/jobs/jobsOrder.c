@@ -0,0 +1,16 @@
+// args: -j 3 tests/jobs/badJobsUndeclared.c -funroll
+int table[4];
+
+int sum(void) {
+    int s;
+    int i;
+    s = 0;
+    for (i = 0; i < 4; i = i + 1) {
+        s = s + table[i];
+    }
+    return s;
+}
+
+int main(void) {
+    return sum();
+}
@@ -0,0 +1,5 @@
+// args: --lazy
+int main(void) {
+    {
+        return 0;
+    }
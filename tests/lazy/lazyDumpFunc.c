@@ -0,0 +1,20 @@
+// args: --lazy --dump-func=wanted
+int g;
+
+int broken(int a) {
+    if (a) {
+        return a + ;
+    }
+    return undeclared;
+}
+
+int wanted(int a) {
+    {
+        g = a;
+    }
+    return g + 1;
+}
+
+int after(void) {
+    return wanted(2);
+}
@@ -0,0 +1,14 @@
+// args: --lazy
+int twice(int a);
+
+int main(void) {
+    int x = twice(3);
+    {
+        x = x + 1;
+    }
+    return x;
+}
+
+int twice(int a) {
+    return a * 2;
+}
@@ -0,0 +1,5 @@
+int main(void) {
+    const int a = 1;
+    a = 2;
+    return a;
+}
@@ -0,0 +1,5 @@
+int main(void) {
+    const int a[3];
+    a[0] = 1;
+    return a[0];
+}
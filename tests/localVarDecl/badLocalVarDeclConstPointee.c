@@ -0,0 +1,10 @@
+int main(void) {
+    int a = 1;
+    const int *p = &a;
+    int * const *q;
+    const int **r;
+    *q = p;
+    **r = 2;
+    *p = 2;
+    return *p;
+}
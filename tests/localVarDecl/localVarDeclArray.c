@@ -0,0 +1,9 @@
+int table[4];
+
+void main(void) {
+    char buf[16];
+    int i;
+    i = 2;
+    buf[i] = 1;
+    table[i + 1] = buf[0];
+}
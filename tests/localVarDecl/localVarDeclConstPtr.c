@@ -0,0 +1,8 @@
+int main(void) {
+    int a = 1;
+    const int *p = &a;
+    int * const q = &a;
+    p = q;
+    *q = 2;
+    return *p;
+}
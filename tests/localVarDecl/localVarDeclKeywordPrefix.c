@@ -0,0 +1,6 @@
+void main(void) {
+    int internal;
+    int done;
+    int iffy;
+    internal = done + iffy;
+}
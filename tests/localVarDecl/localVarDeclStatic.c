@@ -0,0 +1,12 @@
+// args: -fpromote -fpeephole -finline
+static int counter(void) {
+    static int count = 0;
+    int step = 1;
+    count = count + step;
+    return count;
+}
+
+int main(void) {
+    counter();
+    return counter();
+}
@@ -0,0 +1,20 @@
+// args: -forder -fstats
+int g;
+int leaf(int a);
+int dead(int a);
+
+int dead(int a) {
+    return leaf(a);
+}
+
+int leaf(int a) {
+    return a;
+}
+
+int helper(int a) {
+    return leaf(a);
+}
+
+int main(void) {
+    return helper(g);
+}
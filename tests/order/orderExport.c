@@ -0,0 +1,12 @@
+// args: -forder -fexport=api -fstats
+int helper(int a) {
+    return a;
+}
+
+int unused(int a) {
+    return a;
+}
+
+int api(int a) {
+    return helper(a);
+}
@@ -0,0 +1,12 @@
+// args: -forder -fstats
+static int helper(int a) {
+    return a + 1;
+}
+
+static int unused(int a) {
+    return a;
+}
+
+int api(int a) {
+    return helper(a);
+}
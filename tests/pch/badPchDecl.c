@@ -0,0 +1,10 @@
+// args: --pch-write=tests/pch/badPchDecl.pch
+int twice(int a);
+int g = 1;
+int h = -2;
+
+int half(int a) {
+    return a / 2;
+}
+
+int k = g;
@@ -0,0 +1,4 @@
+// args: --pch=tests/pch/missing.pch
+int main(void) {
+    return 0;
+}
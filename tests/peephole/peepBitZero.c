@@ -0,0 +1,4 @@
+// args: -fpeephole -fstats
+int f(int a, int b) {
+    return (a | 0) ^ (0 ^ b) + (a << 0) + (b >> 0);
+}
@@ -0,0 +1,8 @@
+// args: -fpeephole -fstats
+int f(int a, int b) {
+    if ((a < b) == 0)
+        return 1;
+    if (0 != (a == b))
+        return 2;
+    return (a + b) == 0;
+}
@@ -0,0 +1,8 @@
+// args: -fpeephole -fstats
+int g = 2 * 3 + 1;
+
+int f(int a) {
+    int b = (1 << 4) - 20;
+    int c = 1 / 0;
+    return a * (2 + 3) + !7 + ~0 + (3 < 4);
+}
@@ -0,0 +1,14 @@
+// args: -fpeephole -fstats
+int g;
+
+int f(int a) {
+    int x;
+    int y;
+    x = a + 1;
+    x = a * 2;
+    y = a;
+    y = y + 1;
+    g = 1;
+    g = 2;
+    return x + y;
+}
@@ -0,0 +1,4 @@
+// args: -fpeephole -fstats
+int f(int a, int b) {
+    return - -a + ~~b;
+}
@@ -0,0 +1,19 @@
+// args: -fpeephole -fstats
+int g;
+
+void f(int a) {
+    while (a) {
+        a = a - 1;
+        if (a == 3) {
+            g = a;
+            continue;
+        }
+        continue;
+    }
+    for (a = 0; a < 4; a = a + 1) {
+        if (a)
+            continue;
+        g = 1;
+    }
+    return;
+}
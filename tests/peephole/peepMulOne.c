@@ -0,0 +1,4 @@
+// args: -fpeephole -fstats
+int f(int a, int b) {
+    return a * 1 + 1 * b / 1;
+}
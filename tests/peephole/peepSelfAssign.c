@@ -0,0 +1,10 @@
+// args: -fpeephole -fstats
+int g;
+
+int f(int a) {
+    a = a;
+    g = g;
+    if (a)
+        a = a;
+    return a;
+}
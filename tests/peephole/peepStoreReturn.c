@@ -0,0 +1,13 @@
+// args: -fpeephole -fstats
+int g;
+
+int f(int a) {
+    int x;
+    x = a * 2;
+    return x;
+}
+
+int h(int a) {
+    g = a;
+    return g;
+}
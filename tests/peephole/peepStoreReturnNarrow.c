@@ -0,0 +1,12 @@
+// args: -fpeephole -fstats
+int f(void) {
+    char x;
+    x = 300;
+    return x;
+}
+
+char g(char a) {
+    char x;
+    x = a;
+    return x;
+}
@@ -0,0 +1,14 @@
+// args: --profile-generate
+int abs(int a) {
+    if (a < 0)
+        return 0 - a;
+    return a;
+}
+
+int main(void) {
+    int i;
+    for (i=0; i<10; i=i+1) {
+        abs(i);
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+// args: --profile-generate
+int step(int a) {
+    while (a > 10)
+        a = a - 10;
+    return a;
+}
+
+int main(void) {
+    if (step(25) == 5)
+        return step(3);
+    return 0;
+}
@@ -0,0 +1,20 @@
+// args: --profile-use=tests/profile/profileUse.prof -funroll
+int unused(int a) {
+    return a;
+}
+
+int clamp(int a) {
+    int i;
+    for (i=0; i<2; i=i+1) {
+        a = a - 1;
+    }
+    if (a > 100) {
+        return 100;
+    } else {
+        return a;
+    }
+}
+
+int main(void) {
+    return clamp(5);
+}
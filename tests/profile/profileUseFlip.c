@@ -0,0 +1,11 @@
+// args: --profile-use=tests/profile/profileUseFlip.prof -funroll
+int main(void) {
+    int i;
+    int s = 0;
+    if (s) {
+        for (i = 0; i < 4; i = i + 1) s = s + i;
+    } else {
+        for (i = 0; i < 4; i = i + 1) s = s - i;
+    }
+    return s;
+}
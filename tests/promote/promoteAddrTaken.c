@@ -0,0 +1,10 @@
+// args: -fpromote
+int g;
+
+int main(int a, int b) {
+    int x = a;
+    int y;
+    int *p = &y;
+    *p = x + b;
+    return y;
+}
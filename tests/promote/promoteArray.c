@@ -0,0 +1,8 @@
+// args: -fpromote
+int f(int x) {
+    int a[2];
+    int y;
+    a[0] = x;
+    y = a[0];
+    return y;
+}
@@ -0,0 +1,6 @@
+void main(void) {
+    while (1) {
+        case 1:
+            break;
+    }
+}
@@ -0,0 +1,6 @@
+void main(int x) {
+    switch (x) {
+    case 1:
+        continue;
+    }
+}
@@ -0,0 +1,8 @@
+void main(int x) {
+    switch (x) {
+    case 1:
+        break;
+    case 1:
+        break;
+    }
+}
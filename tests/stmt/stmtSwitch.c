@@ -0,0 +1,22 @@
+int f(int x) {
+    int y;
+    y = 0;
+    switch (x) {
+    case 1:
+        y = 10;
+        break;
+    case -2:
+    case 3:
+        y = 20;
+    default:
+        y = y + 1;
+    }
+    while (x) {
+        switch (x) {
+        case 1:
+            continue;
+        }
+        break;
+    }
+    return y;
+}
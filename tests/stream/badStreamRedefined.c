@@ -0,0 +1,12 @@
+// args: --stream
+int f(int a) {
+    return a;
+}
+
+int main(void) {
+    return f(1);
+}
+
+int f(int b) {
+    return b + 1;
+}
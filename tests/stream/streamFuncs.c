@@ -0,0 +1,22 @@
+// args: --stream -fstats
+int g;
+int table[4];
+
+int get(int i) {
+    return table[i & 3];
+}
+
+int sum(int n) {
+    int s;
+    int i;
+    s = 0;
+    for (i = 0; i < n; i = i + 1) {
+        s = s + get(i);
+    }
+    return s;
+}
+
+int main(void) {
+    g = sum(8);
+    return g;
+}
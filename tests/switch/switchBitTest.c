@@ -0,0 +1,12 @@
+// args: -fswitch -fstats
+int isSpace(int c) {
+    switch (c) {
+    case 9:
+    case 10:
+    case 13:
+    case 32:
+        return 1;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,10 @@
+// args: -fswitch -fstats
+int f(int x) {
+    switch (x) {
+    case 1:    return 5;
+    case 100:  return 6;
+    case 1000: return 7;
+    case 5000: return 8;
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+// args: -fswitch -fstats
+int f(int x) {
+    int y;
+    if (x == 1)
+        y = 4;
+    else if (2 == x)
+        y = 9;
+    else if (x == 3)
+        y = 1;
+    else if (x == 4)
+        y = 7;
+    else
+        y = 0;
+    return y;
+}
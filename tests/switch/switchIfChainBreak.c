@@ -0,0 +1,18 @@
+// args: -fswitch -fstats
+int f(int x) {
+    while (x) {
+        if (x == 1)
+            x = 4;
+        else if (x == 2)
+            break;
+        else if (x == 3)
+            x = 1;
+    }
+    if (x == 1)
+        return 1;
+    else if (x == 2)
+        return 2;
+    else if (x == 1)
+        return 3;
+    return 0;
+}
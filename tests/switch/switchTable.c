@@ -0,0 +1,11 @@
+// args: -fswitch -fstats
+int f(int op, int a, int b) {
+    switch (op) {
+    case 0: return a + b;
+    case 1: return a - b;
+    case 2: return a * b;
+    case 3: return a / b;
+    case 5: return a % b;
+    }
+    return 0;
+}
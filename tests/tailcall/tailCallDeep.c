@@ -0,0 +1,10 @@
+// args: -ftail-calls
+int count(int n, int acc) {
+    if (n == 0)
+        return acc;
+    return count(n - 1, acc);
+}
+
+int main(void) {
+    return count(5000000, 0);
+}
@@ -0,0 +1,13 @@
+// args: -ftail-calls
+int g(int *p);
+
+int f(void) {
+    int x;
+    x = 1;
+    return g(&x);
+}
+
+int h(int n) {
+    static int s;
+    return g(&s);
+}
@@ -0,0 +1,10 @@
+// args: -ftail-calls
+int g(void);
+
+char f(void) {
+    return g();
+}
+
+const int h(void) {
+    return g();
+}
@@ -0,0 +1,6 @@
+// args: -ftail-calls
+int gcd(int a, int b) {
+    if (b == 0)
+        return a;
+    return gcd(b, a % b);
+}
@@ -0,0 +1,21 @@
+// args: -ftail-calls
+int even(int n);
+
+int odd(int n) {
+    if (n == 0)
+        return 0;
+    return even(n - 1);
+}
+
+int even(int n) {
+    if (n == 0)
+        return 1;
+    return odd(n - 1);
+}
+
+void log(int n) {
+}
+
+void run(int n) {
+    log(n);
+}
@@ -0,0 +1,8 @@
+// args: -funroll
+void main(void) {
+    int i;
+    int *p;
+    for (i=0; i<3; i=i+1) {
+        p = &i;
+    }
+}
@@ -0,0 +1,8 @@
+// args: -funroll
+void main(void) {
+    int i;
+    int s;
+    for (i=0; i<3; i=i+1) {
+        s = s + i;
+    }
+}
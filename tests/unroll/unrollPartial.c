@@ -0,0 +1,8 @@
+// args: -funroll -funroll-factor=2
+void main(void) {
+    int i;
+    int s;
+    for (i=40; i>=0; i=i-2) {
+        s = s + i;
+    }
+}
@@ -0,0 +1,13 @@
+// args: -fvectorize -fstats
+void add(int *dst, int *src, int n) {
+    int i;
+    for (i = 0; i < n; i = i + 1) {
+        dst[i] = dst[i] + src[i];
+    }
+}
+
+void fill(char *dst, int n) {
+    int i;
+    for (i = 1; i <= n; i = 1 + i)
+        dst[i] = -5;
+}
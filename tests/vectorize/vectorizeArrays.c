@@ -0,0 +1,12 @@
+// args: -fvectorize -fstats
+int main(void) {
+    int a[100];
+    int b[100];
+    int i;
+    int k = 3;
+    for (i = 0; i < 100; i = i + 1) {
+        a[i] = b[i] + k;
+        b[i] = ~a[i] ^ (b[i] << 2);
+    }
+    return a[7];
+}
@@ -0,0 +1,31 @@
+// args: -fvectorize -fstats
+int f(int x);
+
+void reject(int *a, int *b, char *c, short *d, short *e, int n) {
+    int i;
+    int s = 0;
+    for (i = 0; i < n; i = i + 1) {
+        a[i] = a[i] * b[i];
+    }
+    for (i = 0; i < n; i = i + 2) {
+        a[i] = b[i];
+    }
+    for (i = 0; i < n; i = i + 1) {
+        a[i] = f(b[i]);
+    }
+    for (i = 0; i < n; i = i + 1) {
+        s = s + a[i];
+    }
+    for (i = 0; i < n; i = i + 1) {
+        c[i] = c[i] << 1;
+    }
+    for (i = 0; i < n; i = i + 1) {
+        a[i] = c[i];
+    }
+    for (i = 0; i < n; i = i + 1) {
+        a[i] = b[i + 1];
+    }
+    for (i = 0; i < n; i = i + 1) {
+        d[i] = (d[i] + e[i]) >> 1;
+    }
+}
@@ -0,0 +1,7 @@
+// args: -fvectorize -fstats
+void scale(short *dst, short *a, short *b, int n) {
+    int i;
+    for (i = 0; i < n; i = i + 1) {
+        dst[i] = a[i] * b[i] - (a[i] >> 1);
+    }
+}
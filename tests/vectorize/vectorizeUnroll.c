@@ -0,0 +1,17 @@
+// args: -funroll -fvectorize -fstats
+int main(void) {
+    int a[64];
+    int b[64];
+    int c[70];
+    int i;
+    for (i = 0; i < 64; i = i + 1) {
+        a[i] = b[i] + 1;
+    }
+    for (i = 0; i < 8; i = i + 1) {
+        b[i] = i;
+    }
+    for (i = 0; i < 70; i = i + 1) {
+        c[i] = c[i] / 3;
+    }
+    return a[3];
+}
@@ -8,20 +8,28 @@ const char *tTypeName(token_type_t type) {
   case TOK_RPAREN:     return ")";
   case TOK_LBRACE:     return "{";
   case TOK_RBRACE:     return "}";
+  case TOK_LBRACKET:   return "[";
+  case TOK_RBRACKET:   return "]";
   case TOK_IDENT:      return "identifier";
   case TOK_INT:        return "int";
   case TOK_INT_LIT:    return "integer literal";
   case TOK_VOID:       return "void";
   case TOK_CHAR:       return "char";
   case TOK_SHORT:      return "short";
+  case TOK_CONST:      return "const";
+  case TOK_STATIC:     return "static";
   case TOK_RETURN:     return "return";
   case TOK_WHILE:      return "while";
   case TOK_DO:         return "do";
   case TOK_FOR:        return "for";
+  case TOK_SWITCH:     return "switch";
+  case TOK_CASE:       return "case";
+  case TOK_DEFAULT:    return "default";
   case TOK_IF:         return "if";
   case TOK_BREAK:      return "break";
   case TOK_CONTINUE:   return "continue";
   case TOK_COMMA:      return ",";
+  case TOK_COLON:      return ":";
   case TOK_ASSIGN:     return "=";
   case TOK_ADD:        return "+";
   case TOK_SUB:        return "-";
@@ -63,7 +71,9 @@ bool tIsType(const token_t* t) {
   case TOK_VOID:
   case TOK_CHAR:
   case TOK_SHORT:
-  case TOK_INT:       return true;
+  case TOK_INT:
+  case TOK_CONST:
+  case TOK_STATIC:    return true;
   default:            return false;
   }
 }
@@ -124,5 +134,20 @@ bool tEqual(const token_t* a, const token_t* b) {
 }
 
 int tLineNum(const token_t* t) {
-  return t->line;
+  return (int)tLineOf(t->line);
+}
+
+uint32_t tLineOf(uint32_t line) {
+  // the line within its file
+  return (line & LINE_HEADER) ? (line & LINE_MASK) : line;
+}
+
+token_t tMake(token_type_t type, uint32_t line) {
+  // synthesized tokens borrow their spelling from the token name table
+  token_t t;
+  t.type  = type;
+  t.line  = line;
+  t.start = tTypeName(type);
+  t.end   = t.start + strlen(t.start);
+  return t;
 }
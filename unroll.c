@@ -0,0 +1,336 @@
+#include "defs.h"
+
+
+// Loop unrolling for counted for loops of the form:
+//
+//   for (i = C0; i < C1; i = i + S) body
+//
+// where i is an int local whose address is never taken and which is not
+// assigned inside the body. Loops with a small trip count are unrolled
+// completely, larger ones by opt->unrollFactor followed by a remainder loop.
+// opt->unrollBudget bounds the number of nodes an unrolled loop may produce.
+// Without 'partial' only full unrolls are done, the larger loops are left for
+// the vectorizer to widen first.
+
+
+// loops with at most this many iterations are candidates for full unrolling
+#define UNROLL_MAX_FULL 16
+
+typedef struct {
+  ast_node_p   var;     // induction variable
+  token_type_t cmp;     // comparison in the loop condition
+  int64_t      start;
+  int64_t      limit;
+  int64_t      step;
+  int64_t      trip;
+} unroll_loop_t;
+
+static bool unrollIsVar(ast_node_p n, ast_node_p var) {
+  return n && n->type == AST_EXPR_IDENT && n->exprIdent.decl == var;
+}
+
+static bool unrollIsIntLocal(ast_node_p var) {
+
+  if (!var || var->type != AST_DECL_VAR) {
+    return false;
+  }
+
+  // must be exactly 'int'
+  ast_node_p t = var->declVar.type;
+  if (!t || t->next || !tIs(&t->declType.token, TOK_INT)) {
+    return false;
+  }
+
+  // must not be a global
+  return !var->declVar.isGlobal;
+}
+
+static bool unrollAssigns(ast_node_p n, ast_node_p var) {
+  for (; n; n = n->next) {
+    if (n->type == AST_EXPR_BIN_OP &&
+        tIs(&n->exprBinOp.op, TOK_ASSIGN) &&
+        unrollIsVar(n->exprBinOp.lhs, var)) {
+      return true;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (unrollAssigns(*slots[i], var)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool unrollHasJump(ast_node_p n, bool inSwitch) {
+  // break or continue which would target the loop being unrolled
+  for (; n; n = n->next) {
+    bool sw = inSwitch;
+    switch (n->type) {
+    case AST_STMT_BREAK:
+      if (!inSwitch) {
+        return true;
+      }
+      break;
+    case AST_STMT_CONTINUE:
+      return true;
+    case AST_STMT_WHILE:
+    case AST_STMT_DO:
+    case AST_STMT_FOR:
+      // jumps inside nested loops target those loops
+      continue;
+    case AST_STMT_SWITCH:
+      // a break inside a switch only leaves the switch
+      sw = true;
+      break;
+    default:
+      break;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (unrollHasJump(*slots[i], sw)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool unrollHasStatic(ast_node_p n) {
+  // every copy of the body would get its own static local
+  for (; n; n = n->next) {
+    if (n->type == AST_DECL_VAR && aIsStatic(n->declVar.type)) {
+      return true;
+    }
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (unrollHasStatic(*slots[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static token_type_t unrollFlip(token_type_t cmp) {
+  switch (cmp) {
+  case TOK_LT:  return TOK_GT;
+  case TOK_LTE: return TOK_GTE;
+  case TOK_GT:  return TOK_LT;
+  case TOK_GTE: return TOK_LTE;
+  default:      return cmp;
+  }
+}
+
+static bool unrollTripCount(unroll_loop_t *l) {
+
+  const int64_t s = l->start;
+  const int64_t e = l->limit;
+  const int64_t d = l->step;
+
+  if (d == 0) {
+    return false;
+  }
+
+  switch (l->cmp) {
+  case TOK_LT:
+    if (d < 0) return false;
+    l->trip = (s < e) ? (e - s + d - 1) / d : 0;
+    break;
+  case TOK_LTE:
+    if (d < 0) return false;
+    l->trip = (s <= e) ? (e - s) / d + 1 : 0;
+    break;
+  case TOK_GT:
+    if (d > 0) return false;
+    l->trip = (s > e) ? (s - e - d - 1) / -d : 0;
+    break;
+  case TOK_GTE:
+    if (d > 0) return false;
+    l->trip = (s >= e) ? (s - e) / -d + 1 : 0;
+    break;
+  case TOK_NEQ:
+    if ((e - s) % d != 0 || (e - s) / d < 0) return false;
+    l->trip = (e - s) / d;
+    break;
+  default:
+    return false;
+  }
+
+  // the induction variable must not overflow on the way
+  const int64_t last = s + l->trip * d;
+  return last >= INT32_MIN && last <= INT32_MAX;
+}
+
+static bool unrollAnalyse(ast_node_p n, unroll_loop_t *l) {
+
+  ast_node_p init = n->stmtFor.init;
+  ast_node_p cond = n->stmtFor.cond;
+  ast_node_p upd  = n->stmtFor.update;
+
+  // init: i = C0
+  if (!init || init->next || init->type != AST_EXPR_BIN_OP ||
+      !tIs(&init->exprBinOp.op, TOK_ASSIGN) ||
+      init->exprBinOp.lhs->type != AST_EXPR_IDENT ||
+      !aIntLitValue(init->exprBinOp.rhs, &l->start)) {
+    return false;
+  }
+  l->var = init->exprBinOp.lhs->exprIdent.decl;
+  if (!unrollIsIntLocal(l->var)) {
+    return false;
+  }
+
+  // cond: i <op> C1 or C1 <op> i
+  if (!cond || cond->next || cond->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  l->cmp = cond->exprBinOp.op.type;
+  if (unrollIsVar(cond->exprBinOp.rhs, l->var)) {
+    l->cmp = unrollFlip(l->cmp);
+    if (!aIntLitValue(cond->exprBinOp.lhs, &l->limit)) {
+      return false;
+    }
+  }
+  else if (!unrollIsVar(cond->exprBinOp.lhs, l->var) ||
+           !aIntLitValue(cond->exprBinOp.rhs, &l->limit)) {
+    return false;
+  }
+
+  // update: i = i + S, i = S + i or i = i - S
+  if (!upd || upd->next || upd->type != AST_EXPR_BIN_OP ||
+      !tIs(&upd->exprBinOp.op, TOK_ASSIGN) ||
+      !unrollIsVar(upd->exprBinOp.lhs, l->var)) {
+    return false;
+  }
+  ast_node_p e = upd->exprBinOp.rhs;
+  if (e->type != AST_EXPR_BIN_OP) {
+    return false;
+  }
+  const bool isAdd = tIs(&e->exprBinOp.op, TOK_ADD);
+  const bool isSub = tIs(&e->exprBinOp.op, TOK_SUB);
+  if (isAdd && unrollIsVar(e->exprBinOp.rhs, l->var)) {
+    if (!aIntLitValue(e->exprBinOp.lhs, &l->step)) {
+      return false;
+    }
+  }
+  else if ((isAdd || isSub) && unrollIsVar(e->exprBinOp.lhs, l->var)) {
+    if (!aIntLitValue(e->exprBinOp.rhs, &l->step)) {
+      return false;
+    }
+    l->step = isSub ? -l->step : l->step;
+  }
+  else {
+    return false;
+  }
+
+  // the body must leave the induction variable alone
+  if (unrollAssigns(n->stmtFor.body, l->var) ||
+      unrollHasJump(n->stmtFor.body, false) ||
+      unrollHasStatic(n->stmtFor.body) ||
+      l->var->declVar.isEscaping) {
+    return false;
+  }
+
+  return unrollTripCount(l);
+}
+
+static ast_node_p unrollCopies(ast_node_p n, ast_node_p out, int64_t count) {
+  // append count copies of 'body; update' to out
+  for (int64_t i = 0; i < count; ++i) {
+    if (n->stmtFor.body) {
+      out = aNodeInsert(out, aNodeClone(n->stmtFor.body));
+    }
+    out = aNodeInsert(out, aNodeClone(n->stmtFor.update));
+  }
+  return out;
+}
+
+static void unrollLoop(ast_node_p n, const opt_t *opt, bool partial) {
+
+  // not worth growing loops the profile says never run, and a vector loop
+  // steps by more than its body shows
+  if (n->decorate.isCold || n->stmtFor.lanes) {
+    return;
+  }
+
+  unroll_loop_t l;
+  if (!unrollAnalyse(n, &l)) {
+    return;
+  }
+
+  const uint32_t line   = n->stmtFor.token.line;
+  const int64_t  size   = aNodeCount(n->stmtFor.body) +
+                          aNodeCount(n->stmtFor.update);
+  const int64_t  factor = opt->unrollFactor;
+
+  ast_node_p out = NULL;
+
+  if (l.trip <= UNROLL_MAX_FULL && l.trip * size <= opt->unrollBudget) {
+
+    // full unroll
+    out = aNodeInsert(out, n->stmtFor.init);
+    out = unrollCopies(n, out, l.trip);
+  }
+  else if (partial && factor > 1 && l.trip >= factor * 2 &&
+           factor * size <= opt->unrollBudget) {
+
+    // partial unroll with a remainder loop
+    const int64_t bound = l.start + (l.trip / factor) * factor * l.step;
+
+    ast_node_p body = aNodeNew(AST_STMT_COMPOUND);
+    body->stmtCompound.stmt = unrollCopies(n, NULL, factor);
+
+    ast_node_p loop = aNodeNew(AST_STMT_FOR);
+    loop->stmtFor.token = n->stmtFor.token;
+    loop->stmtFor.cond  = aBinOpNew(l.step > 0 ? TOK_LT : TOK_GT,
+                                    aIdentNew(l.var, line),
+                                    aIntLitNew(bound, line),
+                                    line);
+    loop->stmtFor.body  = body;
+
+    out = aNodeInsert(out, n->stmtFor.init);
+    out = aNodeInsert(out, loop);
+
+    if (l.trip % factor) {
+      ast_node_p rem = aNodeNew(AST_STMT_FOR);
+      rem->stmtFor = n->stmtFor;
+      rem->stmtFor.init = NULL;
+      out = aNodeInsert(out, rem);
+    }
+  }
+  else {
+    return;
+  }
+
+  ast_node_p c = aNodeNew(AST_STMT_COMPOUND);
+  c->stmtCompound.stmt = out;
+  aNodeReplace(n, c);
+}
+
+static void unrollWalk(ast_node_p n, const opt_t *opt, bool partial) {
+  for (; n; n = n->next) {
+
+    // unroll inner loops first so the budget sees their final size
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      unrollWalk(*slots[i], opt, partial);
+    }
+
+    if (n->type == AST_STMT_FOR) {
+      unrollLoop(n, opt, partial);
+    }
+  }
+}
+
+void oUnroll(ast_node_p n, const opt_t *opt, bool partial) {
+  assert(n->type == AST_ROOT);
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type == AST_DECL_FUNC) {
+      unrollWalk(f->declFunc.body, opt, partial);
+    }
+  }
+}
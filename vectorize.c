@@ -0,0 +1,367 @@
+#include "defs.h"
+
+
+// Loop vectorization for SSE2.
+//
+// Innermost counted loops with a unit stride whose body only stores
+// element-wise expressions:
+//
+//   for (i = C0; i < n; i = i + 1) a[i] = b[i] + k;
+//
+// are strip mined into a loop processing one 16 byte register worth of
+// elements per iteration, decorated with its lane count, followed by the
+// original loop which finishes the remaining elements:
+//
+//   i = C0;
+//   if (no overlap) for (; i < n - 3; i = i + 4) a[i] = b[i] + k;  vector 4
+//   for (; i < n; i = i + 1) a[i] = b[i] + k;
+//
+// Pointers which may refer to the same memory are compared at run time and
+// the vector loop is skipped when they are closer than a register, the
+// scalar loop then does all the work. Distinct arrays never overlap.
+//
+// Only operations SSE2 has packed forms of are accepted: add, sub, and, or,
+// xor, negate and not on 8, 16 and 32 bit elements, shifts by a constant on
+// 16 and 32 bit elements and multiplies on 16 bit elements.
+
+
+// bytes in an SSE register
+#define VEC_BYTES 16
+
+// distinct arrays and pointers a loop may access
+#define VEC_MAX_ACCESS 8
+
+typedef struct {
+  ast_node_p decl;      // array or pointer indexed
+  bool       isStore;
+} vec_access_t;
+
+typedef struct {
+  ast_node_p   var;     // induction variable
+  uint32_t     width;   // bytes per element
+  bool         hasMul;
+  int64_t      maxShift;
+  uint32_t     numAccess;
+  vec_access_t access[VEC_MAX_ACCESS];
+} vec_loop_t;
+
+typedef struct {
+  uint32_t loops;
+  uint32_t checks;
+} vec_t;
+
+static bool vecIsVar(ast_node_p n, ast_node_p var) {
+  return n && n->type == AST_EXPR_IDENT && n->exprIdent.decl == var;
+}
+
+static bool vecIsScalar(ast_node_p decl) {
+  // a variable no store through a pointer can reach
+  return decl && decl->type == AST_DECL_VAR && decl->decorate.type &&
+         !decl->declVar.isEscaping &&
+         !decl->decorate.type->ptrLevel && !decl->decorate.type->count;
+}
+
+static bool vecIsInvariant(vec_loop_t *l, ast_node_p n) {
+  // the body only stores to elements so scalars other than i never change
+  if (n->type == AST_EXPR_INT_LIT) {
+    return true;
+  }
+  return n->type == AST_EXPR_IDENT && n->exprIdent.decl != l->var &&
+         vecIsScalar(n->exprIdent.decl);
+}
+
+static bool vecAccess(vec_loop_t *l, ast_node_p n, bool isStore) {
+
+  // a[i] with a an array or a pointer that is not itself stored to
+  ast_node_p base = n->exprIndex.base;
+  if (!vecIsVar(n->exprIndex.index, l->var) || base->type != AST_EXPR_IDENT) {
+    return false;
+  }
+  ast_node_p d = base->exprIdent.decl;
+  if (!d || d->type != AST_DECL_VAR || !d->decorate.type ||
+      (d->declVar.isEscaping && !d->decorate.type->count)) {
+    return false;
+  }
+
+  // every lane has to be the same size
+  const ast_type_t *t = n->decorate.type;
+  if (!t || t->ptrLevel || t->isVoid ||
+      (t->width != 1 && t->width != 2 && t->width != 4) ||
+      (l->width && l->width != t->width)) {
+    return false;
+  }
+  l->width = t->width;
+
+  for (uint32_t i = 0; i < l->numAccess; ++i) {
+    if (l->access[i].decl == d) {
+      l->access[i].isStore |= isStore;
+      return true;
+    }
+  }
+  if (l->numAccess == VEC_MAX_ACCESS) {
+    return false;
+  }
+  l->access[l->numAccess].decl    = d;
+  l->access[l->numAccess].isStore = isStore;
+  l->numAccess++;
+  return true;
+}
+
+static bool vecExpr(vec_loop_t *l, ast_node_p n) {
+
+  int64_t c;
+
+  switch (n->type) {
+  case AST_EXPR_INT_LIT:
+  case AST_EXPR_IDENT:
+    return vecIsInvariant(l, n);
+  case AST_EXPR_INDEX:
+    return vecAccess(l, n, false);
+  case AST_EXPR_UNARY_OP:
+    return (tIs(&n->exprUnaryOp.op, TOK_SUB) ||
+            tIs(&n->exprUnaryOp.op, TOK_BIT_NOT)) &&
+           vecExpr(l, n->exprUnaryOp.rhs);
+  case AST_EXPR_BIN_OP:
+    if (n->exprBinOp.scale) {
+      return false;
+    }
+    switch (n->exprBinOp.op.type) {
+    case TOK_MUL:
+      l->hasMul = true;
+      // fall through
+    case TOK_ADD:
+    case TOK_SUB:
+    case TOK_BIT_AND:
+    case TOK_BIT_OR:
+    case TOK_BIT_XOR:
+      return vecExpr(l, n->exprBinOp.lhs) && vecExpr(l, n->exprBinOp.rhs);
+    case TOK_SHL:
+    case TOK_SHR:
+      // every lane shifts by the same count
+      if (!aIntLitValue(n->exprBinOp.rhs, &c) || c < 0) {
+        return false;
+      }
+      // C shifts right in int, bits a narrow lane lost on the way would
+      // still come down, so only an element as loaded can be shifted
+      if (tIs(&n->exprBinOp.op, TOK_SHR) && l->width < 4 &&
+          n->exprBinOp.lhs->type != AST_EXPR_INDEX) {
+        return false;
+      }
+      l->maxShift = c > l->maxShift ? c : l->maxShift;
+      return vecExpr(l, n->exprBinOp.lhs);
+    default:
+      return false;
+    }
+  default:
+    return false;
+  }
+}
+
+static bool vecBody(vec_loop_t *l, ast_node_p n) {
+
+  if (n && n->type == AST_STMT_COMPOUND) {
+    n = n->stmtCompound.stmt;
+  }
+  if (!n) {
+    return false;
+  }
+
+  // a[i] = e; ...
+  for (; n; n = n->next) {
+    if (n->type != AST_EXPR_BIN_OP || !tIs(&n->exprBinOp.op, TOK_ASSIGN) ||
+        n->exprBinOp.lhs->type != AST_EXPR_INDEX ||
+        !vecAccess(l, n->exprBinOp.lhs, true) ||
+        !vecExpr(l, n->exprBinOp.rhs)) {
+      return false;
+    }
+  }
+
+  // operations without a packed form for this element size
+  if (l->hasMul && l->width != 2) {
+    return false;
+  }
+  if (l->maxShift && (l->width == 1 || l->maxShift >= l->width * 8)) {
+    return false;
+  }
+  return true;
+}
+
+static bool vecAnalyse(vec_loop_t *l, ast_node_p n) {
+
+  ast_node_p init = n->stmtFor.init;
+  ast_node_p cond = n->stmtFor.cond;
+  ast_node_p upd  = n->stmtFor.update;
+
+  // init: i = e
+  if (!init || init->next || init->type != AST_EXPR_BIN_OP ||
+      !tIs(&init->exprBinOp.op, TOK_ASSIGN) ||
+      init->exprBinOp.lhs->type != AST_EXPR_IDENT) {
+    return false;
+  }
+  l->var = init->exprBinOp.lhs->exprIdent.decl;
+  if (!vecIsScalar(l->var)) {
+    return false;
+  }
+
+  // cond: i < n or i <= n
+  if (!cond || cond->next || cond->type != AST_EXPR_BIN_OP ||
+      (!tIs(&cond->exprBinOp.op, TOK_LT) &&
+       !tIs(&cond->exprBinOp.op, TOK_LTE)) ||
+      !vecIsVar(cond->exprBinOp.lhs, l->var) ||
+      !vecIsInvariant(l, cond->exprBinOp.rhs)) {
+    return false;
+  }
+
+  // update: i = i + 1 or i = 1 + i
+  int64_t step = 0;
+  if (!upd || upd->next || upd->type != AST_EXPR_BIN_OP ||
+      !tIs(&upd->exprBinOp.op, TOK_ASSIGN) ||
+      !vecIsVar(upd->exprBinOp.lhs, l->var)) {
+    return false;
+  }
+  ast_node_p e = upd->exprBinOp.rhs;
+  if (e->type != AST_EXPR_BIN_OP || !tIs(&e->exprBinOp.op, TOK_ADD) ||
+      !((vecIsVar(e->exprBinOp.lhs, l->var) &&
+         aIntLitValue(e->exprBinOp.rhs, &step)) ||
+        (vecIsVar(e->exprBinOp.rhs, l->var) &&
+         aIntLitValue(e->exprBinOp.lhs, &step))) ||
+      step != 1) {
+    return false;
+  }
+
+  return vecBody(l, n->stmtFor.body);
+}
+
+static ast_node_p vecApart(vec_loop_t *l, ast_node_p x, ast_node_p y,
+                           int64_t lanes, uint32_t line) {
+  // x - y >= lanes || y - x >= lanes || x == y
+  ast_node_p xy = aBinOpNew(TOK_SUB, aIdentNew(x, line), aIdentNew(y, line), line);
+  ast_node_p yx = aBinOpNew(TOK_SUB, aIdentNew(y, line), aIdentNew(x, line), line);
+  xy->exprBinOp.scale = l->width;
+  yx->exprBinOp.scale = l->width;
+  ast_node_p e = aBinOpNew(TOK_LOG_OR,
+    aBinOpNew(TOK_GTE, xy, aIntLitNew(lanes, line), line),
+    aBinOpNew(TOK_GTE, yx, aIntLitNew(lanes, line), line),
+    line);
+  return aBinOpNew(TOK_LOG_OR, e,
+    aBinOpNew(TOK_EQ, aIdentNew(x, line), aIdentNew(y, line), line),
+    line);
+}
+
+static ast_node_p vecCheck(vec_t *v, vec_loop_t *l, int64_t lanes,
+                           uint32_t line) {
+
+  // every pair that is written through and may share memory
+  ast_node_p check = NULL;
+  for (uint32_t i = 0; i < l->numAccess; ++i) {
+    for (uint32_t j = i + 1; j < l->numAccess; ++j) {
+      vec_access_t *a = &l->access[i];
+      vec_access_t *b = &l->access[j];
+      if ((!a->isStore && !b->isStore) ||
+          (a->decl->decorate.type->count && b->decl->decorate.type->count)) {
+        continue;
+      }
+      ast_node_p e = vecApart(l, a->decl, b->decl, lanes, line);
+      check = check ? aBinOpNew(TOK_LOG_AND, check, e, line) : e;
+      v->checks++;
+    }
+  }
+  return check;
+}
+
+static void vecLoop(vec_t *v, ast_node_p n) {
+
+  if (n->decorate.isCold) {
+    return;
+  }
+
+  vec_loop_t l;
+  memset(&l, 0, sizeof(l));
+  if (!vecAnalyse(&l, n)) {
+    return;
+  }
+
+  const uint32_t line  = n->stmtFor.token.line;
+  const int64_t  lanes = VEC_BYTES / l.width;
+
+  // the last full vector starts at most lanes - 1 elements before the limit
+  ast_node_p limit = n->stmtFor.cond->exprBinOp.rhs;
+  ast_node_p bound = NULL;
+  int64_t c;
+  if (aIntLitValue(limit, &c)) {
+    bound = aIntNew(c - (lanes - 1), line);
+  }
+  else {
+    bound = aBinOpNew(TOK_SUB, aIdentNew(limit->exprIdent.decl, line),
+                      aIntLitNew(lanes - 1, line), line);
+  }
+
+  ast_node_p vec = aNodeNew(AST_STMT_FOR);
+  vec->stmtFor.token  = n->stmtFor.token;
+  vec->stmtFor.cond   = aBinOpNew(n->stmtFor.cond->exprBinOp.op.type,
+                                  aIdentNew(l.var, line), bound, line);
+  vec->stmtFor.update = aBinOpNew(TOK_ASSIGN, aIdentNew(l.var, line),
+    aBinOpNew(TOK_ADD, aIdentNew(l.var, line), aIntLitNew(lanes, line), line),
+    line);
+  vec->stmtFor.body   = aNodeClone(n->stmtFor.body);
+  vec->stmtFor.lanes  = (uint32_t)lanes;
+
+  ast_node_p check = vecCheck(v, &l, lanes, line);
+  if (check) {
+    ast_node_p i = aNodeNew(AST_STMT_IF);
+    i->stmtIf.token  = tMake(TOK_IF, line);
+    i->stmtIf.expr   = check;
+    i->stmtIf.isTrue = vec;
+    vec = i;
+  }
+
+  // the original loop finishes off the remainder
+  ast_node_p rem = aNodeNew(AST_STMT_FOR);
+  rem->stmtFor = n->stmtFor;
+  rem->stmtFor.init = NULL;
+
+  ast_node_p out = NULL;
+  out = aNodeInsert(out, n->stmtFor.init);
+  out = aNodeInsert(out, vec);
+  out = aNodeInsert(out, rem);
+
+  ast_node_p comp = aNodeNew(AST_STMT_COMPOUND);
+  comp->stmtCompound.stmt = out;
+  aNodeReplace(n, comp);
+
+  v->loops++;
+}
+
+static void vecWalk(vec_t *v, ast_node_p n) {
+  for (; n; n = n->next) {
+
+    ast_node_p *slots[AST_MAX_CHILDREN];
+    const uint32_t count = aChildren(n, slots);
+    for (uint32_t i = 0; i < count; ++i) {
+      vecWalk(v, *slots[i]);
+    }
+
+    if (n->type == AST_STMT_FOR) {
+      vecLoop(v, n);
+    }
+  }
+}
+
+void oVectorize(ast_node_p n, const opt_t *opt) {
+
+  assert(n->type == AST_ROOT);
+
+  vec_t v;
+  memset(&v, 0, sizeof(v));
+
+  for (ast_node_p f = n->root.node; f; f = f->next) {
+    if (f->type == AST_DECL_FUNC) {
+      vecWalk(&v, f->declFunc.body);
+    }
+  }
+
+  if (opt->stats) {
+    fprintf(opt->out, "vectorize: %u loops, %u alias checks\n",
+      v.loops, v.checks);
+  }
+}